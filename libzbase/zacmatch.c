@@ -0,0 +1,371 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "zacmatch.h"
+#include "sim_log.h"
+
+
+/** make room for @depth states, new rows have no edge and no output */
+static
+int zacm_states_grow(zacmatch_t *acm, uint32_t *depth, uint32_t need)
+{
+    uint32_t *trans, *out_head, n = *depth;
+
+    if (need <= n) {
+        return 1;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    if ((uint64_t)n * acm->nclass >= ZACM_EMIT) {
+        xerr("<zacmatch> too many states, %u x %u classes\n", n, acm->nclass);
+        return 0;
+    }
+    trans = realloc(acm->trans, sizeof(uint32_t) * n * acm->nclass);
+    if (trans) {
+        acm->trans = trans;
+    }
+    out_head = realloc(acm->out_head, sizeof(uint32_t) * n);
+    if (out_head) {
+        acm->out_head = out_head;
+    }
+    if (!trans || !out_head) {
+        xerr("<zacmatch> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    memset(trans + (size_t)*depth * acm->nclass, 0, sizeof(uint32_t) * (n - *depth) * acm->nclass);
+    memset(out_head + *depth, 0xff, sizeof(uint32_t) * (n - *depth));
+    *depth = n;
+    return 1;
+}
+
+/** add pattern @p to the trie, state ids in trans, 0 for no edge */
+static
+int zacm_insert(zacmatch_t *acm, uint32_t *depth, zqidx_t p, const uint8_t *str, uint32_t len)
+{
+    uint32_t s = 0, i, *t;
+
+    for (i=0; i<len; ++i) {
+        t = &acm->trans[(size_t)s * acm->nclass + acm->cls[str[i]]];
+        if (!*t) {
+            if (!zacm_states_grow(acm, depth, acm->nstate + 1)) {
+                return 0;
+            }
+            t = &acm->trans[(size_t)s * acm->nclass + acm->cls[str[i]]];
+            *t = acm->nstate++;
+        }
+        s = *t;
+    }
+    acm->pat_next[p] = acm->out_head[s];
+    acm->out_head[s] = p;
+    return 1;
+}
+
+/** fail links by BFS, folded into trans; then dict links and rows */
+static
+int zacm_link(zacmatch_t *acm)
+{
+    uint32_t nclass = acm->nclass, nstate = acm->nstate;
+    uint32_t *queue = malloc(sizeof(uint32_t) * nstate);
+    uint32_t *fail  = malloc(sizeof(uint32_t) * nstate);
+    uint32_t *trans = acm->trans, head = 0, tail = 0, s, t, f, c;
+    size_t i;
+
+    acm->dict = calloc(nstate, sizeof(uint32_t));
+    if (!queue || !fail || !acm->dict) {
+        xerr("<zacmatch> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(queue);
+        SIM_FREEP(fail);
+        return 0;
+    }
+
+    fail[0] = 0;
+    for (c=0; c<nclass; ++c) {
+        if ((t = trans[c])) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+        for (c=0; c<nclass; ++c) {
+            t = trans[(size_t)s * nclass + c];
+            if (t) {
+                fail[t] = trans[(size_t)f * nclass + c];
+                queue[tail++] = t;
+            } else {
+                trans[(size_t)s * nclass + c] = trans[(size_t)f * nclass + c];
+            }
+        }
+        /* the root never has output, so 0 ends the dict chain */
+        acm->dict[s] = acm->out_head[f] != ZACM_NIL ? f : acm->dict[f];
+    }
+
+    for (i=0; i<(size_t)nstate * nclass; ++i) {
+        t = trans[i];
+        trans[i] = t * nclass |
+            ((acm->out_head[t] != ZACM_NIL || acm->dict[t]) ? ZACM_EMIT : 0);
+    }
+
+    free(queue);
+    free(fail);
+    return 1;
+}
+
+/** SIMD prefilter sets, used only if small */
+static
+void zacm_prefilter_init(zacmatch_t *acm, const uint8_t second[256])
+{
+    const uint8_t *set[2] = {acm->first, second};
+    uint32_t k, n;
+    int b;
+
+    for (k=0; k<2; ++k) {
+        for (b=0, n=0; b<256; ++b) {
+            n += set[k][b];
+        }
+        if (n > ZACM_PF_MAX || (k == 1 && acm->min_len < 2)) {
+            continue;
+        }
+        for (b=0, n=0; b<256; ++b) {
+            if (set[k][b]) {
+                memset(acm->pf_vec[k][n++], b, 16);
+            }
+        }
+        acm->pf_n[k] = n;
+    }
+}
+
+zacmatch_t* zacmatch_build(zstrq_t *patterns)
+{
+    zacmatch_t *acm = calloc(1, sizeof(zacmatch_t));
+    zcount_t npat = zstrq_get_str_count(patterns);
+    uint8_t used[256] = {0}, second[256] = {0};
+    const uint8_t *str;
+    uint32_t depth = 256, len, c;
+    zqidx_t p;
+    int b;
+
+    if (!acm) {
+        xerr("<zacmatch> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    acm->npat     = npat;
+    acm->nstate   = 1;
+    acm->min_len  = UINT32_MAX;
+    acm->pat_len  = malloc(sizeof(uint32_t) * MAX(npat, 1));
+    acm->pat_next = malloc(sizeof(uint32_t) * MAX(npat, 1));
+    if (!acm->pat_len || !acm->pat_next) {
+        xerr("<zacmatch> %s() failed!\n", __FUNCTION__);
+        zacmatch_free(acm);
+        return 0;
+    }
+
+    /* byte classes, 0 for the bytes no pattern has */
+    for (p=0; p<npat; ++p) {
+        str = (const uint8_t *)zstrq_get_str_base(patterns, p);
+        len = zstrq_get_str_size(patterns, p);
+        acm->pat_len[p]  = len;
+        acm->pat_next[p] = ZACM_NIL;
+        for (c=0; c<len; ++c) {
+            used[str[c]] = 1;
+        }
+        if (len) {
+            acm->first[str[0]] = 1;
+            acm->min_len = MIN(acm->min_len, len);
+        }
+        if (len > 1) {
+            second[str[1]] = 1;
+        }
+    }
+    for (b=0, c=0; b<256; ++b) {
+        c += used[b];
+    }
+    acm->nclass = c < 256 ? 1 : 0;          /* no class 0 if all bytes are used */
+    for (b=0; b<256; ++b) {
+        acm->cls[b] = used[b] ? (uint8_t)acm->nclass++ : 0;
+    }
+    if (acm->min_len == UINT32_MAX) {
+        acm->min_len = 0;
+    }
+
+    acm->trans    = calloc((size_t)depth * acm->nclass, sizeof(uint32_t));
+    acm->out_head = malloc(sizeof(uint32_t) * depth);
+    if (!acm->trans || !acm->out_head) {
+        xerr("<zacmatch> %s() failed!\n", __FUNCTION__);
+        zacmatch_free(acm);
+        return 0;
+    }
+    memset(acm->out_head, 0xff, sizeof(uint32_t) * depth);
+
+    for (p=0; p<npat; ++p) {
+        if (acm->pat_len[p] &&
+            !zacm_insert(acm, &depth, p, (const uint8_t *)zstrq_get_str_base(patterns, p), acm->pat_len[p])) {
+            zacmatch_free(acm);
+            return 0;
+        }
+    }
+    if (!zacm_link(acm)) {
+        zacmatch_free(acm);
+        return 0;
+    }
+    zacm_prefilter_init(acm, second);
+
+    return acm;
+}
+
+void zacmatch_free(zacmatch_t *acm)
+{
+    if (acm) {
+        SIM_FREEP(acm->trans);
+        SIM_FREEP(acm->out_head);
+        SIM_FREEP(acm->dict);
+        SIM_FREEP(acm->pat_next);
+        SIM_FREEP(acm->pat_len);
+        free(acm);
+    }
+}
+
+zcount_t zacmatch_get_pat_count(zacmatch_t *acm)
+{
+    return acm->npat;
+}
+
+uint32_t zacmatch_get_pat_size(zacmatch_t *acm, zqidx_t pat)
+{
+    return (pat >= 0 && pat < acm->npat) ? acm->pat_len[pat] : 0;
+}
+
+uint64_t zacmatch_get_mem_size(zacmatch_t *acm)
+{
+    return sizeof(zacmatch_t) + sizeof(uint32_t) * (
+           (uint64_t)acm->nstate * acm->nclass + 2ull * acm->nstate + 2ull * acm->npat);
+}
+
+#if defined(__SSE2__)
+/** bit i set if @p[i] is in set @k */
+static inline
+uint32_t zacm_pf_mask(const zacmatch_t *acm, int k, const uint8_t *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i e = _mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i *)acm->pf_vec[k][0]));
+    uint32_t i;
+    for (i=1; i<acm->pf_n[k]; ++i) {
+        e = _mm_or_si128(e, _mm_cmpeq_epi8(v, _mm_loadu_si128((const __m128i *)acm->pf_vec[k][i])));
+    }
+    return (uint32_t)_mm_movemask_epi8(e);
+}
+#endif
+
+/** @return the first position from @p where a match may start, @end if none */
+static inline
+const uint8_t* zacm_skip(const zacmatch_t *acm, const uint8_t *p, const uint8_t *end)
+{
+#if defined(__SSE2__)
+    if (acm->pf_n[0] || acm->pf_n[1]) {
+        /* 17 bytes for the pair test at offset 1 */
+        while (end - p >= 17) {
+            uint32_t m = 0xffff;
+            if (acm->pf_n[0]) {
+                m &= zacm_pf_mask(acm, 0, p);
+            }
+            if (acm->pf_n[1]) {
+                m &= zacm_pf_mask(acm, 1, p + 1);
+            }
+            if (m) {
+                return p + __builtin_ctz(m);
+            }
+            p += 16;
+        }
+    }
+#endif
+    while (p < end && !acm->first[*p]) {
+        ++p;
+    }
+    return p;
+}
+
+/** report the patterns ending at state @row, set @stop if told so */
+static
+zcount_t zacm_report(const zacmatch_t *acm, uint32_t row, uint64_t end,
+                    zacm_match_func_t func, void *ctx, int *stop)
+{
+    uint32_t s = row / acm->nclass, p;
+    zcount_t n = 0;
+
+    for (; s; s=acm->dict[s]) {
+        for (p=acm->out_head[s]; p!=ZACM_NIL; p=acm->pat_next[p]) {
+            n += 1;
+            if (func && func(ctx, (zqidx_t)p, end)) {
+                *stop = 1;
+                return n;
+            }
+        }
+    }
+    return n;
+}
+
+void zacmatch_stream_init(zacm_stream_t *st)
+{
+    st->row = 0;
+    st->off = 0;
+}
+
+zcount_t zacmatch_stream_feed(zacmatch_t *acm, zacm_stream_t *st,
+                    const zsq_char_t *buf, size_t size,
+                    zacm_match_func_t func, void *ctx)
+{
+    const uint8_t *base = (const uint8_t *)buf, *p = base, *end = base + size;
+    const uint32_t *trans = acm->trans;
+    uint32_t row = st->row, v;
+    zcount_t n = 0;
+    int stop = 0;
+
+    while (p < end) {
+        if (row == 0 && (p = zacm_skip(acm, p, end)) == end) {
+            break;
+        }
+        v = trans[row + acm->cls[*p++]];
+        row = v & ~ZACM_EMIT;
+        if (v & ZACM_EMIT) {
+            n += zacm_report(acm, row, st->off + (uint64_t)(p - base), func, ctx, &stop);
+            if (stop) {
+                break;
+            }
+        }
+    }
+
+    st->row  = row;
+    st->off += (uint64_t)(p - base);
+    return n;
+}
+
+zcount_t zacmatch_scan(zacmatch_t *acm, const zsq_char_t *buf, size_t size,
+                    zacm_match_func_t func, void *ctx)
+{
+    zacm_stream_t st;
+    zacmatch_stream_init(&st);
+    return zacmatch_stream_feed(acm, &st, buf, size, func, ctx);
+}
@@ -0,0 +1,104 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief multi-pattern substring matcher (Aho-Corasick) over a zstrq
+ *
+ *  -Compiled from a zstrq of patterns, a pattern is identified by its idx.
+ *  -Bytes used by no pattern share one class, the others get a class each,
+ *   so the dense DFA table (failure links folded in) is states x classes.
+ *   A table entry is the row of the next state, premultiplied, with
+ *   ZACM_EMIT set if some pattern ends there: one load per byte.
+ *  -In the root state the text is skipped with a prefilter: 16 bytes at a
+ *   time (SSE2) against the set of first bytes, and of second bytes if all
+ *   patterns have 2+ chars, when the sets are small; else by a byte table.
+ *  -A stream keeps the state between buffers, so a match may span them.
+ */
+
+#ifndef ZACMATCH_H_
+#define ZACMATCH_H_
+
+#include "zdefs.h"
+#include "zstrq.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+#define     ZACM_EMIT           (0x80000000u)   //<! in a row, some pattern ends here
+#define     ZACM_NIL            (0xffffffffu)
+#define     ZACM_PF_MAX         (8)             //<! max bytes of a SIMD prefilter set
+
+typedef struct z_ac_matcher
+{
+    uint32_t       *trans;                  //<! [row + class], row = state * nclass
+    uint8_t         cls[256];               //<! class of each byte, 0 if unused
+    uint32_t        nclass;
+    uint32_t        nstate;
+
+    uint32_t       *out_head;               //<! first pattern ending at a state
+    uint32_t       *dict;                   //<! next state on the fail chain with output
+    uint32_t       *pat_next;               //<! next pattern ending at the same state
+    uint32_t       *pat_len;
+    zcount_t        npat;
+    uint32_t        min_len;
+
+    uint8_t         first[256];             //<! 1 if a pattern starts with the byte
+    uint8_t         pf_vec[2][ZACM_PF_MAX][16]; //<! first, second bytes, splat
+    uint32_t        pf_n[2];                //<! 0 if not used
+}zacmatch_t;
+
+typedef struct z_ac_stream
+{
+    uint32_t        row;                    //<! current state
+    uint64_t        off;                    //<! bytes consumed so far
+}zacm_stream_t;
+
+/**
+ * Called for each match in end order, longer ones first at the same end.
+ * @param pat           idx in the pattern zstrq
+ * @param end           offset of the char after the match, from the stream start
+ * @return 0 to go on, else to stop the scan
+ */
+typedef int (*zacm_match_func_t)(void *ctx, zqidx_t pat, uint64_t end);
+
+
+/** empty patterns are ignored, @patterns may be freed after */
+zacmatch_t* zacmatch_build(zstrq_t *patterns);
+void        zacmatch_free(zacmatch_t *acm);
+
+zcount_t    zacmatch_get_pat_count(zacmatch_t *acm);
+uint32_t    zacmatch_get_pat_size(zacmatch_t *acm, zqidx_t pat);
+uint64_t    zacmatch_get_mem_size(zacmatch_t *acm);
+
+/** @return the count of matches reported */
+zcount_t    zacmatch_scan(zacmatch_t *acm, const zsq_char_t *buf, size_t size,
+                    zacm_match_func_t func, void *ctx);
+
+/** streaming, a stopped scan leaves @st just after the stopping match */
+void        zacmatch_stream_init(zacm_stream_t *st);
+zcount_t    zacmatch_stream_feed(zacmatch_t *acm, zacm_stream_t *st,
+                    const zsq_char_t *buf, size_t size,
+                    zacm_match_func_t func, void *ctx);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZACMATCH_H_
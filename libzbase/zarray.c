@@ -551,19 +551,20 @@ void zarray_quick_sort_iter(zarray_t *za, za_cmp_func_t func, zqidx_t start, zqi
         return;
     }
 
+    /* start/end are always in use, so raw bases, no checked access */
     zarray_elem_2_swap(za, right);
 
     while (left!=right)
     {
-        while(left<right && zarray_elem_cmp(za, func, left, za->elem_swap) <= 0) {
+        while(left<right && func(ZARRAY_ELEM_BASE(za, left), za->elem_swap) <= 0) {
             ++ left;
         }
-        zarray_set_elem_val_itnl(za, right, left);   // first bigger to right
+        memcpy(ZARRAY_ELEM_BASE(za, right), ZARRAY_ELEM_BASE(za, left), za->elem_size);  // first bigger to right
 
-        while(left<right && zarray_elem_cmp(za, func, right, za->elem_swap) >= 0) {
+        while(left<right && func(ZARRAY_ELEM_BASE(za, right), za->elem_swap) >= 0) {
             -- right;
         }
-        zarray_set_elem_val_itnl(za, left, right);   // first smaller to left
+        memcpy(ZARRAY_ELEM_BASE(za, left), ZARRAY_ELEM_BASE(za, right), za->elem_size);  // first smaller to left
     }
 
     zarray_swap_2_elem(za, right);
@@ -575,7 +576,7 @@ void zarray_quick_sort_iter(zarray_t *za, za_cmp_func_t func, zqidx_t start, zqi
 void zarray_quick_sort(zarray_t *za, za_cmp_func_t func)
 {
     zcount_t count = zarray_get_count(za);
-    if (count > 2) {
+    if (count > 1) {
         long long static_swap[8];
         if (za->elem_size > sizeof(static_swap)) {
             za->elem_swap = malloc(za->elem_size);
@@ -638,7 +639,7 @@ ZARRAY_QUICK_SORT_ITER_DEFINE(int32_t)
 void zarray_quick_sort_i32(zarray_t *za)
 {
     zcount_t count = zarray_get_count(za);
-    if (count > 2) {
+    if (count > 1) {
         ZARRAY_QUICK_SORT_ITER(int32_t, za->elem_array, 0, count-1);
     }
 }
@@ -647,7 +648,7 @@ ZARRAY_QUICK_SORT_ITER_DEFINE(uint32_t)
 void zarray_quick_sort_u32(zarray_t *za)
 {
     zcount_t count = zarray_get_count(za);
-    if (count > 2) {
+    if (count > 1) {
         ZARRAY_QUICK_SORT_ITER(uint32_t, za->elem_array, 0, count-1);
     }
 }
@@ -688,3 +689,28 @@ void zarray_print(zarray_t *za, const char *q_name, za_print_func_t func,
 
     return;
 }
+
+zqidx_t zarray_lower_bound(zarray_t *za, zaddr_t elem_base, za_cmp_func_t func)
+{
+    zqidx_t lo = 0, hi = zarray_get_count(za), mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (func(ZARRAY_ELEM_BASE(za, mid), elem_base) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+zqidx_t zarray_bsearch_qidx(zarray_t *za, zaddr_t elem_base, za_cmp_func_t func)
+{
+    zqidx_t qidx = zarray_lower_bound(za, elem_base, func);
+    if (qidx < zarray_get_count(za) && 
+        0 == func(ZARRAY_ELEM_BASE(za, qidx), elem_base)) {
+        return qidx;
+    }
+    return -1;
+}
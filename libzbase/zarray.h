@@ -154,6 +154,14 @@ void        zarray_quick_sort(zarray_t *za, za_cmp_func_t func);
 void        zarray_quick_sort_i32(zarray_t *za);
 void        zarray_quick_sort_u32(zarray_t *za);
 
+/**
+ * Binary search on a sorted array.
+ * lower_bound @return the first qidx with za[qidx] >= @elem_base, or count
+ * bsearch_qidx @return the qidx of a match or -1
+ */
+zqidx_t     zarray_lower_bound(zarray_t *za, zaddr_t elem_base, za_cmp_func_t func);
+zqidx_t     zarray_bsearch_qidx(zarray_t *za, zaddr_t elem_base, za_cmp_func_t func);
+
 
 typedef void  (*za_print_func_t)  (zqidx_t idx, zaddr_t elem_base);
 void        zarray_print(zarray_t *za, const char *q_name, za_print_func_t func,
@@ -0,0 +1,371 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include "zbqueue.h"
+#include "sim_log.h"
+
+#ifdef ZBQUEUE_USE_FUTEX
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+
+static
+int64_t zbq_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @return absolute deadline in ns, or -1 for no deadline */
+static
+int64_t zbq_deadline(int timeout_ms)
+{
+    return timeout_ms < 0 ? -1 : zbq_now_ns() + (int64_t)timeout_ms * 1000000;
+}
+
+static
+int zevcnt_init(zevcnt_t *ev)
+{
+    atomic_init(&ev->seq, 0);
+    atomic_init(&ev->waiters, 0);
+#ifndef ZBQUEUE_USE_FUTEX
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        if (pthread_mutex_init(&ev->lock, 0) || pthread_cond_init(&ev->cond, &attr)) {
+            pthread_condattr_destroy(&attr);
+            return 0;
+        }
+        pthread_condattr_destroy(&attr);
+    }
+#endif
+    return 1;
+}
+
+static
+void zevcnt_destroy(zevcnt_t *ev)
+{
+#ifndef ZBQUEUE_USE_FUTEX
+    pthread_cond_destroy(&ev->cond);
+    pthread_mutex_destroy(&ev->lock);
+#endif
+}
+
+/**
+ * Register as a waiter. The caller must re-check its condition after
+ * this and then either zevcnt_cancel() or zevcnt_wait() with the key.
+ */
+static
+unsigned zevcnt_prepare(zevcnt_t *ev)
+{
+    atomic_fetch_add_explicit(&ev->waiters, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    return atomic_load_explicit(&ev->seq, memory_order_acquire);
+}
+
+static
+void zevcnt_cancel(zevcnt_t *ev)
+{
+    atomic_fetch_sub_explicit(&ev->waiters, 1, memory_order_relaxed);
+}
+
+/** @return 0 if @deadline_ns passed, else 1 (woken up, maybe spuriously) */
+static
+int zevcnt_wait(zevcnt_t *ev, unsigned key, int64_t deadline_ns)
+{
+    int ret = 1;
+#ifdef ZBQUEUE_USE_FUTEX
+    struct timespec ts, *pts = 0;
+    if (deadline_ns >= 0) {
+        int64_t left = deadline_ns - zbq_now_ns();
+        if (left <= 0) {
+            zevcnt_cancel(ev);
+            return 0;
+        }
+        ts.tv_sec  = left / 1000000000;
+        ts.tv_nsec = left % 1000000000;
+        pts = &ts;
+    }
+    if (syscall(SYS_futex, (uint32_t *)&ev->seq, FUTEX_WAIT_PRIVATE, key, pts, 0, 0) < 0) {
+        ret = (errno != ETIMEDOUT);
+    }
+#else
+    pthread_mutex_lock(&ev->lock);
+    while (atomic_load_explicit(&ev->seq, memory_order_relaxed) == key) {
+        if (deadline_ns < 0) {
+            pthread_cond_wait(&ev->cond, &ev->lock);
+        } else {
+            struct timespec ts;
+            ts.tv_sec  = deadline_ns / 1000000000;
+            ts.tv_nsec = deadline_ns % 1000000000;
+            if (pthread_cond_timedwait(&ev->cond, &ev->lock, &ts) == ETIMEDOUT) {
+                ret = 0;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ev->lock);
+#endif
+    zevcnt_cancel(ev);
+    return ret;
+}
+
+/** wake up to @n waiters, no syscall if nobody is waiting */
+static
+void zevcnt_notify(zevcnt_t *ev, int n)
+{
+    if (n <= 0) {
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ev->waiters, memory_order_relaxed) == 0) {
+        return;
+    }
+
+#ifdef ZBQUEUE_USE_FUTEX
+    atomic_fetch_add_explicit(&ev->seq, 1, memory_order_release);
+    syscall(SYS_futex, (uint32_t *)&ev->seq, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+#else
+    pthread_mutex_lock(&ev->lock);
+    atomic_fetch_add_explicit(&ev->seq, 1, memory_order_release);
+    if (n == 1) {
+        pthread_cond_signal(&ev->cond);
+    } else {
+        pthread_cond_broadcast(&ev->cond);
+    }
+    pthread_mutex_unlock(&ev->lock);
+#endif
+}
+
+
+zbqueue_t* zbqueue_malloc(uint32_t elem_size, uint32_t depth)
+{
+    zbqueue_t *bq = calloc(1, sizeof(zbqueue_t));
+    if (!bq) {
+        xerr("<zbqueue> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+
+    bq->mq = zmpmcq_malloc(elem_size, depth);
+    if (!bq->mq) {
+        free(bq);
+        return 0;
+    }
+
+    if (!zevcnt_init(&bq->not_empty) || !zevcnt_init(&bq->not_full)) {
+        xerr("<zbqueue> %s() failed!\n", __FUNCTION__);
+        zmpmcq_free(bq->mq);
+        free(bq);
+        return 0;
+    }
+    atomic_init(&bq->b_closed, 0);
+    atomic_init(&bq->pushing, 0);
+
+    return bq;
+}
+
+void zbqueue_free(zbqueue_t *bq)
+{
+    if (bq) {
+        zevcnt_destroy(&bq->not_empty);
+        zevcnt_destroy(&bq->not_full);
+        zmpmcq_free(bq->mq);
+        free(bq);
+    }
+}
+
+zcount_t zbqueue_get_depth(zbqueue_t *bq)
+{
+    return zmpmcq_get_depth(bq->mq);
+}
+
+zcount_t zbqueue_get_count(zbqueue_t *bq)
+{
+    return zmpmcq_get_count(bq->mq);
+}
+
+void zbqueue_close(zbqueue_t *bq)
+{
+    atomic_store(&bq->b_closed, 1);
+    zevcnt_notify(&bq->not_empty, INT_MAX);
+    zevcnt_notify(&bq->not_full, INT_MAX);
+}
+
+int zbqueue_is_closed(zbqueue_t *bq)
+{
+    return atomic_load(&bq->b_closed);
+}
+
+/* no more elem could ever be pushed */
+static
+int zbq_is_push_done(zbqueue_t *bq)
+{
+    return atomic_load(&bq->b_closed) && atomic_load(&bq->pushing) == 0;
+}
+
+int zbqueue_is_drained(zbqueue_t *bq)
+{
+    return zbq_is_push_done(bq) && zmpmcq_get_count(bq->mq) == 0;
+}
+
+static
+int zbq_push_begin(zbqueue_t *bq)
+{
+    atomic_fetch_add(&bq->pushing, 1);
+    if (atomic_load(&bq->b_closed)) {
+        atomic_fetch_sub(&bq->pushing, 1);
+        zevcnt_notify(&bq->not_empty, INT_MAX);     /* poppers waiting to drain */
+        return 0;
+    }
+    return 1;
+}
+
+static
+void zbq_push_end(zbqueue_t *bq)
+{
+    atomic_fetch_sub(&bq->pushing, 1);
+    if (atomic_load_explicit(&bq->b_closed, memory_order_relaxed)) {
+        zevcnt_notify(&bq->not_empty, INT_MAX);
+    }
+}
+
+static
+zcount_t zbq_try_push_some(zbqueue_t *bq, const char *elems, zcount_t count)
+{
+    uint32_t elem_size = bq->mq->q.elem_size;
+    zcount_t n = 0;
+    while (n < count && zmpmcq_try_push(bq->mq, elems + n * elem_size)) {
+        ++ n;
+    }
+    return n;
+}
+
+static
+zcount_t zbq_try_pop_some(zbqueue_t *bq, char *elems, zcount_t count)
+{
+    uint32_t elem_size = bq->mq->q.elem_size;
+    zcount_t n = 0;
+    while (n < count && zmpmcq_try_pop(bq->mq, elems ? elems + n * elem_size : 0)) {
+        ++ n;
+    }
+    return n;
+}
+
+zcount_t zbqueue_push_multi(zbqueue_t *bq, const void *elems, zcount_t count, int timeout_ms)
+{
+    const char *src = elems;
+    uint32_t elem_size = bq->mq->q.elem_size;
+    int64_t  deadline = zbq_deadline(timeout_ms);
+    zcount_t pushed = 0, notified = 0;
+    unsigned key;
+
+    if (count <= 0 || !zbq_push_begin(bq)) {
+        return 0;
+    }
+
+    for (;;) {
+        pushed += zbq_try_push_some(bq, src + pushed * elem_size, count - pushed);
+        if (pushed == count || timeout_ms == 0) {
+            break;
+        }
+
+        /* full: let consumers drain what we have so far before sleeping */
+        zevcnt_notify(&bq->not_empty, pushed - notified);
+        notified = pushed;
+
+        key = zevcnt_prepare(&bq->not_full);
+        if (zmpmcq_try_push(bq->mq, src + pushed * elem_size)) {
+            zevcnt_cancel(&bq->not_full);
+            ++ pushed;
+            continue;
+        }
+        if (zbqueue_is_closed(bq)) {
+            zevcnt_cancel(&bq->not_full);
+            break;
+        }
+        if (!zevcnt_wait(&bq->not_full, key, deadline)) {
+            pushed += zbq_try_push_some(bq, src + pushed * elem_size, count - pushed);
+            break;
+        }
+    }
+
+    zevcnt_notify(&bq->not_empty, pushed - notified);
+    zbq_push_end(bq);
+    return pushed;
+}
+
+zcount_t zbqueue_push_timed(zbqueue_t *bq, const void *elem_base, int timeout_ms)
+{
+    return zbqueue_push_multi(bq, elem_base, 1, timeout_ms);
+}
+
+zcount_t zbqueue_pop_multi(zbqueue_t *bq, void *elems, zcount_t count, int timeout_ms)
+{
+    int64_t  deadline = zbq_deadline(timeout_ms);
+    zcount_t popped = 0;
+    unsigned key;
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    for (;;) {
+        popped = zbq_try_pop_some(bq, elems, count);
+        if (popped || timeout_ms == 0) {
+            break;
+        }
+        if (zbq_is_push_done(bq)) {
+            popped = zbq_try_pop_some(bq, elems, count);
+            break;
+        }
+
+        key = zevcnt_prepare(&bq->not_empty);
+        popped = zbq_try_pop_some(bq, elems, count);
+        if (popped) {
+            zevcnt_cancel(&bq->not_empty);
+            break;
+        }
+        if (zbq_is_push_done(bq)) {
+            zevcnt_cancel(&bq->not_empty);
+            popped = zbq_try_pop_some(bq, elems, count);
+            break;
+        }
+        if (!zevcnt_wait(&bq->not_empty, key, deadline)) {
+            popped = zbq_try_pop_some(bq, elems, count);
+            break;
+        }
+    }
+
+    zevcnt_notify(&bq->not_full, popped);
+    return popped;
+}
+
+zcount_t zbqueue_pop_timed(zbqueue_t *bq, void *dst_base, int timeout_ms)
+{
+    return zbqueue_pop_multi(bq, dst_base, 1, timeout_ms);
+}
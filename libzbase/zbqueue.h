@@ -0,0 +1,108 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief blocking producer/consumer queue on top of zmpmcq
+ *
+ *  -push blocks while full, pop blocks while empty, no spinning.
+ *  -Sleeping is done on an event count: futex on linux, or a
+ *   mutex/condvar pair when ZBQUEUE_NO_FUTEX is defined.
+ *  -The event count is only touched (syscall) when someone is actually
+ *   waiting, so uncontended push/pop are plain zmpmcq operations.
+ *  -After zbqueue_close(), push fails at once and pop keeps returning
+ *   the remaining elems until the queue is drained.
+ */
+
+#ifndef ZBQUEUE_H_
+#define ZBQUEUE_H_
+
+#include <stdatomic.h>
+#include "zdefs.h"
+#include "zmpmcq.h"
+
+#if defined(__linux__) && !defined(ZBQUEUE_NO_FUTEX)
+#define ZBQUEUE_USE_FUTEX   1
+#else
+#include <pthread.h>
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** sleep until @seq changes */
+typedef struct z_event_count
+{
+    atomic_uint         seq;
+    atomic_uint         waiters;
+#ifndef ZBQUEUE_USE_FUTEX
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+#endif
+}zevcnt_t;
+
+typedef struct z_blocking_queue
+{
+    zmpmcq_t           *mq;
+    zevcnt_t            not_empty;
+    zevcnt_t            not_full;
+    atomic_int          b_closed;
+    atomic_int          pushing;        //<! pushers that passed the closed check
+}zbqueue_t;
+
+
+zbqueue_t*  zbqueue_malloc(uint32_t elem_size, uint32_t depth);
+#define     ZBQUEUE_MALLOC(type_t, depth)   zbqueue_malloc(sizeof(type_t), (depth))
+void        zbqueue_free(zbqueue_t *bq);
+
+zcount_t    zbqueue_get_depth(zbqueue_t *bq);
+zcount_t    zbqueue_get_count(zbqueue_t *bq);   //<! snapshot, may be stale
+
+/** reject further push, wake up all waiters */
+void        zbqueue_close(zbqueue_t *bq);
+int         zbqueue_is_closed(zbqueue_t *bq);
+int         zbqueue_is_drained(zbqueue_t *bq);  //<! closed and empty
+
+/**
+ * @param timeout_ms    <0 wait forever, 0 don't wait
+ * @return 1, or 0 if timeout or closed (see zbqueue_is_closed())
+ */
+zcount_t    zbqueue_push_timed(zbqueue_t *bq, const void *elem_base, int timeout_ms);
+zcount_t    zbqueue_pop_timed(zbqueue_t *bq, void *dst_base, int timeout_ms);
+#define     zbqueue_push(bq, elem_base)     zbqueue_push_timed((bq), (elem_base), -1)
+#define     zbqueue_pop(bq, dst_base)       zbqueue_pop_timed((bq), (dst_base), -1)
+
+/**
+ * Push all @count elems, waiting for space as needed. Waiting consumers
+ * are woken once per batch.
+ * @return the count pushed, < @count only if timeout or closed
+ */
+zcount_t    zbqueue_push_multi(zbqueue_t *bq, const void *elems, zcount_t count, int timeout_ms);
+
+/**
+ * Wait for at least 1 elem, then take up to @count without waiting.
+ * @return the count popped, 0 if timeout or drained
+ */
+zcount_t    zbqueue_pop_multi(zbqueue_t *bq, void *elems, zcount_t count, int timeout_ms);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZBQUEUE_H_
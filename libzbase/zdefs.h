@@ -38,6 +38,38 @@ typedef     int32_t         zbidx_t;            //<! buffer idx
 #define zmem_swap               mem_swap
 #define zmem_swap_near_block    mem_swap_near_block
 
+#define     ZCACHE_LINE_SIZE    (64)
+#if defined(_MSC_VER)
+#define     ZALIGNED(n)         __declspec(align(n))
+#else
+#define     ZALIGNED(n)         __attribute__((aligned(n)))
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define     ZCPU_RELAX()        __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define     ZCPU_RELAX()        __asm__ __volatile__("yield")
+#else
+#define     ZCPU_RELAX()        do {} while (0)
+#endif
+
+#define     ZIS_POW2(v)         ((v) && !((v) & ((v) - 1)))
+
+/** @return the smallest power of 2 that is >= @v, or 0 if overflow */
+static inline uint32_t zpow2_roundup(uint32_t v)
+{
+    if (v <= 1) {
+        return 1;
+    }
+    v -= 1;
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    return v + 1;
+}
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,362 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zfcstrq.h"
+#include "sim_log.h"
+
+
+static inline
+uint8_t* zfc_put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline
+const uint8_t* zfc_get_varint(const uint8_t *p, uint32_t *v)
+{
+    uint32_t r = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        r |= (uint32_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = r | ((uint32_t)*p++ << shift);
+    return p;
+}
+
+static inline
+uint32_t zfc_lcp(const zsq_char_t *a, uint32_t alen, const zsq_char_t *b, uint32_t blen)
+{
+    uint32_t n = MIN(alen, blen), i;
+    for (i=0; i<n && a[i]==b[i]; ++i) {
+    }
+    return i;
+}
+
+/** memcmp order, a prefix first */
+static inline
+int zfc_cmp(const zsq_char_t *a, uint32_t alen, const zsq_char_t *b, uint32_t blen)
+{
+    int r = memcmp(a, b, MIN(alen, blen));
+    return r ? r : (alen > blen) - (alen < blen);
+}
+
+zfcstrq_t* zfcstrq_build(zstrq_t *sorted, uint32_t block_size)
+{
+    zfcstrq_t *fc = calloc(1, sizeof(zfcstrq_t));
+    zcount_t count = zstrq_get_str_count(sorted);
+    uint64_t depth = 4096, need;
+    const zsq_char_t *prev = 0, *str;
+    uint32_t prev_len = 0, len, lcp;
+    uint8_t *p;
+    zqidx_t i;
+
+    block_size = block_size ? block_size : ZFCSQ_BLOCK_DEF;
+    if (!fc || block_size < ZFCSQ_BLOCK_MIN || block_size > ZFCSQ_BLOCK_MAX) {
+        xerr("<zfcstrq> %s() failed, block_size %u\n", __FUNCTION__, block_size);
+        SIM_FREEP(fc);
+        return 0;
+    }
+
+    fc->count      = count;
+    fc->block_size = block_size;
+    fc->nblock     = (count + block_size - 1) / block_size;
+    fc->block_off  = malloc(sizeof(uint64_t) * MAX(fc->nblock, 1));
+    fc->data       = malloc(depth);
+    if (!fc->block_off || !fc->data) {
+        xerr("<zfcstrq> %s() failed!\n", __FUNCTION__);
+        zfcstrq_free(fc);
+        return 0;
+    }
+
+    for (i=0; i<count; ++i) {
+        str = zstrq_get_str_base(sorted, i);
+        len = zstrq_get_str_size(sorted, i);
+        if (prev && zfc_cmp(prev, prev_len, str, len) > 0) {
+            xerr("<zfcstrq> %s(): not sorted at %d\n", __FUNCTION__, i);
+            zfcstrq_free(fc);
+            return 0;
+        }
+
+        /* 2 varints + suffix at most */
+        need = fc->data_size + 10 + len;
+        if (need > depth) {
+            uint8_t *data;
+            depth = MAX(depth * 2, need);
+            data  = realloc(fc->data, depth);
+            if (!data) {
+                xerr("<zfcstrq> %s() failed!\n", __FUNCTION__);
+                zfcstrq_free(fc);
+                return 0;
+            }
+            fc->data = data;
+        }
+
+        p = fc->data + fc->data_size;
+        if (i % block_size == 0) {
+            fc->block_off[i / block_size] = fc->data_size;
+            lcp = 0;
+            p = zfc_put_varint(p, len);
+        } else {
+            lcp = zfc_lcp(prev, prev_len, str, len);
+            p = zfc_put_varint(p, lcp);
+            p = zfc_put_varint(p, len - lcp);
+        }
+        memcpy(p, str + lcp, len - lcp);
+        fc->data_size = (uint64_t)(p + len - lcp - fc->data);
+
+        fc->max_len    = MAX(fc->max_len, len);
+        fc->raw_bytes += len + 1 + sizeof(zsq_entry_t);
+        prev     = str;
+        prev_len = len;
+    }
+
+    /* give back the slack */
+    if (fc->data_size) {
+        p = realloc(fc->data, fc->data_size);
+        fc->data = p ? p : fc->data;
+    }
+    return fc;
+}
+
+void zfcstrq_free(zfcstrq_t *fc)
+{
+    if (fc) {
+        SIM_FREEP(fc->block_off);
+        SIM_FREEP(fc->data);
+        free(fc);
+    }
+}
+
+zcount_t zfcstrq_get_count(zfcstrq_t *fc)
+{
+    return fc->count;
+}
+
+uint64_t zfcstrq_get_size(zfcstrq_t *fc)
+{
+    return sizeof(zfcstrq_t) + fc->data_size + sizeof(uint64_t) * fc->nblock;
+}
+
+uint32_t zfcstrq_get(zfcstrq_t *fc, zqidx_t idx, zsq_char_t *buf, uint32_t size)
+{
+    const uint8_t *p;
+    uint32_t len = 0, lcp, sfx, k, n;
+
+    if (idx < 0 || idx >= fc->count || !size) {
+        return 0;
+    }
+
+    /* chars at or after @size are never needed: a prefix longer than that
+       is cut in the output anyway */
+    p = fc->data + fc->block_off[idx / fc->block_size];
+    for (k=0; k<=(uint32_t)(idx % fc->block_size); ++k) {
+        if (k == 0) {
+            lcp = 0;
+            p = zfc_get_varint(p, &sfx);
+        } else {
+            p = zfc_get_varint(p, &lcp);
+            p = zfc_get_varint(p, &sfx);
+        }
+        if (lcp < size - 1) {
+            n = MIN(sfx, size - 1 - lcp);
+            memcpy(buf + lcp, p, n);
+        }
+        p  += sfx;
+        len = lcp + sfx;
+    }
+    buf[MIN(len, size - 1)] = 0;
+    return len;
+}
+
+zqidx_t zfcstrq_lower_bound(zfcstrq_t *fc, const zsq_char_t *str, uint32_t str_len)
+{
+    zcount_t lo = 0, hi = fc->nblock, mid, k, n;
+    const uint8_t *p;
+    uint32_t m, len, lcp, sfx, q;
+    int r;
+
+    /* the first block whose head >= @str */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        p = zfc_get_varint(fc->data + fc->block_off[mid], &len);
+        if (zfc_cmp((const zsq_char_t *)p, len, str, str_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return 0;
+    }
+
+    /**
+     * Walk the block before, its head < @str. @m is the match length of
+     * the previous string (< @str) against @str:
+     *  -lcp > m: it's still < @str
+     *  -lcp < m: it's > @str, done
+     *  -lcp == m: compare the suffix
+     */
+    p = zfc_get_varint(fc->data + fc->block_off[lo - 1], &len);
+    m = zfc_lcp((const zsq_char_t *)p, len, str, str_len);
+    p += len;
+    n  = MIN(fc->block_size, fc->count - (lo - 1) * fc->block_size);
+    for (k=1; k<n; ++k) {
+        p = zfc_get_varint(p, &lcp);
+        p = zfc_get_varint(p, &sfx);
+        if (lcp < m) {
+            break;
+        }
+        if (lcp == m) {
+            q = zfc_lcp((const zsq_char_t *)p, sfx, str + m, str_len - m);
+            if (q == sfx || (m + q < str_len && (uint8_t)p[q] < (uint8_t)str[m + q])) {
+                r = (m + q == str_len && q == sfx) ? 0 : -1;
+            } else {
+                r = 1;
+            }
+            if (r >= 0) {
+                break;
+            }
+            m += q;
+        }
+        p += sfx;
+    }
+    return (lo - 1) * fc->block_size + k;
+}
+
+zqidx_t zfcstrq_find(zfcstrq_t *fc, const zsq_char_t *str, uint32_t str_len)
+{
+    zqidx_t idx = zfcstrq_lower_bound(fc, str, str_len);
+    const uint8_t *p;
+    uint32_t len, lcp, sfx, m = 0, k;
+
+    if (idx >= fc->count) {
+        return -1;
+    }
+
+    /* compare string @idx against @str while decoding its block */
+    p = fc->data + fc->block_off[idx / fc->block_size];
+    for (k=0; k<=(uint32_t)(idx % fc->block_size); ++k) {
+        if (k == 0) {
+            lcp = 0;
+            p = zfc_get_varint(p, &sfx);
+        } else {
+            p = zfc_get_varint(p, &lcp);
+            p = zfc_get_varint(p, &sfx);
+        }
+        /* chars [0, m) of the previous string match @str */
+        m = MIN(m, lcp);
+        if (m == lcp) {
+            m += zfc_lcp((const zsq_char_t *)p, sfx, str + lcp, str_len - lcp);
+        }
+        p  += sfx;
+        len = lcp + sfx;
+    }
+    return (m == len && len == str_len) ? idx : -1;
+}
+
+zfcsq_iter_t zfcstrq_iter_open(zfcstrq_t *fc, zqidx_t start)
+{
+    zfcsq_iter_t iter;
+    uint32_t lcp, sfx;
+    zqidx_t i;
+
+    memset(&iter, 0, sizeof(iter));
+    iter.fc  = fc;
+    iter.buf = malloc(fc->max_len + 1);
+    if (!iter.buf) {
+        xerr("<zfcstrq> %s() failed!\n", __FUNCTION__);
+        iter.idx = fc->count;
+        return iter;
+    }
+
+    start = CLIP(start, 0, fc->count);
+    iter.idx = start;
+    if (start >= fc->count) {
+        return iter;
+    }
+
+    /* decode up to start - 1 so the next one can share its prefix */
+    iter.pos = fc->data + fc->block_off[start / fc->block_size];
+    for (i=start - start % fc->block_size; i<start; ++i) {
+        if (i % fc->block_size == 0) {
+            lcp = 0;
+            iter.pos = zfc_get_varint(iter.pos, &sfx);
+        } else {
+            iter.pos = zfc_get_varint(iter.pos, &lcp);
+            iter.pos = zfc_get_varint(iter.pos, &sfx);
+        }
+        memcpy(iter.buf + lcp, iter.pos, sfx);
+        iter.pos += sfx;
+        iter.len  = lcp + sfx;
+    }
+    return iter;
+}
+
+void zfcstrq_iter_close(zfcsq_iter_t *iter)
+{
+    SIM_FREEP(iter->buf);
+    iter->idx = iter->fc ? iter->fc->count : 0;
+}
+
+zsq_char_t* zfcstrq_iter_next(zfcsq_iter_t *iter, uint32_t *len)
+{
+    zfcstrq_t *fc = iter->fc;
+    uint32_t lcp = 0, sfx;
+
+    if (!iter->buf || iter->idx >= fc->count) {
+        return 0;
+    }
+    if (iter->idx % fc->block_size == 0) {
+        iter->pos = fc->data + fc->block_off[iter->idx / fc->block_size];
+        iter->pos = zfc_get_varint(iter->pos, &sfx);
+    } else {
+        iter->pos = zfc_get_varint(iter->pos, &lcp);
+        iter->pos = zfc_get_varint(iter->pos, &sfx);
+    }
+    memcpy(iter->buf + lcp, iter->pos, sfx);
+    iter->pos += sfx;
+    iter->len  = lcp + sfx;
+    iter->buf[iter->len] = 0;
+    iter->idx += 1;
+
+    if (len) {
+        *len = iter->len;
+    }
+    return iter->buf;
+}
+
+void zfcstrq_print_stats(zfcstrq_t *fc, const char *name)
+{
+    uint64_t size = zfcstrq_get_size(fc);
+
+    xprint("<zfcstrq> %s: count=%d, block=%u, raw=%llu bytes, coded=%llu bytes "
+        "(data %llu + index %llu), ratio=%.2fx\n",
+        name, fc->count, fc->block_size, 
+        (unsigned long long)fc->raw_bytes, (unsigned long long)size,
+        (unsigned long long)fc->data_size, 
+        (unsigned long long)(sizeof(uint64_t) * fc->nblock),
+        size ? (double)fc->raw_bytes / size : 0.0);
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief front-coded (prefix compressed) string table, read-only
+ *
+ *  -Built from a sorted zstrq (see zstrq_sort()), in memcmp order.
+ *  -Strings are grouped in blocks of @block_size. The first string of a
+ *   block is stored in full, each other one as (shared prefix length with
+ *   the previous string, suffix), lengths as LEB128 varints.
+ *  -Lookup binary searches the block heads, then walks one block keeping
+ *   the match length against the key, so no string has to be rebuilt.
+ *  -Random access decodes from the block head, sequential access goes
+ *   through an iterator which only copies the suffixes.
+ */
+
+#ifndef ZFCSTRQ_H_
+#define ZFCSTRQ_H_
+
+#include "zdefs.h"
+#include "zstrq.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+#define     ZFCSQ_BLOCK_MIN     (16)
+#define     ZFCSQ_BLOCK_MAX     (64)
+#define     ZFCSQ_BLOCK_DEF     (32)
+
+typedef struct z_front_coded_strq
+{
+    zcount_t        count;
+    uint32_t        block_size;
+    zcount_t        nblock;
+    uint64_t       *block_off;              //<! of each block in data
+    uint8_t        *data;
+    uint64_t        data_size;
+    uint32_t        max_len;
+
+    uint64_t        raw_bytes;              //<! as a flat zstrq, entries included
+}zfcstrq_t;
+
+typedef struct z_front_coded_strq_iterator
+{
+    zfcstrq_t      *fc;
+    zqidx_t         idx;                    //<! of the next string
+    const uint8_t  *pos;                    //<! its code in data
+    zsq_char_t     *buf;                    //<! last string, 0-terminated
+    uint32_t        len;
+}zfcsq_iter_t;
+
+
+/**
+ * @param sorted        strings in zstrq_sort() order, else it fails
+ * @param block_size    ZFCSQ_BLOCK_MIN ~ ZFCSQ_BLOCK_MAX, 0 for default
+ */
+zfcstrq_t*  zfcstrq_build(zstrq_t *sorted, uint32_t block_size);
+void        zfcstrq_free(zfcstrq_t *fc);
+
+zcount_t    zfcstrq_get_count(zfcstrq_t *fc);
+uint64_t    zfcstrq_get_size(zfcstrq_t *fc);    //<! bytes of data and block index
+
+/**
+ * Decode string @idx into @buf, truncated to @size - 1 chars, 0-terminated.
+ * @return the full length, 0 if @idx is out of range
+ */
+uint32_t    zfcstrq_get(zfcstrq_t *fc, zqidx_t idx, zsq_char_t *buf, uint32_t size);
+
+/** @return idx of the first string >= @str, count if none */
+zqidx_t     zfcstrq_lower_bound(zfcstrq_t *fc, const zsq_char_t *str, uint32_t str_len);
+
+/** @return idx of @str, -1 if not found */
+zqidx_t     zfcstrq_find(zfcstrq_t *fc, const zsq_char_t *str, uint32_t str_len);
+
+/** iterate from @start, close it after use */
+zfcsq_iter_t zfcstrq_iter_open(zfcstrq_t *fc, zqidx_t start);
+void        zfcstrq_iter_close(zfcsq_iter_t *iter);
+
+/** @return the next string, 0-terminated and valid until the next call, 0 at the end */
+zsq_char_t* zfcstrq_iter_next(zfcsq_iter_t *iter, uint32_t *len);
+
+/** print sizes and the compression ratio against a flat zstrq */
+void        zfcstrq_print_stats(zfcstrq_t *fc, const char *name);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZFCSTRQ_H_
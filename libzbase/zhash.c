@@ -17,12 +17,29 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #include "zhash.h"
 #include "sim_log.h"
 
 
-zhash_t *zhash_malloc(uint32_t node_size, uint32_t depth_log2)
+/* ctrl 0 is empty so a calloc'ed table is ready without a pass over it */
+#define ZH_CTRL_EMPTY       (0x00)
+#define ZH_CTRL_DELETED     (0x01)
+#define ZH_CTRL_FULL        (0x80)
+#define ZH_H1(h64)          ((h64) >> 7)                            //<! slot
+#define ZH_H2(h64)          ((uint8_t)(ZH_CTRL_FULL | ((h64) & 0x7f)))  //<! ctrl tag
+
+static
+zhash_t *zh_malloc_internal(uint32_t node_size, uint32_t depth_log2, int b_open)
 {
     zhash_t *zh = calloc( 1, sizeof(zhash_t) );
     if (!zh) {
@@ -30,38 +47,240 @@ zhash_t *zhash_malloc(uint32_t node_size, uint32_t depth_log2)
         return 0;
     }
 
+    depth_log2 = MIN(depth_log2, ZH_DEPTH_LOG2_MAX);
     zh->depth_log2 = depth_log2;
     zh->depth = 1 << depth_log2;
+    zh->node_size = node_size;
+    zh->b_open = b_open;
 
-    zh->hash_tbl = calloc(zh->depth, sizeof(zh_head_t));
+    if (b_open) {
+        zh->ctrl = calloc(zh->depth + ZH_GROUP, 1);
+    } else {
+        zh->hash_tbl = calloc(zh->depth, sizeof(zh_head_t));
+    }
     zh->nodeq = zarray_malloc_s(node_size, zh->depth);
-    zarray_memzero(zh->nodeq);
-    zh->strq  = zstrq_malloc(0);
+    zh->strq  = zstrq_malloc_chunked(0);         /* keys never move */
 
-    if (!zh->hash_tbl || !zh->nodeq || !zh->strq) {
+    if ((b_open ? !zh->ctrl : !zh->hash_tbl) || !zh->nodeq || !zh->strq) {
         xerr("<zhash> buf malloc failed!\n");
         zhash_free(zh);
         return 0;
     }
 
+    zh->hash_func = zh_hash_wy64;
+    zh->seed      = zh_hash_seed();
     return zh;
 }
 
+zhash_t *zhash_malloc(uint32_t node_size, uint32_t depth_log2)
+{
+    return zh_malloc_internal(node_size, depth_log2, 0);
+}
+
+zhash_t *zhash_malloc_open(uint32_t node_size, uint32_t depth_log2)
+{
+    return zh_malloc_internal(node_size, MAX(depth_log2, 4), 1);
+}
+
 void zhash_free(zhash_t *h)
 {
     if (h) {
         if (h->hash_tbl) { free(h->hash_tbl); }
+        if (h->ctrl) { free(h->ctrl); }
         if (h->nodeq) { zarray_free(h->nodeq); }
         if (h->strq) { zstrq_free(h->strq); }
+        if (h->old_strq) { zstrq_free(h->old_strq); }
+        if (h->old_tbl) { free(h->old_tbl); }
+        if (h->old_ctrl) { free(h->old_ctrl); }
+        if (h->old_nodeq) { zarray_free(h->old_nodeq); }
+        zh_nodeq_free(h->nodeq_ext);
         free(h);
     }
 }
 
-static 
-uint32_t zh_nstr_time33(uint32_t type, const char *key, uint32_t key_len)
+zaddr_t zh_nodeq_push(zarray_t *nodeq, zarray_t **ext)
+{
+    zarray_t *za = nodeq;
+    zaddr_t node;
+    int k;
+
+    for (k=0; zarray_get_space(za) <= 0; ++k) {
+        uint64_t depth = (uint64_t)zarray_get_depth(nodeq) << k;
+        if (k >= ZH_NODEQ_EXT || depth > (1u << ZH_DEPTH_LOG2_MAX)) {
+            return 0;
+        }
+        if (!ext[k] && !(ext[k] = zarray_malloc_s(nodeq->elem_size, (uint32_t)depth))) {
+            return 0;
+        }
+        za = ext[k];
+    }
+    node = zarray_push_back(za, 0);
+    memset(node, 0, za->elem_size);
+    return node;
+}
+
+zaddr_t zh_nodeq_at(zarray_t *nodeq, zarray_t **ext, zqidx_t idx)
+{
+    zarray_t *za = nodeq;
+    int k = 0;
+
+    while (za && idx >= 0) {
+        if (idx < zarray_get_count(za)) {
+            return ZARRAY_ELEM_BASE(za, idx);
+        }
+        idx -= zarray_get_count(za);
+        za = k < ZH_NODEQ_EXT ? ext[k++] : 0;
+    }
+    return 0;
+}
+
+zcount_t zh_nodeq_used(zarray_t *nodeq, zarray_t **ext)
+{
+    zcount_t used = zarray_get_count(nodeq);
+    int k;
+    for (k=0; k<ZH_NODEQ_EXT && ext[k]; ++k) {
+        used += zarray_get_count(ext[k]);
+    }
+    return used;
+}
+
+zcount_t zh_nodeq_depth(zarray_t *nodeq, zarray_t **ext)
+{
+    zcount_t depth = zarray_get_depth(nodeq);
+    int k;
+    for (k=0; k<ZH_NODEQ_EXT && ext[k]; ++k) {
+        depth += zarray_get_depth(ext[k]);
+    }
+    return depth;
+}
+
+int zh_nodeq_has(zarray_t *nodeq, zarray_t **ext, zaddr_t base)
+{
+    int k;
+    if (zarray_is_elem_base_in_use(nodeq, base)) {
+        return 1;
+    }
+    for (k=0; k<ZH_NODEQ_EXT && ext[k]; ++k) {
+        if (zarray_is_elem_base_in_use(ext[k], base)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void zh_nodeq_free(zarray_t **ext)
+{
+    int k;
+    for (k=0; k<ZH_NODEQ_EXT; ++k) {
+        if (ext[k]) {
+            zarray_free(ext[k]);
+            ext[k] = 0;
+        }
+    }
+}
+
+void zh_release_moved(void *base, size_t from, size_t to)
+{
+#if defined(__linux__) && defined(MADV_DONTNEED)
+    static uintptr_t page = 0;
+    uintptr_t lo, hi;
+
+    if (!page) {
+        page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    }
+    /* whole pages only, the malloc headers around stay */
+    lo = MAX(((uintptr_t)base + from) & ~(page - 1), ((uintptr_t)base + page - 1) & ~(page - 1));
+    hi = ((uintptr_t)base + to) & ~(page - 1);
+    if (hi > lo) {
+        madvise((void *)lo, hi - lo, MADV_DONTNEED);
+    }
+#endif
+}
+
+/* wyhash-style mixing, after wyhash by Wang Yi (public domain) */
+
+static const uint64_t g_zh_wy_secret[4] = {
+    0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+};
+
+static inline
+uint64_t zh_wy_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline
+uint64_t zh_wy_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/** 64x64->128 multiply, xor of the halves */
+static inline
+uint64_t zh_wy_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t zh_hash_wy64(const char *key, uint32_t key_len, uint64_t seed)
+{
+    const uint64_t *s = g_zh_wy_secret;
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t i = key_len;
+    uint64_t a, b, see1, see2;
+
+    seed ^= zh_wy_mix(seed ^ s[0], s[1]);
+    if (key_len <= 16) {
+        if (key_len >= 4) {
+            /* 2 overlapping 4+4 byte reads cover 4~16 bytes */
+            a = (zh_wy_r4(p) << 32) | zh_wy_r4(p + ((key_len >> 3) << 2));
+            b = (zh_wy_r4(p + key_len - 4) << 32) | zh_wy_r4(p + key_len - 4 - ((key_len >> 3) << 2));
+        } else if (key_len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[key_len >> 1] << 8) | p[key_len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        if (i > 48) {
+            see1 = see2 = seed;
+            do {
+                seed = zh_wy_mix(zh_wy_r8(p)      ^ s[1], zh_wy_r8(p + 8)  ^ seed);
+                see1 = zh_wy_mix(zh_wy_r8(p + 16) ^ s[2], zh_wy_r8(p + 24) ^ see1);
+                see2 = zh_wy_mix(zh_wy_r8(p + 32) ^ s[3], zh_wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = zh_wy_mix(zh_wy_r8(p) ^ s[1], zh_wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = zh_wy_r8(p + i - 16);
+        b = zh_wy_r8(p + i - 8);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+    {
+        __uint128_t r = (__uint128_t)a * b;
+        a = (uint64_t)r;
+        b = (uint64_t)(r >> 64);
+    }
+    return zh_wy_mix(a ^ s[0] ^ key_len, b ^ s[1]);
+}
+
+uint64_t zh_hash_time33(const char *key, uint32_t key_len, uint64_t seed)
 {
     uint32_t i = 0;
-    uint32_t hash = type;
+    uint32_t hash = (uint32_t)seed;
     for (i=0; i<key_len; ++i) {
         hash = hash * 33 + key[i]; 
     } 
@@ -69,33 +288,57 @@ uint32_t zh_nstr_time33(uint32_t type, const char *key, uint32_t key_len)
     return hash; 
 }
 
-static 
-uint32_t zh_cstr_time33(uint32_t type, const char *key, uint32_t *key_len)
+uint64_t zh_hash_seed(void)
 {
-    int      c = 0;
-    uint32_t i = 0;
-    uint32_t hash = type;
-    for (i=0; (c=key[i]); ++i) {
-        hash = hash * 33 + c; 
-    } 
+    static uint64_t counter = 0;
+    struct timespec ts;
+    uint64_t x;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    x  = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    x ^= (uint64_t)(size_t)&ts;
+    x += __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ull;
 
-    if (key_len) { 
-        *key_len = i;
+    /* splitmix64 finalizer */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+int zhash_set_hash_func(zhash_t *h, zh_hash_func_t func, uint64_t seed)
+{
+    if (h->count > 0) {
+        xerr("<zhash> %s(): the table isn't empty\n", __FUNCTION__);
+        return 0;
     }
+    h->hash_func = func ? func : zh_hash_wy64;
+    h->seed      = seed;
+    return 1;
+}
 
-    return hash; 
+/** the bucket of @hash, in the old table if it's not moved yet */
+static inline
+zh_head_t *zh_bucket(zhash_t *h, zh_hval_t hash)
+{
+    if (h->old_tbl) {
+        uint32_t b = GETLSBS(hash, h->old_log2);
+        if (b >= h->rehash_idx) {
+            return &h->old_tbl[b];
+        }
+    }
+    return &h->hash_tbl[GETLSBS(hash, h->depth_log2)];
 }
 
 static
 zh_node_t *zh_find_in_collision(zhash_t *h, zh_hval_t hash, 
                             const char *key, uint32_t key_len)
 {
-    zh_node_t *head = h->hash_tbl[GETLSBS(hash, h->depth_log2)];
+    zh_node_t *head = *zh_bucket(h, hash);
     zh_node_t *node = 0;
     for (node = head; node; node = node->next) 
     {
-        if (node->hash==hash && node->key[key_len]==0 
-                && strncmp(node->key, key, key_len)==0) 
+        if (node->hash==hash && node->key_len==key_len 
+                && memcmp(node->key, key, key_len)==0) 
         {
             return node;
         }
@@ -103,16 +346,347 @@ zh_node_t *zh_find_in_collision(zhash_t *h, zh_hval_t hash,
     return 0;
 }
 
+/** move up to ZH_REHASH_STEP chains, and visit up to 10x as many empty buckets */
+static
+void zh_rehash_step(zhash_t *h)
+{
+    uint32_t old_depth = 1u << h->old_log2;
+    int moved = 0, empty = 0;
+
+    while (h->rehash_idx < old_depth && moved < ZH_REHASH_STEP && empty < ZH_REHASH_STEP * 10) {
+        zh_node_t *node = h->old_tbl[h->rehash_idx], *next;
+        zh_head_t *head;
+
+        if (!node) {
+            empty += 1;
+        } else {
+            moved += 1;
+        }
+        for (; node; node = next) {
+            next = node->next;
+            head = &h->hash_tbl[GETLSBS(node->hash, h->depth_log2)];
+            node->next = *head;
+            *head = node;
+        }
+        h->old_tbl[h->rehash_idx++] = 0;
+    }
+    if (h->rehash_idx >= old_depth) {
+        SIM_FREEP(h->old_tbl);
+    } else if ((h->rehash_idx - h->rehash_rel) * sizeof(zh_head_t) >= ZH_RELEASE_BYTES) {
+        zh_release_moved(h->old_tbl, h->rehash_rel * sizeof(zh_head_t),
+                         h->rehash_idx * sizeof(zh_head_t));
+        h->rehash_rel = h->rehash_idx;
+    }
+}
+
+/** start moving to a table twice as large, no pass over the nodes here */
+static
+void zh_grow(zhash_t *h)
+{
+    zh_head_t *tbl;
+
+    if (h->depth_log2 >= ZH_DEPTH_LOG2_MAX) {
+        return;                     /* chains just get longer */
+    }
+    tbl = calloc((size_t)h->depth * 2, sizeof(zh_head_t));
+    if (!tbl) {
+        xwarn("<zhash> no memory to grow to 2^%u buckets\n", h->depth_log2 + 1);
+        return;
+    }
+    h->old_tbl    = h->hash_tbl;
+    h->old_log2   = h->depth_log2;
+    h->rehash_idx = 0;
+    h->rehash_rel = 0;
+    h->hash_tbl   = tbl;
+    h->depth_log2 += 1;
+    h->depth     <<= 1;
+}
+
+/** bit i set if ctrl @g[i] is @c */
+static inline
+uint32_t zh_group_match(const uint8_t *g, uint8_t c)
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+#else
+    uint32_t m = 0, i;
+    for (i=0; i<ZH_GROUP; ++i) {
+        m |= (uint32_t)(g[i] == c) << i;
+    }
+    return m;
+#endif
+}
+
+/** bit i set if @g[i] is empty or deleted, i.e. has no top bit */
+static inline
+uint32_t zh_group_match_free(const uint8_t *g)
+{
+#if defined(__SSE2__)
+    return ~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g)) & 0xffff;
+#else
+    uint32_t m = 0, i;
+    for (i=0; i<ZH_GROUP; ++i) {
+        m |= (uint32_t)(g[i] < ZH_CTRL_FULL) << i;
+    }
+    return m;
+#endif
+}
+
+#define ZH_OPEN_NODE(nodeq, i)  ((zh_node_t *)ZARRAY_ELEM_BASE((nodeq), (i)))
+#define ZH_IS_FULL(ctrl, i)     ((ctrl)[i] >= ZH_CTRL_FULL)
+
+/** set ctrl @i, and its mirror past the end for the first group */
+static inline
+void zh_ctrl_set(uint8_t *ctrl, uint32_t depth, uint32_t i, uint8_t c)
+{
+    ctrl[i] = c;
+    if (i < ZH_GROUP) {
+        ctrl[depth + i] = c;
+    }
+}
+
+static
+zh_node_t *zh_open_find(const uint8_t *ctrl, zarray_t *nodeq, uint32_t depth,
+                            uint64_t h64, zh_hval_t hash, const char *key, uint32_t key_len)
+{
+    uint32_t mask = depth - 1;
+    uint32_t pos  = (uint32_t)ZH_H1(h64) & mask, step = 0, m;
+    uint8_t  h2   = ZH_H2(h64);
+    zh_node_t *node;
+
+    for (;;) {
+        const uint8_t *g = ctrl + pos;
+        __builtin_prefetch(ZH_OPEN_NODE(nodeq, pos));     /* overlaps the ctrl miss */
+        for (m = zh_group_match(g, h2); m; m &= m - 1) {
+            node = ZH_OPEN_NODE(nodeq, (pos + __builtin_ctz(m)) & mask);
+            if (node->hash==hash && node->key_len==key_len
+                    && memcmp(node->key, key, key_len)==0) {
+                return node;
+            }
+        }
+        /* an empty slot ends the probe, the key would have landed there */
+        if (zh_group_match(g, ZH_CTRL_EMPTY)) {
+            return 0;
+        }
+        step += ZH_GROUP;
+        pos = (pos + step) & mask;
+    }
+}
+
+/**
+ * take the first free slot on the probe sequence of @h64 in the current
+ * table, @return the zeroed node
+ */
+static
+zh_node_t *zh_open_take(zhash_t *h, uint64_t h64)
+{
+    uint32_t mask = h->depth - 1;
+    uint32_t pos  = (uint32_t)ZH_H1(h64) & mask, step = 0, m, i;
+    zh_node_t *node;
+
+    while (!(m = zh_group_match_free(h->ctrl + pos))) {
+        step += ZH_GROUP;
+        pos = (pos + step) & mask;
+    }
+    i = (pos + __builtin_ctz(m)) & mask;
+    h->tombs -= h->ctrl[i] == ZH_CTRL_DELETED;
+    zh_ctrl_set(h->ctrl, h->depth, i, ZH_H2(h64));
+    h->nodeq->count += 1;
+    node = ZH_OPEN_NODE(h->nodeq, i);
+    memset(node, 0, h->nodeq->elem_size);
+    return node;
+}
+
+/**
+ * move the nodes of up to 2 x ZH_REHASH_STEP old slots, their hash is
+ * computed again as the node keeps 32 bits only. A moved slot is marked
+ * deleted, so probes in the old table still go through it.
+ */
+static
+void zh_open_rehash_step(zhash_t *h)
+{
+    uint32_t old_depth = 1u << h->old_log2;
+    uint32_t end = MIN(old_depth, h->rehash_idx + 2 * ZH_REHASH_STEP), i;
+
+    for (i=h->rehash_idx; i<end; ++i) {
+        if (ZH_IS_FULL(h->old_ctrl, i)) {
+            zh_node_t *src = ZH_OPEN_NODE(h->old_nodeq, i), *dst;
+            uint64_t h64 = h->hash_func(src->key, src->key_len, h->seed);
+            dst = zh_open_take(h, h64);
+            memcpy(dst, src, h->nodeq->elem_size);
+            zh_ctrl_set(h->old_ctrl, old_depth, i, ZH_CTRL_DELETED);
+            h->old_nodeq->count -= 1;
+        }
+    }
+    h->rehash_idx = end;
+    if (end >= old_depth || zarray_get_count(h->old_nodeq) == 0) {
+        SIM_FREEP(h->old_ctrl);
+        zarray_free(h->old_nodeq);
+        h->old_nodeq = 0;
+    } else if ((end - h->rehash_rel) * h->old_nodeq->elem_size >= ZH_RELEASE_BYTES) {
+        /* only the nodes, probes still read the moved ctrl */
+        zh_release_moved(ZH_OPEN_NODE(h->old_nodeq, 0), h->rehash_rel * h->old_nodeq->elem_size,
+                         end * h->old_nodeq->elem_size);
+        h->rehash_rel = end;
+    }
+}
+
+/** start moving to a table of 2^@log2 slots, the same size to drop tombstones */
+static
+void zh_open_grow(zhash_t *h, uint32_t log2)
+{
+    uint8_t  *ctrl;
+    zarray_t *nodeq;
+
+    if (log2 > ZH_DEPTH_LOG2_MAX) {
+        return;
+    }
+    ctrl  = calloc(((size_t)1 << log2) + ZH_GROUP, 1);
+    nodeq = zarray_malloc_s(h->node_size, 1u << log2);
+    if (!ctrl || !nodeq) {
+        xwarn("<zhash> no memory to grow to 2^%u slots\n", log2);
+        SIM_FREEP(ctrl);
+        zarray_free(nodeq);
+        return;
+    }
+    h->old_ctrl   = h->ctrl;
+    h->old_nodeq  = h->nodeq;
+    h->old_log2   = h->depth_log2;
+    h->rehash_idx = 0;
+    h->rehash_rel = 0;
+    h->ctrl       = ctrl;
+    h->nodeq      = nodeq;
+    h->depth_log2 = log2;
+    h->depth      = 1u << log2;
+    h->tombs      = 0;
+}
+
+/** the node whose key is at @str, found by @h64 */
+static
+zh_node_t *zh_find_by_key_ptr(zhash_t *h, uint64_t h64, const char *str)
+{
+    zh_node_t *node;
+    int t;
+
+    if (!h->b_open) {
+        for (node = *zh_bucket(h, ZH_HASH_FOLD(h64)); node; node = node->next) {
+            if (node->key == str) {
+                return node;
+            }
+        }
+        return 0;
+    }
+
+    for (t=0; t<2; ++t) {
+        const uint8_t *ctrl  = t ? h->old_ctrl : h->ctrl;
+        zarray_t      *nodeq = t ? h->old_nodeq : h->nodeq;
+        uint32_t mask = (t ? 1u << h->old_log2 : h->depth) - 1;
+        uint32_t pos  = (uint32_t)ZH_H1(h64) & mask, step = 0, m;
+
+        for (; ctrl; step += ZH_GROUP, pos = (pos + step) & mask) {
+            for (m = zh_group_match(ctrl + pos, ZH_H2(h64)); m; m &= m - 1) {
+                node = ZH_OPEN_NODE(nodeq, (pos + __builtin_ctz(m)) & mask);
+                if (node->key == str) {
+                    return node;
+                }
+            }
+            if (zh_group_match(ctrl + pos, ZH_CTRL_EMPTY)) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * move up to ZH_KEY_MOVE_STEP live keys of old_strq to strq, each node is
+ * found by hashing its key and looking for the key address
+ */
+static
+void zh_key_move_step(zhash_t *h)
+{
+    zstrq_t *old = h->old_strq;
+    zcount_t n = zstrq_get_str_count(old);
+    int moved = 0;
+
+    for (; h->key_move_idx < n && moved < ZH_KEY_MOVE_STEP; ++h->key_move_idx) {
+        zqidx_t  qidx = h->key_move_idx;
+        zsq_char_t *str = zstrq_get_str_base(old, qidx), *dst;
+        uint32_t len;
+        uint64_t h64;
+        zh_node_t *node;
+
+        if (!str) {
+            continue;
+        }
+        len  = zstrq_get_str_size(old, qidx);
+        h64  = h->hash_func(str, len, h->seed);
+        node = zh_find_by_key_ptr(h, h64, str);
+        if (!node) {
+            xerr("<zhash> %s(): no node for key %d\n", __FUNCTION__, qidx);
+            continue;
+        }
+        dst = zstrq_push_back_hashed(h->strq, str, len, node->hash);
+        if (!dst) {
+            return;                 /* try again later */
+        }
+        node->key     = dst;
+        node->key_idx = zstrq_get_str_count(h->strq) - 1;
+        moved += 1;
+    }
+    if (h->key_move_idx >= n) {
+        zstrq_free(old);
+        h->old_strq = 0;
+    }
+}
+
+/** start moving the live keys once the deleted ones outnumber them */
+static
+void zh_key_move_start(zhash_t *h)
+{
+    zstrq_t *strq;
+
+    if (zstrq_get_dead_count(h->strq) < MAX(h->count, ZH_KEY_MOVE_STEP * 4)) {
+        return;
+    }
+    strq = zstrq_malloc_chunked(0);
+    if (!strq) {
+        return;
+    }
+    h->old_strq     = h->strq;
+    h->strq         = strq;
+    h->key_move_idx = 0;
+}
+
 static
 zaddr_t     zhash_touch_node(zhash_t    *h, 
                             const char  *key, 
                             uint32_t     key_len,
                             int          b_insert)
 {
-    uint32_t hash = key_len ? zh_nstr_time33(0, key, key_len)
-                            : zh_cstr_time33(0, key, &key_len);
+    uint64_t h64;
+    uint32_t hash;
+    zh_node_t *node;
+
+    key_len = key_len ? key_len : (uint32_t)strlen(key);
+    h64  = h->hash_func(key, key_len, h->seed);
+    hash = ZH_HASH_FOLD(h64);
+
+    /* open tables move nodes on set only, so a get leaves pointers valid */
+    if (h->old_tbl || (h->old_ctrl && b_insert)) {
+        h->b_open ? zh_open_rehash_step(h) : zh_rehash_step(h);
+    }
 
-    zh_node_t *node = zh_find_in_collision(h, hash, key, key_len);
+    if (h->b_open) {
+        node = zh_open_find(h->ctrl, h->nodeq, h->depth, h64, hash, key, key_len);
+        if (!node && h->old_ctrl) {
+            node = zh_open_find(h->old_ctrl, h->old_nodeq, 1u << h->old_log2,
+                                h64, hash, key, key_len);
+        }
+    } else {
+        node = zh_find_in_collision(h, hash, key, key_len);
+    }
     if (node) {
         h->ret_flag |= ZHASH_FOUND;
         return node;
@@ -121,29 +695,62 @@ zaddr_t     zhash_touch_node(zhash_t    *h,
     if (b_insert) 
     {
         zsq_char_t *saved_key = 0;
+        zcount_t    max_used  = (zcount_t)(h->depth - h->depth / 8);
 
-        if ( zarray_get_space(h->nodeq) <= 0 ) {
-            xerr("<zhash> hash table overflow!\n");
-            h->ret_flag |= ZHASH_NODE_BUF_OVERFLOW;
-            return 0;
-        } 
+        if (h->b_open) {
+            if (!h->old_ctrl && zarray_get_count(h->nodeq) + h->tombs >= max_used) {
+                /* mostly tombstones: same size */
+                zh_open_grow(h, zarray_get_count(h->nodeq) >= max_used / 2
+                                ? h->depth_log2 + 1 : h->depth_log2);
+                max_used = (zcount_t)(h->depth - h->depth / 8);
+            }
+            if (zarray_get_count(h->nodeq) + h->tombs >= max_used) {
+                xerr("<zhash> hash table overflow!\n");
+                h->ret_flag |= ZHASH_NODE_BUF_OVERFLOW;
+                return 0;
+            }
+        } else if (!h->old_tbl && h->count >= (zcount_t)h->depth) {
+            zh_grow(h);
+        }
 
-        saved_key = zstrq_push_back(h->strq, key, key_len);
+        saved_key = zstrq_push_back_hashed(h->strq, key, key_len, hash);
         if ( saved_key == 0 ) {
             xerr("<zhash> key buf overflow!\n");
             h->ret_flag |= ZHASH_KEY_BUF_OVERFLOW;
             return 0;
         }
-        
-        node = zarray_push_back(h->nodeq, 0);
-        node->hash = hash;
-        node->key  = saved_key;
 
-        /* insert to front */
-        zh_node_t *head = h->hash_tbl[GETLSBS(hash, h->depth_log2)];
-        node->next = head ? head->next : 0;
-        h->hash_tbl[GETLSBS(hash, h->depth_log2)] = node;
+        if (h->b_open) {
+            node = zh_open_take(h, h64);
+        } else if ((node = h->free_list) != 0) {
+            h->free_list = node->next;
+            memset(node, 0, h->node_size);
+        } else {
+            node = zh_nodeq_push(h->nodeq, h->nodeq_ext);
+        }
+        if ( node == 0 ) {
+            xerr("<zhash> hash table overflow!\n");
+            h->ret_flag |= ZHASH_NODE_BUF_OVERFLOW;
+            zstrq_pop_back(h->strq, 0);
+            return 0;
+        } 
+        node->hash    = hash;
+        node->key_len = key_len;
+        node->key     = saved_key;
+        node->key_idx = zstrq_get_str_count(h->strq) - 1;
+        h->count     += 1;
+
+        if (!h->b_open) {
+            /* insert to front */
+            zh_head_t *head = zh_bucket(h, hash);
+            node->next = *head;
+            *head = node;
+        }
 
+        /* the node is findable by its key now, for the key moves */
+        if (h->old_strq) {
+            zh_key_move_step(h);
+        }
         return node;
     }
 
@@ -160,6 +767,83 @@ zaddr_t     zhash_set_node(zhash_t *h, const char *key, uint32_t keylen)
     return zhash_touch_node(h, key, keylen, 1);
 }
 
+/** open table: the slot of @node in @ctrl/@nodeq, -1 if not a live one */
+static
+zqidx_t zh_open_slot_of(const uint8_t *ctrl, zarray_t *nodeq, zaddr_t node)
+{
+    zqidx_t i;
+    if (!ctrl || !zarray_is_elem_base_in_buf(nodeq, node)) {
+        return -1;
+    }
+    i = (zqidx_t)(((char *)node - (char *)nodeq->elem_array) / nodeq->elem_size);
+    return ZH_IS_FULL(ctrl, i) ? i : -1;
+}
+
+int zhash_del_node(zhash_t *h, zaddr_t base)
+{
+    zh_node_t *node = base, **link;
+    zqidx_t i;
+
+    if (!node || !node->key) {
+        return 0;
+    }
+
+    if (h->b_open) {
+        if ((i = zh_open_slot_of(h->ctrl, h->nodeq, node)) >= 0) {
+            zh_ctrl_set(h->ctrl, h->depth, i, ZH_CTRL_DELETED);
+            h->nodeq->count -= 1;
+            h->tombs += 1;
+        } else if ((i = zh_open_slot_of(h->old_ctrl, h->old_nodeq, node)) >= 0) {
+            zh_ctrl_set(h->old_ctrl, 1u << h->old_log2, i, ZH_CTRL_DELETED);
+            h->old_nodeq->count -= 1;
+        } else {
+            return 0;
+        }
+    } else {
+        for (link = zh_bucket(h, node->hash); *link && *link != node; link = &(*link)->next) {
+        }
+        if (!*link) {
+            return 0;
+        }
+        *link = node->next;
+        node->next = h->free_list;
+        h->free_list = node;
+    }
+
+    if (h->old_strq && node->key_idx < zstrq_get_str_count(h->old_strq) &&
+            zstrq_get_str_base(h->old_strq, node->key_idx) == node->key) {
+        zstrq_del_str(h->old_strq, node->key_idx);
+    } else {
+        zstrq_del_str(h->strq, node->key_idx);
+    }
+    node->key = 0;
+    node->key_len = 0;
+    h->count -= 1;
+
+    if (h->old_strq) {
+        zh_key_move_step(h);
+    } else {
+        zh_key_move_start(h);
+    }
+    return 1;
+}
+
+int zhash_del_key(zhash_t *h, const char *key, uint32_t key_len)
+{
+    zaddr_t node = zhash_touch_node(h, key, key_len, 0);
+    return node ? zhash_del_node(h, node) : 0;
+}
+
+zcount_t    zhash_get_count(zhash_t *h)
+{
+    return h->count;
+}
+
+int         zhash_is_rehashing(zhash_t *h)
+{
+    return h->old_tbl || h->old_ctrl;
+}
+
 int         zhash_ret_flag(zhash_t *h)
 {
     return h->ret_flag;
@@ -188,25 +872,90 @@ zh_iter_t   zhash_iter(zhash_t *h)
     zh_iter_t iter = {h, 0};
     return iter;
 }
+
+/**
+ * open table: the full slot from @i on in direction @dir, 0 if none.
+ * Slots of the table being moved out follow the current ones.
+ */
+static
+zaddr_t zh_open_iter_seek(zh_iter_t *iter, zqidx_t i, int dir)
+{
+    zhash_t *h = iter->h;
+    zqidx_t  n = h->depth + (h->old_ctrl ? (1 << h->old_log2) : 0);
+
+    for (; 0 <= i && i < n; i += dir) {
+        int b_old = i >= (zqidx_t)h->depth;
+        zqidx_t j = b_old ? i - (zqidx_t)h->depth : i;
+        if (ZH_IS_FULL(b_old ? h->old_ctrl : h->ctrl, j)) {
+            iter->iter_idx = i;
+            return ZH_OPEN_NODE(b_old ? h->old_nodeq : h->nodeq, j);
+        }
+    }
+    iter->iter_idx = i;
+    return 0;
+}
+
 zaddr_t zhash_iter_curr(zh_iter_t *iter)
 {
-    return zarray_get_elem_base(iter->h->nodeq, iter->iter_idx);
+    zhash_t *h = iter->h;
+    zh_node_t *node;
+    if (h->b_open) {
+        zqidx_t i = iter->iter_idx;
+        if (0 <= i && i < (zqidx_t)h->depth) {
+            return ZH_IS_FULL(h->ctrl, i) ? ZH_OPEN_NODE(h->nodeq, i) : 0;
+        }
+        i -= h->depth;
+        if (h->old_ctrl && 0 <= i && i < (1 << h->old_log2)) {
+            return ZH_IS_FULL(h->old_ctrl, i) ? ZH_OPEN_NODE(h->old_nodeq, i) : 0;
+        }
+        return 0;
+    }
+    node = zh_nodeq_at(h->nodeq, h->nodeq_ext, iter->iter_idx);
+    return node && node->key ? node : 0;
+}
+
+/** chained table: the live node from @i on in direction @dir, 0 if none */
+static
+zaddr_t zh_iter_seek(zh_iter_t *iter, zqidx_t i, int dir)
+{
+    zhash_t *h = iter->h;
+    zh_node_t *node;
+
+    for (; (node = zh_nodeq_at(h->nodeq, h->nodeq_ext, i)) != 0; i += dir) {
+        if (node->key) {
+            break;
+        }
+    }
+    iter->iter_idx = i;
+    return node;
 }
 
 zaddr_t zhash_iter_front(zh_iter_t *iter) 
 {
-    return zarray_get_elem_base(iter->h->nodeq, iter->iter_idx=0);
+    if (iter->h->b_open) {
+        return zh_open_iter_seek(iter, 0, 1);
+    }
+    return zh_iter_seek(iter, 0, 1);
 }
 zaddr_t zhash_iter_back(zh_iter_t *iter)  
 { 
-    zcount_t count = zarray_get_count(iter->h->nodeq);
-    return zarray_get_elem_base(iter->h->nodeq, iter->iter_idx=count-1);
+    zhash_t *h = iter->h;
+    if (h->b_open) {
+        return zh_open_iter_seek(iter, h->depth + (h->old_ctrl ? (1 << h->old_log2) : 0) - 1, -1);
+    }
+    return zh_iter_seek(iter, zh_nodeq_used(h->nodeq, h->nodeq_ext) - 1, -1);
 }
 zaddr_t zhash_iter_next(zh_iter_t *iter)  
 { 
-    return zarray_get_elem_base(iter->h->nodeq, ++ iter->iter_idx);
+    if (iter->h->b_open) {
+        return zh_open_iter_seek(iter, iter->iter_idx + 1, 1);
+    }
+    return zh_iter_seek(iter, iter->iter_idx + 1, 1);
 }
 zaddr_t zhash_iter_prev(zh_iter_t *iter)  
 { 
-    return zarray_get_elem_base(iter->h->nodeq, -- iter->iter_idx);
+    if (iter->h->b_open) {
+        return zh_open_iter_seek(iter, iter->iter_idx - 1, -1);
+    }
+    return zh_iter_seek(iter, iter->iter_idx - 1, -1);
 }
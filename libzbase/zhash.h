@@ -35,7 +35,9 @@ typedef struct zhash_node   zh_node_t;
     struct {\
         zh_node_t  *next;   \
         zh_hval_t   hash;   \
-        char       *key;    \
+        uint32_t    key_len;\
+        char       *key;    /* 0 if deleted */ \
+        zqidx_t     key_idx;/* in strq */ \
     };\
 }
 
@@ -45,6 +47,19 @@ struct zhash_node {
 
 typedef zh_node_t* zh_head_t;
 
+/**
+ * Key hash, 64 bits. The node keeps the 32-bit fold of it and the bucket
+ * is taken from the low bits, so they have to be well mixed.
+ */
+typedef uint64_t (*zh_hash_func_t)(const char *key, uint32_t key_len, uint64_t seed);
+
+#define     ZH_GROUP                    (16)        //<! ctrl bytes probed at once
+#define     ZH_NODEQ_EXT                (24)        //<! max node blocks after nodeq
+#define     ZH_DEPTH_LOG2_MAX           (30)        //<! no growth past 2^30 buckets
+#define     ZH_REHASH_STEP              (8)         //<! buckets moved per op, x2 slots if open
+#define     ZH_RELEASE_BYTES            (1<<18)     //<! old table given back by this much
+#define     ZH_KEY_MOVE_STEP            (16)        //<! keys moved to a new strq per op
+
 typedef struct zhash
 {
     uint32_t    depth_log2;
@@ -56,6 +71,29 @@ typedef struct zhash
     zstrq_t    *strq;           //<! key_buf
     
     uint32_t    ret_flag;
+
+    zh_hash_func_t  hash_func;  //<! zh_hash_wy64() by default
+    uint64_t        seed;       //<! random per table by default
+
+    /* open addressing, see zhash_malloc_open() */
+    int         b_open;
+    uint8_t    *ctrl;           //<! [depth + ZH_GROUP], a tag per nodeq slot, tail mirrors the head
+
+    /* growth, see zhash_malloc() */
+    zcount_t    count;
+    zarray_t   *nodeq_ext[ZH_NODEQ_EXT];    //<! chained: node blocks after nodeq, [k] is depth(nodeq) << k
+    uint32_t    old_log2;
+    zh_head_t  *old_tbl;        //<! chained: buckets not moved yet, 0 if not rehashing
+    uint8_t    *old_ctrl;       //<! open: slots not moved yet, 0 if not rehashing
+    zarray_t   *old_nodeq;
+    uint32_t    rehash_idx;     //<! old buckets/slots below it are moved
+    uint32_t    rehash_rel;     //<! old buckets/slots below it are given back
+
+    /* deletion, see zhash_del_node() */
+    zh_node_t  *free_list;      //<! chained: deleted nodes, linked by next
+    zcount_t    tombs;          //<! open: deleted slots in ctrl
+    zstrq_t    *old_strq;       //<! keys not moved yet, 0 if not moving
+    zqidx_t     key_move_idx;   //<! keys of old_strq below it are moved
 }zhash_t;
 
 
@@ -64,11 +102,58 @@ typedef struct zhash
 #define     ZHASH_KEY_BUF_OVERFLOW      (1<<2)
 #define     ZHASH_OBJ_BUF_OVERFLOW      (1<<3)
 int         zhash_ret_flag(zhash_t *h);
+
+/**
+ * Chained table of 2^@depth_log2 buckets to start with. It grows without
+ * a stop: when the nodes reach the bucket count, a table twice as large is
+ * added and each get/set moves up to ZH_REHASH_STEP buckets of the old one
+ * until it's empty, a key is in the old table iff its old bucket isn't
+ * moved yet. Nodes never move, they're added in blocks, each one the size
+ * of all before together, so the node room doubles with each block.
+ */
 zhash_t*    zhash_malloc(uint32_t node_size, uint32_t depth_log2);
 #define     ZHASH_MALLOC(type_t, log2)  zhash_malloc(sizeof(type_t), (log2))
+
+/**
+ * Open addressing (Swiss table): nodeq is a flat array of 2^@depth_log2
+ * slots, at least ZH_GROUP, filled up to 7/8. A slot's ctrl byte is empty
+ * or the 7 low bits of the key hash, a lookup compares a group of 16 ctrl
+ * bytes at once (SSE2) and only visits the nodes whose tag matches.
+ * Groups are probed at triangular steps from the slot of the upper bits.
+ * Same API as the chained table, except the collision link iterators;
+ * the iterators walk the slots in table order, not insertion order.
+ *
+ * At 7/8 a table twice as large is added, and each set moves up to
+ * 2 x ZH_REHASH_STEP slots of the old one, so a set may move nodes got
+ * before: a node pointer is valid until the next set.
+ */
+zhash_t*    zhash_malloc_open(uint32_t node_size, uint32_t depth_log2);
+#define     ZHASH_MALLOC_OPEN(type_t, log2) zhash_malloc_open(sizeof(type_t), (log2))
 void        zhash_free(zhash_t *h);
 
 
+/**
+ * wyhash-style: 16 bytes per 64x64->128 multiply-fold step, 48 per round
+ * of 3 independent lanes for long keys, short keys read with 2~4 loads.
+ */
+uint64_t    zh_hash_wy64(const char *key, uint32_t key_len, uint64_t seed);
+
+/** the former hash, one multiply by 33 per byte, @seed is the initial value */
+uint64_t    zh_hash_time33(const char *key, uint32_t key_len, uint64_t seed);
+
+/** a new random seed, from the clock, an address and a counter */
+uint64_t    zh_hash_seed(void);
+
+/** 32-bit node hash of a 64-bit one */
+#define     ZH_HASH_FOLD(h64)           ((zh_hval_t)((h64) ^ ((h64) >> 32)))
+
+/**
+ * Change the hash of an empty table, e.g. a fixed @seed for reproducible
+ * layouts. @return 1 if set, 0 if the table has nodes already
+ */
+int         zhash_set_hash_func(zhash_t *h, zh_hash_func_t func, uint64_t seed);
+
+
 /**
  *  @param key_len  - If 0, @key_len is ignored, @key is null end str. 
  *                  - Else, @key_len is forced to be the length for @key 
@@ -76,6 +161,40 @@ void        zhash_free(zhash_t *h);
 zaddr_t     zhash_get_node(zhash_t *h, const char *key, uint32_t key_len);
 zaddr_t     zhash_set_node(zhash_t *h, const char *key, uint32_t key_len);
 
+zcount_t    zhash_get_count(zhash_t *h);
+int         zhash_is_rehashing(zhash_t *h);
+
+/**
+ * Deletion. The key is deleted from strq. Once the deleted keys of strq
+ * outnumber the live ones, the live ones are moved to a new strq,
+ * ZH_KEY_MOVE_STEP per set/del, and the old one is freed with its chars
+ * and index, so node->key changes then.
+ *  -chained: the node is unlinked from its chain and put on free_list,
+ *   the next set takes it back. Other nodes don't move.
+ *  -open: the slot becomes a tombstone, reused by a set probing it. A set
+ *   finding no room for tombstones rehashes to a table of the same size
+ *   if most of the used slots are tombstones.
+ * The iterators skip deleted nodes, a node can be deleted while iterating.
+ * @return 1 if deleted, 0 if not found, or @node isn't a node of @h
+ */
+int         zhash_del_node(zhash_t *h, zaddr_t node);
+int         zhash_del_key(zhash_t *h, const char *key, uint32_t key_len);
+
+/** node blocks of chained tables: @nodeq, then @ext[k] of depth(@nodeq) << k */
+zaddr_t     zh_nodeq_push(zarray_t *nodeq, zarray_t **ext);    //<! @return a zeroed node
+zaddr_t     zh_nodeq_at(zarray_t *nodeq, zarray_t **ext, zqidx_t idx);
+zcount_t    zh_nodeq_depth(zarray_t *nodeq, zarray_t **ext);
+zcount_t    zh_nodeq_used(zarray_t *nodeq, zarray_t **ext);     //<! pushed, deleted ones too
+int         zh_nodeq_has(zarray_t *nodeq, zarray_t **ext, zaddr_t base);
+void        zh_nodeq_free(zarray_t **ext);
+
+/**
+ * Give the pages of bytes [@from, @to) of an old table back as the rehash
+ * leaves them, so that freeing it at the end isn't a pass over all of its
+ * pages. The bytes read 0 after. madvise() on linux, else a no-op.
+ */
+void        zh_release_moved(void *base, size_t from, size_t to);
+
 
 /** iterators for traverse through hash collision link */
 typedef struct zhash_collision_iterator {
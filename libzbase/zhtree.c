@@ -22,9 +22,6 @@
 #include "zhtree.h"
 #include "sim_log.h"
 
-static uint32_t zht_nstr_time33(uint32_t type, const char *key, uint32_t key_len);
-static uint32_t zht_cstr_time33(uint32_t type, const char *key, uint32_t *key_len);
-
 static zht_node_t *zhtree_mount_new_child(zhtree_t *h, zht_node_t *parent, zht_node_t *node);
 static zht_node_t *zhtree_find_in_children(zhtree_t *h, zht_node_t *parent, 
                             zh_hval_t hash, const char *key, uint32_t key_len);
@@ -40,13 +37,14 @@ zhtree_t *zhtree_malloc(uint32_t node_size, uint32_t depth_log2)
         return 0;
     }
 
+    depth_log2 = MIN(depth_log2, ZH_DEPTH_LOG2_MAX);
     zh->depth_log2 = depth_log2;
     zh->depth = 1 << depth_log2;
+    zh->node_size = node_size;
 
     zh->hash_tbl = calloc(zh->depth, sizeof(zht_head_t));
     zh->nodeq = zarray_malloc_s(node_size, zh->depth);
-    zarray_memzero(zh->nodeq);
-    zh->strq  = zstrq_malloc(0);
+    zh->strq  = zstrq_malloc_chunked(0);         /* keys never move */
 
     if (!zh->hash_tbl || !zh->nodeq || !zh->strq) {
         xerr("<zhtree> buf malloc failed!\n");
@@ -55,16 +53,20 @@ zhtree_t *zhtree_malloc(uint32_t node_size, uint32_t depth_log2)
     }
 
     static char name[] = "root";
-    zht_node_t *root = zarray_push_back(zh->nodeq, 0);
+    zht_node_t *root = zh_nodeq_push(zh->nodeq, zh->nodeq_ext);
     if ( root == 0 ) {
         xerr("<zhtree> no room for root!\n");
         zhtree_free(zh);
+        return 0;
     }
-    memset(root, 0, sizeof(zht_node_t));
     root->key = name;
+    root->key_len = sizeof(name) - 1;
     zh->root = root;
     zh->wnode = root;
+    zh->count = 1;
 
+    zh->hash_func = zh_hash_wy64;
+    zh->seed      = zh_hash_seed();
     return zh;
 }
 
@@ -74,37 +76,21 @@ void zhtree_free(zhtree_t *h)
         if (h->hash_tbl) { free(h->hash_tbl); }
         if (h->nodeq) { zarray_free(h->nodeq); }
         if (h->strq) { zstrq_free(h->strq); }
+        if (h->old_tbl) { free(h->old_tbl); }
+        zh_nodeq_free(h->nodeq_ext);
         free(h);
     }
 }
 
-static 
-uint32_t zht_nstr_time33(uint32_t type, const char *key, uint32_t key_len)
-{
-    uint32_t i = 0;
-    uint32_t hash = type * 33 + '/';
-    for (i=0; i<key_len; ++i) {
-        hash = hash * 33 + key[i]; 
-    } 
-
-    return hash; 
-}
-
-static 
-uint32_t zht_cstr_time33(uint32_t type, const char *key, uint32_t *key_len)
+int zhtree_set_hash_func(zhtree_t *h, zh_hash_func_t func, uint64_t seed)
 {
-    int      c = 0;
-    uint32_t i = 0;
-    uint32_t hash = type * 33 + '/';
-    for (i=0; (c=key[i]); ++i) {
-        hash = hash * 33 + c; 
-    } 
-
-    if (key_len) { 
-        *key_len = i;
+    if (h->count > 1) {
+        xerr("<zhtree> %s(): the tree isn't empty\n", __FUNCTION__);
+        return 0;
     }
-
-    return hash; 
+    h->hash_func = func ? func : zh_hash_wy64;
+    h->seed      = seed;
+    return 1;
 }
 
 zaddr_t zhtree_get_root(zhtree_t *h)
@@ -120,17 +106,17 @@ zaddr_t zhtree_get_wnode(zhtree_t *h)
 
 zcount_t    zhtree_get_depth(zhtree_t *h)
 {
-    return zarray_get_depth(h->nodeq);
+    return zh_nodeq_depth(h->nodeq, h->nodeq_ext);
 }
 
 zcount_t    zhtree_get_count(zhtree_t *h)
 {
-    return zarray_get_count(h->nodeq);
+    return h->count;
 }
 
 zspace_t    zhtree_get_space(zhtree_t *h)
 {
-    return zarray_get_space(h->nodeq);
+    return zhtree_get_depth(h) - h->count;
 }
 
 /*
@@ -147,12 +133,21 @@ int zhtree_ret_flag(zhtree_t *h)
 
 int zhtree_is_node_in_buf(zhtree_t *h, zaddr_t node_base)
 {
-    return zarray_is_elem_base_in_buf(h->nodeq, node_base);
+    int k;
+    if (zarray_is_elem_base_in_buf(h->nodeq, node_base)) {
+        return 1;
+    }
+    for (k=0; k<ZH_NODEQ_EXT && h->nodeq_ext[k]; ++k) {
+        if (zarray_is_elem_base_in_buf(h->nodeq_ext[k], node_base)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 int zhtree_is_node_in_use(zhtree_t *h, zaddr_t node_base)
 {
-    return zarray_is_elem_base_in_use(h->nodeq, node_base);
+    return zh_nodeq_has(h->nodeq, h->nodeq_ext, node_base);
 }
 
 zht_child_iter_t   zht_child_iter_init(zht_node_t *parent)
@@ -227,7 +222,7 @@ zht_node_t *zhtree_find_in_children(zhtree_t *h, zht_node_t *parent,
     WHILE_GET_ZHT_CHILD(iter, node) 
     {
         if (node->hash==hash && node->parent==parent &&
-                node->key[key_len]==0 && strncmp(node->key, key, key_len)==0) 
+                node->key_len==key_len && memcmp(node->key, key, key_len)==0) 
         {
             return node;
         }
@@ -235,17 +230,85 @@ zht_node_t *zhtree_find_in_children(zhtree_t *h, zht_node_t *parent,
     return 0;
 }
 
+/** the bucket of @hash, in the old table if it's not moved yet */
+static inline
+zht_head_t *zhtree_bucket(zhtree_t *h, zh_hval_t hash)
+{
+    if (h->old_tbl) {
+        uint32_t b = GETLSBS(hash, h->old_log2);
+        if (b >= h->rehash_idx) {
+            return &h->old_tbl[b];
+        }
+    }
+    return &h->hash_tbl[GETLSBS(hash, h->depth_log2)];
+}
+
+/** move up to ZH_REHASH_STEP chains, and visit up to 10x as many empty buckets */
+static
+void zhtree_rehash_step(zhtree_t *h)
+{
+    uint32_t old_depth = 1u << h->old_log2;
+    int moved = 0, empty = 0;
+
+    while (h->rehash_idx < old_depth && moved < ZH_REHASH_STEP && empty < ZH_REHASH_STEP * 10) {
+        zht_node_t *node = h->old_tbl[h->rehash_idx], *next;
+        zht_head_t *head;
+
+        if (!node) {
+            empty += 1;
+        } else {
+            moved += 1;
+        }
+        for (; node; node = next) {
+            next = (zht_node_t *)node->next;
+            head = &h->hash_tbl[GETLSBS(node->hash, h->depth_log2)];
+            node->next = (zh_node_t *)*head;
+            *head = node;
+        }
+        h->old_tbl[h->rehash_idx++] = 0;
+    }
+    if (h->rehash_idx >= old_depth) {
+        SIM_FREEP(h->old_tbl);
+    } else if ((h->rehash_idx - h->rehash_rel) * sizeof(zht_head_t) >= ZH_RELEASE_BYTES) {
+        zh_release_moved(h->old_tbl, h->rehash_rel * sizeof(zht_head_t),
+                         h->rehash_idx * sizeof(zht_head_t));
+        h->rehash_rel = h->rehash_idx;
+    }
+}
+
+static
+void zhtree_grow(zhtree_t *h)
+{
+    zht_head_t *tbl;
+
+    if (h->depth_log2 >= ZH_DEPTH_LOG2_MAX) {
+        return;
+    }
+    tbl = calloc((size_t)h->depth * 2, sizeof(zht_head_t));
+    if (!tbl) {
+        xwarn("<zhtree> no memory to grow to 2^%u buckets\n", h->depth_log2 + 1);
+        return;
+    }
+    h->old_tbl    = h->hash_tbl;
+    h->old_log2   = h->depth_log2;
+    h->rehash_idx = 0;
+    h->rehash_rel = 0;
+    h->hash_tbl   = tbl;
+    h->depth_log2 += 1;
+    h->depth     <<= 1;
+}
+
 static
 zht_node_t *zhtree_find_in_collision(zhtree_t *h, zht_node_t *parent, 
                             zh_hval_t hash, const char *key, uint32_t key_len)
 {
-    zht_node_t *head = h->hash_tbl[GETLSBS(hash, h->depth_log2)];
+    zht_node_t *head = *zhtree_bucket(h, hash);
     zht_node_t *node = 0;
     zh_link_iter_t iter = zh_link_iter_init((zh_node_t *)head);
     WHILE_GET_COLLISION_NODE(iter, node) 
     {
         if (node->hash==hash && node->parent==parent &&
-                node->key[key_len]==0 && strncmp(node->key, key, key_len)==0) 
+                node->key_len==key_len && memcmp(node->key, key, key_len)==0) 
         {
             return node;
         }
@@ -258,8 +321,15 @@ zaddr_t zhtree_touch_child_internal(zhtree_t *h, zht_node_t *parent,
                         const char  *key, uint32_t key_len, 
                         int b_insert)
 {
-    uint32_t hash = key_len ? zht_nstr_time33(parent->hash, key, key_len)
-                            : zht_cstr_time33(parent->hash, key, &key_len);
+    uint64_t seed = h->seed ^ ((uint64_t)parent->hash * 0x9e3779b97f4a7c15ull);
+    uint32_t hash;
+
+    key_len = key_len ? key_len : (uint32_t)strlen(key);
+    hash = ZH_HASH_FOLD(h->hash_func(key, key_len, seed));
+
+    if (h->old_tbl) {
+        zhtree_rehash_step(h);
+    }
 
     /* we don't use @func zhtree_find_in_children() 
        because hash is thought to be faster */
@@ -271,26 +341,34 @@ zaddr_t zhtree_touch_child_internal(zhtree_t *h, zht_node_t *parent,
 
     if (b_insert) 
     {
-        zsq_char_t *saved_key = zstrq_push_back(h->strq, key, key_len);
+        if (!h->old_tbl && h->count >= (zcount_t)h->depth) {
+            zhtree_grow(h);
+        }
+
+        zsq_char_t *saved_key = zstrq_push_back_hashed(h->strq, key, key_len, hash);
         if ( saved_key == 0 ) {
             xerr("<zhtree> key buf overflow!\n");
             h->ret_flag |= ZHASH_KEY_BUF_OVERFLOW;
             return 0;
         }
 
-        node = zarray_push_back(h->nodeq, 0);
+        node = zh_nodeq_push(h->nodeq, h->nodeq_ext);
         if ( node == 0 ) {
             xerr("<zhtree> hash table overflow!\n");
             h->ret_flag |= ZHASH_NODE_BUF_OVERFLOW;
+            zstrq_pop_back(h->strq, 0);
             return 0;
         } 
-        node->hash = hash;
-        node->key  = saved_key;
+        node->hash    = hash;
+        node->key_len = key_len;
+        node->key     = saved_key;
+        node->key_idx = zstrq_get_str_count(h->strq) - 1;
+        h->count     += 1;
         
         /* insert to hash collision link */
-        zht_node_t *head = h->hash_tbl[GETLSBS(hash, h->depth_log2)];
-        node->next = head ? head->next : 0;
-        h->hash_tbl[GETLSBS(hash, h->depth_log2)] = node;
+        zht_head_t *head = zhtree_bucket(h, hash);
+        node->next = (zh_node_t *)*head;
+        *head = node;
 
         /* insert to children link */
         zhtree_mount_new_child(h, parent, node);
@@ -515,7 +593,7 @@ int  zht_path_snprint(zht_path_t *iter, char *str, int size)
     zht_node_t *node = 0;
     WHILE_ZHT_PATH_DOWN(iter, node)
     {
-        int keylen = strlen(node->key);
+        int keylen = node->key_len;
         if (need < size) {
             if (left > keylen) {
                 strcpy(str, node->key);
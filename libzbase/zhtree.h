@@ -56,6 +56,17 @@ typedef struct zhtree
     zstrq_t     *strq;              //<! key_buf
     
     uint32_t     ret_flag;
+
+    zh_hash_func_t  hash_func;      //<! zh_hash_wy64() by default
+    uint64_t        seed;           //<! random per tree by default
+
+    /* growth, as zhash_malloc() */
+    zcount_t     count;
+    zarray_t    *nodeq_ext[ZH_NODEQ_EXT];
+    uint32_t     old_log2;
+    zht_head_t  *old_tbl;
+    uint32_t     rehash_idx;
+    uint32_t     rehash_rel;
     
 //private:    
     zaddr_t      root;
@@ -68,6 +79,7 @@ typedef struct zhtree
 #define     ZHTREE_KEY_BUF_OVERFLOW      (1<<2)
 #define     ZHTREE_OBJ_BUF_OVERFLOW      (1<<3)
 
+/** 2^@depth_log2 buckets to start with, grows by incremental rehash as zhash */
 zhtree_t*   zhtree_malloc(uint32_t node_size, uint32_t depth_log2);
 #define     ZHTREE_MALLOC(type_t, log2)  zhtree_malloc(sizeof(type_t), (log2))
 void        zhtree_free(zhtree_t *h);
@@ -80,6 +92,12 @@ zcount_t    zhtree_get_depth(zhtree_t *h);
 zcount_t    zhtree_get_count(zhtree_t *h);
 zspace_t    zhtree_get_space(zhtree_t *h);
 
+/**
+ * Change the hash of a tree holding only the root, see zhash_set_hash_func().
+ * A child's hash is of its key, seeded with @seed and the parent's hash.
+ */
+int         zhtree_set_hash_func(zhtree_t *h, zh_hash_func_t func, uint64_t seed);
+
 /**
  *  @param key_len  - If 0, @key_len is ignored, @key is null end str. 
  *                  - Else, @key_len is forced to be the length for @key 
@@ -0,0 +1,174 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "zmpmcq.h"
+#include "sim_log.h"
+
+
+#define ZMPMCQ_SPIN_LIMIT   (1<<6)      /* max relax per round before yield */
+
+static
+void zmpmcq_backoff(uint32_t *spins)
+{
+    uint32_t i;
+    if (*spins < ZMPMCQ_SPIN_LIMIT) {
+        for (i=0; i<*spins; ++i) {
+            ZCPU_RELAX();
+        }
+        *spins = *spins ? (*spins << 1) : 1;
+    } else {
+        sched_yield();
+    }
+}
+
+zmpmcq_t* zmpmcq_malloc(uint32_t elem_size, uint32_t depth)
+{
+    zmpmcq_t *mq = 0;
+    uint32_t pow2 = zpow2_roundup(MAX(depth, 2));
+    uint32_t i;
+
+    if (!pow2 || pow2 > (1u<<30)) {
+        xerr("<zmpmcq> invalid depth %u\n", depth);
+        return 0;
+    }
+
+    mq = aligned_alloc(ZCACHE_LINE_SIZE, sizeof(zmpmcq_t));
+    if (!mq) {
+        xerr("<zmpmcq> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    memset(mq, 0, sizeof(zmpmcq_t));
+
+    mq->seq = malloc(pow2 * sizeof(atomic_uint_fast64_t));
+    if (!mq->seq || !zqueue_buf_malloc(&mq->q, elem_size, pow2, 0)) {
+        xerr("<zmpmcq> %s() failed!\n", __FUNCTION__);
+        zmpmcq_free(mq);
+        return 0;
+    }
+
+    mq->mask = pow2 - 1;
+    for (i=0; i<pow2; ++i) {
+        atomic_init(&mq->seq[i], i);
+    }
+    atomic_init(&mq->enqueue_pos, 0);
+    atomic_init(&mq->dequeue_pos, 0);
+
+    return mq;
+}
+
+void zmpmcq_free(zmpmcq_t *mq)
+{
+    if (mq) {
+        zqueue_buf_free(&mq->q);
+        SIM_FREEP(mq->seq);
+        free(mq);
+    }
+}
+
+zcount_t zmpmcq_get_depth(zmpmcq_t *mq)
+{
+    return mq->q.depth;
+}
+
+zcount_t zmpmcq_get_count(zmpmcq_t *mq)
+{
+    uint64_t enq = atomic_load_explicit(&mq->enqueue_pos, memory_order_relaxed);
+    uint64_t deq = atomic_load_explicit(&mq->dequeue_pos, memory_order_relaxed);
+    return enq > deq ? (zcount_t)MIN(enq - deq, mq->mask + 1) : 0;
+}
+
+zcount_t zmpmcq_try_push(zmpmcq_t *mq, const void *elem_base)
+{
+    uint64_t pos = atomic_load_explicit(&mq->enqueue_pos, memory_order_relaxed);
+    uint64_t bidx;
+
+    for (;;) {
+        uint64_t seq;
+        int64_t  diff;
+
+        bidx = pos & mq->mask;
+        seq  = atomic_load_explicit(&mq->seq[bidx], memory_order_acquire);
+        diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&mq->enqueue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;                   /* full */
+        } else {
+            pos = atomic_load_explicit(&mq->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(ZQUEUE_ELEM_BASE((&mq->q), bidx), elem_base, mq->q.elem_size);
+    atomic_store_explicit(&mq->seq[bidx], pos + 1, memory_order_release);
+    return 1;
+}
+
+zcount_t zmpmcq_try_pop(zmpmcq_t *mq, void *dst_base)
+{
+    uint64_t pos = atomic_load_explicit(&mq->dequeue_pos, memory_order_relaxed);
+    uint64_t bidx;
+
+    for (;;) {
+        uint64_t seq;
+        int64_t  diff;
+
+        bidx = pos & mq->mask;
+        seq  = atomic_load_explicit(&mq->seq[bidx], memory_order_acquire);
+        diff = (int64_t)(seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&mq->dequeue_pos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0;                   /* empty */
+        } else {
+            pos = atomic_load_explicit(&mq->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    if (dst_base) {
+        memcpy(dst_base, ZQUEUE_ELEM_BASE((&mq->q), bidx), mq->q.elem_size);
+    }
+    atomic_store_explicit(&mq->seq[bidx], pos + mq->mask + 1, memory_order_release);
+    return 1;
+}
+
+zcount_t zmpmcq_push(zmpmcq_t *mq, const void *elem_base)
+{
+    uint32_t spins = 0;
+    while (!zmpmcq_try_push(mq, elem_base)) {
+        zmpmcq_backoff(&spins);
+    }
+    return 1;
+}
+
+zcount_t zmpmcq_pop(zmpmcq_t *mq, void *dst_base)
+{
+    uint32_t spins = 0;
+    while (!zmpmcq_try_pop(mq, dst_base)) {
+        zmpmcq_backoff(&spins);
+    }
+    return 1;
+}
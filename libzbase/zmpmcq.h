@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief bounded multi-producer/multi-consumer lock-free queue
+ *
+ *  -Elems live in a zqueue_t buffer (elem_array[bidx], elem_size stride).
+ *  -Each slot has a sequence number (Vyukov):
+ *      seq[bidx] == pos        slot is free for the pusher of @pos
+ *      seq[bidx] == pos + 1    slot is filled for the popper of @pos
+ *   A pusher/popper claims @pos by CAS on enqueue_pos/dequeue_pos, so
+ *   threads only contend on the shared cursor, never on a lock.
+ *  -depth is rounded up to power of 2.
+ */
+
+#ifndef ZMPMCQ_H_
+#define ZMPMCQ_H_
+
+#include <stdatomic.h>
+#include "zdefs.h"
+#include "zqueue.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+typedef struct z_mpmc_queue
+{
+    zqueue_t                q;              //<! elem_array/elem_size/depth
+    uint64_t                mask;           //<! depth - 1
+    atomic_uint_fast64_t   *seq;            //<! seq[depth]
+
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_uint_fast64_t    enqueue_pos;
+
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_uint_fast64_t    dequeue_pos;
+}zmpmcq_t;
+
+
+/** @param depth    would be rounded up to power of 2, at least 2 */
+zmpmcq_t*   zmpmcq_malloc(uint32_t elem_size, uint32_t depth);
+#define     ZMPMCQ_MALLOC(type_t, depth)    zmpmcq_malloc(sizeof(type_t), (depth))
+void        zmpmcq_free(zmpmcq_t *mq);
+
+zcount_t    zmpmcq_get_depth(zmpmcq_t *mq);
+zcount_t    zmpmcq_get_count(zmpmcq_t *mq);     //<! snapshot, may be stale
+
+/** @return 1, or 0 if full/empty at the moment */
+zcount_t    zmpmcq_try_push(zmpmcq_t *mq, const void *elem_base);
+zcount_t    zmpmcq_try_pop(zmpmcq_t *mq, void *dst_base);
+
+/**
+ * Spin (cpu relax) with exponential backoff, then yield the cpu,
+ * until the push/pop succeeds. @return 1
+ */
+zcount_t    zmpmcq_push(zmpmcq_t *mq, const void *elem_base);
+zcount_t    zmpmcq_pop(zmpmcq_t *mq, void *dst_base);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZMPMCQ_H_
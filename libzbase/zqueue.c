@@ -19,26 +19,55 @@
 #include <string.h>
 
 #include "zqueue.h"
+#include "zarray.h"
 #include "sim_log.h"
 
+#ifdef ZQUEUE_TELEMETRY
+#include <time.h>
+#if defined(ZQUEUE_TELEMETRY_TSC) && (defined(__x86_64__) || defined(__i386__))
+#define ZQ_TM_USE_TSC       1
+#include <x86intrin.h>
+#endif
+#define ZQ_TM_HOOK(q, call) do { if ((q)->telemetry) { call; } } while (0)
+#else
+#define ZQ_TM_HOOK(q, call) do {} while (0)
+#endif
+
+#if defined(__linux__)
+#define ZQUEUE_HAS_MIRROR   1
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 
-static zaddr_t  zqueue_elem_2_swap(zqueue_t *q, zqidx_t qidx);
-static zaddr_t  zqueue_swap_2_elem(zqueue_t *q, zqidx_t qidx);
 static int32_t  zqueue_safe_cmp(zq_cmp_func_t func, zaddr_t base1, zaddr_t base2);
-static void     zqueue_quick_sort_iter(zqueue_t *q, zq_cmp_func_t func, 
-                                       zqidx_t start, zqidx_t end);
 
 
 static zbidx_t  zq_op_push_front_upd(zqueue_t *q);
 static zbidx_t  zq_op_pop_front_upd(zqueue_t *q);
 static zbidx_t  zq_op_qidx_2_bidx(zqueue_t *q, zqidx_t qidx);
 static zqidx_t  zq_op_bidx_2_qidx(zqueue_t *q, zbidx_t bidx);
-static zaddr_t  zq_op_qidx_2_base(zqueue_t *q, zbidx_t qidx);
+static zaddr_t  zq_op_qidx_2_base(zqueue_t *q, zqidx_t qidx);
 static zqidx_t  zqueue_addr_2_bidx_in_buf(zqueue_t *q, zaddr_t elem_base, int is_base);
+static zcount_t zq_op_get_spans(zqueue_t *q, zqidx_t qidx, zcount_t count, zq_span_t span[2]);
+
+/* @count elems at @base as a zarray, for the contiguous engines */
+static void zq_op_array_view(zqueue_t *q, zarray_t *za, zaddr_t base, zcount_t count)
+{
+    zarray_buf_attach(za, base, q->elem_size, count);
+    za->count = count;
+}
+
+/* depth is power of 2: every wrap is a mask, no compare */
+#define     ZQ_POW2_WRAP(q, idx)    ((idx) & ((q)->depth - 1))
 
 static zbidx_t zq_op_push_front_upd(zqueue_t *q)
 {
     q->count += 1;
+    if (q->b_pow2) {
+        return q->start = ZQ_POW2_WRAP(q, q->start - 1);
+    }
     q->start -= 1;
     if (q->start < 0) {
         q->start = q->depth - 1;
@@ -49,6 +78,9 @@ static zbidx_t zq_op_push_front_upd(zqueue_t *q)
 static zbidx_t zq_op_pop_front_upd(zqueue_t *q)
 {
     q->count -= 1;
+    if (q->b_pow2) {
+        return q->start = ZQ_POW2_WRAP(q, q->start + 1);
+    }
     q->start += 1;
     if (q->start >= q->depth) {
         q->start = 0;
@@ -60,6 +92,9 @@ static zbidx_t zq_op_pop_front_upd(zqueue_t *q)
 static zqidx_t zq_op_bidx_2_qidx(zqueue_t *q, zbidx_t bidx)
 {
     zqidx_t qidx = bidx - q->start;
+    if (q->b_pow2) {
+        return ZQ_POW2_WRAP(q, qidx);
+    }
     qidx += (qidx < 0 ? q->depth : 0);
     return qidx;
 }
@@ -68,17 +103,33 @@ static zqidx_t zq_op_bidx_2_qidx(zqueue_t *q, zbidx_t bidx)
 static zbidx_t zq_op_qidx_2_bidx(zqueue_t *q, zqidx_t qidx)
 {
     zbidx_t bidx = qidx + q->start;
+    if (q->b_pow2) {
+        return ZQ_POW2_WRAP(q, bidx);
+    }
     bidx -= (bidx >= q->depth ? q->depth : 0);
     return bidx;
 }
 
 /* you must assert zqueue_is_qidx_in_buf(q, qidx) */
-static zaddr_t zq_op_qidx_2_base(zqueue_t *q, zbidx_t qidx)
+static zaddr_t zq_op_qidx_2_base(zqueue_t *q, zqidx_t qidx)
 {
-    zbidx_t bidx = zq_op_qidx_2_bidx(q, bidx);
+    zbidx_t bidx = zq_op_qidx_2_bidx(q, qidx);
     return ZQUEUE_ELEM_BASE(q, bidx);
 }
 
+/* you must assert [qidx, qidx+count) is in buf */
+static zcount_t zq_op_get_spans(zqueue_t *q, zqidx_t qidx, zcount_t count, zq_span_t span[2])
+{
+    zbidx_t  bidx  = zq_op_qidx_2_bidx(q, qidx);
+    zcount_t first = q->b_mirrored ? count : MIN(count, q->depth - bidx);
+
+    span[0].base  = ZQUEUE_ELEM_BASE(q, bidx);
+    span[0].count = first;
+    span[1].base  = (count > first) ? q->elem_array : 0;
+    span[1].count = count - first;
+    return count;
+}
+
 #define     ZQUEUE_NEAREST_BIDX(q, addr) \
         ((((char *)(addr))-((char *)(q->elem_array))) / (q->elem_size))
 
@@ -95,15 +146,243 @@ zqidx_t zqueue_addr_2_bidx_in_buf(zqueue_t *q, zaddr_t elem_base, int is_base)
 }
 
 
+#ifdef ZQUEUE_TELEMETRY
+struct zq_telemetry {
+    zq_stats_t  stats;
+    zqueue_t   *stamps;                 //<! uint64_t push time of q[i]
+};
+
+static inline uint64_t zq_tm_now()
+{
+#ifdef ZQ_TM_USE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline uint32_t zq_hist_idx(uint64_t v)
+{
+    int e;
+    if (v < ZQ_HIST_SUB_COUNT) {
+        return (uint32_t)v;
+    }
+    e = 63 - __builtin_clzll(v);
+    return (e - ZQ_HIST_SUB_BITS + 1) * ZQ_HIST_SUB_COUNT 
+         + (uint32_t)((v >> (e - ZQ_HIST_SUB_BITS)) & (ZQ_HIST_SUB_COUNT - 1));
+}
+
+static
+void zq_tm_record(struct zq_telemetry *tm, uint64_t now, uint64_t stamp)
+{
+    uint64_t lat = now > stamp ? now - stamp : 0;
+    tm->stats.hist[zq_hist_idx(lat)] += 1;
+    tm->stats.lat_count += 1;
+    tm->stats.lat_sum   += lat;
+    tm->stats.lat_max    = MAX(tm->stats.lat_max, lat);
+}
+
+/* @n elems were just put at q[qidx ... qidx+n-1] */
+static
+void zq_tm_pushed(zqueue_t *q, zqidx_t qidx, zcount_t n)
+{
+    struct zq_telemetry *tm = q->telemetry;
+    uint64_t now = zq_tm_now(), *p;
+    zq_span_t span[2];
+    zcount_t  i, k;
+
+    if (qidx == zqueue_get_count(tm->stamps)) {
+        zqueue_reserve_spans(tm->stamps, n, span);
+        for (k=0; k<2; ++k) {
+            for (i=0, p=span[k].base; i<span[k].count; ++i) {
+                p[i] = now;
+            }
+        }
+        zqueue_commit(tm->stamps, n);
+    } else {
+        for (i=0; i<n; ++i) {
+            zqueue_insert_elem(tm->stamps, qidx, &now);
+        }
+    }
+    tm->stats.pushes    += n;
+    tm->stats.high_water = MAX(tm->stats.high_water, q->count);
+}
+
+/* @n elems were just taken from q[qidx ... qidx+n-1] */
+static
+void zq_tm_popped(zqueue_t *q, zqidx_t qidx, zcount_t n)
+{
+    struct zq_telemetry *tm = q->telemetry;
+    uint64_t now = zq_tm_now(), stamp, *p;
+    zq_span_t span[2];
+    zcount_t  i, k;
+
+    if (qidx == 0) {
+        zqueue_peek_spans(tm->stamps, n, span);
+        for (k=0; k<2; ++k) {
+            for (i=0, p=span[k].base; i<span[k].count; ++i) {
+                zq_tm_record(tm, now, p[i]);
+            }
+        }
+        zqueue_consume(tm->stamps, n);
+    } else {
+        for (i=0; i<n; ++i) {
+            if (zqueue_pop_elem(tm->stamps, qidx, &stamp)) {
+                zq_tm_record(tm, now, stamp);
+            }
+        }
+    }
+    tm->stats.pops += n;
+}
+
+/* q was reordered, the stamps can't follow: all count from now */
+static
+void zq_tm_restamp(zqueue_t *q)
+{
+    struct zq_telemetry *tm = q->telemetry;
+    uint64_t now = zq_tm_now(), *p;
+    zq_span_t span[2];
+    zcount_t  i, k;
+
+    zqueue_peek_spans(tm->stamps, zqueue_get_count(tm->stamps), span);
+    for (k=0; k<2; ++k) {
+        for (i=0, p=span[k].base; i<span[k].count; ++i) {
+            p[i] = now;
+        }
+    }
+}
+
+int zqueue_stats_enable(zqueue_t *q, int b_enable)
+{
+    struct zq_telemetry *tm = q->telemetry;
+    zcount_t count = zqueue_get_count(q);
+
+    if (!b_enable) {
+        if (tm) {
+            zqueue_free(tm->stamps);
+            free(tm);
+            q->telemetry = 0;
+        }
+        return 0;
+    }
+    if (tm) {
+        return 1;
+    }
+
+    tm = calloc(1, sizeof(struct zq_telemetry));
+    if (tm) {
+        tm->stamps = ZQUEUE_MALLOC_D(uint64_t, MAX(count, 16));
+    }
+    if (!tm || !tm->stamps) {
+        xerr("<zqueue> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(tm);
+        return 0;
+    }
+#ifdef ZQ_TM_USE_TSC
+    tm->stats.b_tsc = 1;
+#endif
+    q->telemetry = tm;
+    zq_tm_pushed(q, 0, count);          /* waits of queued elems count from now */
+    tm->stats.pushes = 0;
+    return 1;
+}
+
+int zqueue_stats_snapshot(zqueue_t *q, zq_stats_t *snap)
+{
+    if (!q->telemetry) {
+        return 0;
+    }
+    *snap = q->telemetry->stats;
+    snap->count = zqueue_get_count(q);
+    return 1;
+}
+
+void zqueue_stats_reset(zqueue_t *q)
+{
+    struct zq_telemetry *tm = q->telemetry;
+    if (tm) {
+        int b_tsc = tm->stats.b_tsc;
+        memset(&tm->stats, 0, sizeof(tm->stats));
+        tm->stats.b_tsc = b_tsc;
+        tm->stats.high_water = zqueue_get_count(q);
+    }
+}
+#else
+int zqueue_stats_enable(zqueue_t *q, int b_enable)
+{
+    return 0;
+}
+
+int zqueue_stats_snapshot(zqueue_t *q, zq_stats_t *snap)
+{
+    return 0;
+}
+
+void zqueue_stats_reset(zqueue_t *q)
+{
+}
+#endif
+
+uint64_t zq_stats_percentile(const zq_stats_t *snap, double pct)
+{
+    uint64_t target = (uint64_t)(CLIP(pct, 0, 100) / 100.0 * snap->lat_count + 0.5);
+    uint64_t acc = 0;
+    uint32_t i;
+
+    if (snap->lat_count == 0) {
+        return 0;
+    }
+    target = CLIP(target, 1, snap->lat_count);
+    for (i=0; i<ZQ_HIST_BUCKETS; ++i) {
+        acc += snap->hist[i];
+        if (acc >= target) {
+            break;
+        }
+    }
+    if (i < ZQ_HIST_SUB_COUNT) {
+        return i;
+    } else {
+        uint32_t e   = i / ZQ_HIST_SUB_COUNT + ZQ_HIST_SUB_BITS - 1;
+        uint64_t sub = i % ZQ_HIST_SUB_COUNT;
+        uint64_t lo  = (ZQ_HIST_SUB_COUNT + sub) << (e - ZQ_HIST_SUB_BITS);
+        return MIN(lo + (1ull << (e - ZQ_HIST_SUB_BITS)) - 1, snap->lat_max);
+    }
+}
+
+void zq_stats_print(const zq_stats_t *snap, const char *q_name)
+{
+    const char *unit = snap->b_tsc ? "tick" : "ns";
+    xprint("<zqueue> %s: count=%d, high_water=%d, pushes=%llu, pops=%llu, rejects=%llu\n", 
+        q_name, snap->count, snap->high_water, 
+        (unsigned long long)snap->pushes, (unsigned long long)snap->pops, 
+        (unsigned long long)snap->rejects);
+    xprint("<zqueue> %s: wait(%s) mean=%.0f, p50=%llu, p90=%llu, p99=%llu, p99.9=%llu, max=%llu\n", 
+        q_name, unit, snap->lat_count ? (double)snap->lat_sum / snap->lat_count : 0.0,
+        (unsigned long long)zq_stats_percentile(snap, 50),
+        (unsigned long long)zq_stats_percentile(snap, 90),
+        (unsigned long long)zq_stats_percentile(snap, 99),
+        (unsigned long long)zq_stats_percentile(snap, 99.9),
+        (unsigned long long)snap->lat_max);
+}
+
 /* buffer attach would reset the entire context */
 zcount_t zqueue_buf_attach(zqueue_t *q, zaddr_t buf, uint32_t elem_size, uint32_t depth)
 {
     q->depth = depth;
+    q->start = 0;
     q->count = 0;
     q->elem_size = elem_size;
     q->elem_array = buf;
     q->b_allocated = 0;
     q->b_allow_realloc = 0;
+    q->b_mirrored = 0;
+    q->b_pow2 = 0;
+    q->elem_swap = 0;
+#ifdef ZQUEUE_TELEMETRY
+    q->telemetry = 0;
+#endif
 
     return depth;
 }
@@ -128,6 +407,15 @@ zaddr_t zqueue_buf_malloc(zqueue_t *q, uint32_t elem_size, uint32_t depth, int b
     return 0;
 }
 
+#define     ZQ_MOVE(q, dst_bidx, src_bidx, n) \
+        memmove(ZQUEUE_ELEM_BASE(q, dst_bidx), ZQUEUE_ELEM_BASE(q, src_bidx), \
+                (size_t)(n) * (q)->elem_size)
+
+/**
+ * Only the smaller of the two ring segments is moved, with at most two
+ * bulk memmove. Large blocks are mmap backed in glibc, where realloc()
+ * itself is a mremap() and doesn't copy the buf.
+ */
 zaddr_t zqueue_buf_realloc(zqueue_t *q, uint32_t depth, int b_allow_realloc)
 {
     zcount_t count = zqueue_get_count(q);
@@ -136,23 +424,40 @@ zaddr_t zqueue_buf_realloc(zqueue_t *q, uint32_t depth, int b_allow_realloc)
             xerr("data drop is not allowed in %s()!\n", __FUNCTION__);
             return 0;
         }
-        
-        zaddr_t buf = realloc(q->elem_array, q->elem_size * depth);
-        if (buf) {
-            zqueue_t _old_q = *q;
-            zqueue_t *old_q = &_old_q;
+        if (q->b_pow2) {
+            depth = zpow2_roundup(depth);
+        }
 
+        zcount_t old_depth = q->depth;
+        zcount_t head = MIN(count, old_depth - q->start);   /* [start, old_depth) */
+        zcount_t wrap = count - head;                       /* [0, wrap) */
+
+        if ((zcount_t)depth < old_depth && q->start + head > (zcount_t)depth) {
+            /* shrink: get the content inside [0, depth) before cutting */
+            zbidx_t new_start = wrap ? (zbidx_t)depth - head : 0;
+            ZQ_MOVE(q, new_start, q->start, head);
+            q->start = new_start;
             q->depth = depth;
-            q->count = (q->count <= depth) ? q->count : depth;
+        }
+        
+        zaddr_t buf = realloc(q->elem_array, (size_t)q->elem_size * depth);
+        if (buf) {
             q->elem_array = buf;
+            q->depth = depth;
             q->b_allow_realloc = b_allow_realloc;
 
-            /* move the wrapped area */
-            zqidx_t mv_idx = old_q->depth - old_q->start;
-            for ( ; mv_idx < old_q->count; ++ mv_idx) {
-                zaddr_t new_base = zqueue_get_elem(q, mv_idx);
-                zaddr_t old_base = zqueue_get_elem(old_q, mv_idx);
-                memcpy(new_base, old_base, sizeof(zqueue_t));
+            if (wrap > 0 && (zcount_t)depth > old_depth) {
+                zcount_t extra = depth - old_depth;
+                if (wrap <= head) {
+                    /* append the wrapped part to the old end */
+                    zcount_t n1 = MIN(wrap, extra);
+                    ZQ_MOVE(q, old_depth, 0, n1);
+                    ZQ_MOVE(q, 0, n1, wrap - n1);
+                } else {
+                    /* slide the head part to the new end */
+                    ZQ_MOVE(q, depth - head, q->start, head);
+                    q->start = depth - head;
+                }
             }
                 
             return buf;
@@ -165,6 +470,8 @@ zaddr_t zqueue_buf_realloc(zqueue_t *q, uint32_t depth, int b_allow_realloc)
 /**
  * Enlarge queue buffer.
  * In case of reallocation failure, the old buf is kept unchanged.
+ * The depth grows geometrically (x1.5 at least), so that a queue 
+ * growing by push costs amortized O(1) per elem.
  * 
  * @param additional_count  the count of elem to be allocated
  *                          in addition to zqueue_get_count()
@@ -176,7 +483,11 @@ zspace_t zqueue_buf_grow(zqueue_t *q, uint32_t additional_count)
         zcount_t old_depth = zqueue_get_depth(q);
         zcount_t new_depth = additional_count + zqueue_get_count(q);
         if (new_depth > old_depth) {
-            zaddr_t new_addr = zqueue_buf_realloc(q, new_depth, 1);
+            zcount_t geo_depth = MAX(new_depth, old_depth + old_depth / 2 + 4);
+            zaddr_t new_addr = zqueue_buf_realloc(q, geo_depth, 1);
+            if (!new_addr && geo_depth > new_depth) {
+                new_addr = zqueue_buf_realloc(q, new_depth, 1);
+            }
             if (!new_addr) {
                 xerr("%s() failed!\n", __FUNCTION__);
             }
@@ -187,11 +498,93 @@ zspace_t zqueue_buf_grow(zqueue_t *q, uint32_t additional_count)
 
 void zqueue_buf_free(zqueue_t *q)
 {
+#ifdef ZQUEUE_HAS_MIRROR
+    if (q->b_allocated && q->b_mirrored && q->elem_array) {
+        munmap(q->elem_array, 2 * (size_t)q->elem_size * q->depth);
+        q->elem_array = 0;
+        q->b_mirrored = 0;
+        return;
+    }
+#endif
     if (q->b_allocated && q->elem_array) {
         SIM_FREEP(q->elem_array);
     }
 }
 
+#ifdef ZQUEUE_HAS_MIRROR
+static
+zaddr_t zq_mirror_map(size_t size)
+{
+    char *base = MAP_FAILED;
+    int   fd = (int)syscall(SYS_memfd_create, "zqueue", 0);
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    if (ftruncate(fd, size) == 0) {
+        /* reserve 2x address space, then overlay both halves with the fd */
+        base = mmap(0, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            if (mmap(base, size, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                mmap(base + size, size, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(base, 2 * size);
+                base = MAP_FAILED;
+            }
+        }
+    }
+
+    close(fd);
+    return base != MAP_FAILED ? base : 0;
+}
+#endif
+
+zaddr_t zqueue_buf_malloc_pow2(zqueue_t *q, uint32_t elem_size, uint32_t depth, int b_allow_realloc)
+{
+    zaddr_t buf = zqueue_buf_malloc(q, elem_size, zpow2_roundup(depth), b_allow_realloc);
+    if (buf) {
+        q->b_pow2 = 1;
+    }
+    return buf;
+}
+
+int zqueue_is_pow2(zqueue_t *q)
+{
+    return q->b_pow2;
+}
+
+zaddr_t zqueue_buf_malloc_mirror(zqueue_t *q, uint32_t elem_size, uint32_t depth)
+{
+#ifdef ZQUEUE_HAS_MIRROR
+    long page = sysconf(_SC_PAGESIZE);
+    if (page > 0 && elem_size > 0 && depth > 0) {
+        /* smallest depth step that keeps depth * elem_size page aligned */
+        uint64_t a = page, b = elem_size, step;
+        while (b) { uint64_t t = a % b; a = b; b = t; }
+        step = page / a;
+        depth = (uint32_t)((depth + step - 1) / step * step);
+
+        zaddr_t buf = zq_mirror_map((size_t)elem_size * depth);
+        if (buf) {
+            zqueue_buf_attach(q, buf, elem_size, depth);
+            q->b_allocated = 1;
+            q->b_mirrored = 1;
+            q->b_pow2 = ZIS_POW2(depth);
+            return buf;
+        }
+    }
+    xwarn("<zqueue> mirror mapping failed, fall back to malloc\n");
+#endif
+    return zqueue_buf_malloc(q, elem_size, depth, 0);
+}
+
+int zqueue_is_mirrored(zqueue_t *q)
+{
+    return q->b_mirrored;
+}
+
 zqueue_t *zqueue_malloc(uint32_t elem_size, uint32_t depth, int b_allow_realloc)
 {
     zaddr_t q = malloc( sizeof(zqueue_t) );
@@ -216,6 +609,34 @@ zqueue_t* zqueue_malloc_d(uint32_t elem_size, uint32_t depth)
     return zqueue_malloc(elem_size, depth, 1);
 }
 
+zqueue_t* zqueue_malloc_pow2(uint32_t elem_size, uint32_t depth, int b_allow_realloc)
+{
+    zaddr_t q = malloc( sizeof(zqueue_t) );
+    if (!q) {
+        xerr("%s() failed!\n", __FUNCTION__);
+    } else {
+        zaddr_t base = zqueue_buf_malloc_pow2(q, elem_size, depth, b_allow_realloc);
+        if (!base) {
+            SIM_FREEP(q);
+        }
+    }
+    return q;
+}
+
+zqueue_t* zqueue_malloc_mirror(uint32_t elem_size, uint32_t depth)
+{
+    zaddr_t q = malloc( sizeof(zqueue_t) );
+    if (!q) {
+        xerr("%s() failed!\n", __FUNCTION__);
+    } else {
+        zaddr_t base = zqueue_buf_malloc_mirror(q, elem_size, depth);
+        if (!base) {
+            SIM_FREEP(q);
+        }
+    }
+    return q;
+}
+
 void zqueue_memzero(zqueue_t *q) 
 {
     if (q && q->elem_array) {
@@ -227,12 +648,14 @@ void zqueue_clear(zqueue_t *q)
 {
     if (q) {
         q->count = 0;
+        ZQ_TM_HOOK(q, zqueue_clear(q->telemetry->stamps));
     }
 }
 
 void zqueue_free(zqueue_t *q)
 {
     if (q) {
+        zqueue_stats_enable(q, 0);
         if (q->b_allocated) { 
             zqueue_buf_free(q);
         } else {
@@ -372,8 +795,9 @@ zcount_t zqueue_pop_front(zqueue_t *q, zaddr_t dst_base)
     zaddr_t base = zqueue_qidx_2_base_in_use(q, 0);
     if (base) {
         zq_op_pop_front_upd(q);
+        ZQ_TM_HOOK(q, zq_tm_popped(q, 0, 1));
         if (dst_base) {
-            memcpy(dst_base, base, sizeof(q->elem_size);
+            memcpy(dst_base, base, q->elem_size);
         }
         return 1;
     }
@@ -385,8 +809,9 @@ zcount_t zqueue_pop_back(zqueue_t *q, zaddr_t dst_base)
     zaddr_t base = zqueue_qidx_2_base_in_use(q, q->count - 1);
     if (base) {
         q->count -= 1;
+        ZQ_TM_HOOK(q, zq_tm_popped(q, q->count, 1));
         if (dst_base) {
-            memcpy(dst_base, base, sizeof(q->elem_size);
+            memcpy(dst_base, base, q->elem_size);
         }
         return 1;
     }
@@ -398,12 +823,14 @@ zaddr_t zqueue_push_front(zqueue_t *q, zaddr_t elem_base)
     zspace_t space = zqueue_buf_grow(q, 1);
     if (space > 0) {
         zq_op_push_front_upd(q);
+        ZQ_TM_HOOK(q, zq_tm_pushed(q, 0, 1));
         zaddr_t base = zqueue_get_front(q);
         if (elem_base) {
-            memcpy(base, elem_base, sizeof(q->elem_size));
+            memcpy(base, elem_base, q->elem_size);
         }
         return base;
     }
+    ZQ_TM_HOOK(q, q->telemetry->stats.rejects += 1);
     return 0;
 }
 
@@ -412,12 +839,14 @@ zaddr_t zqueue_push_back(zqueue_t *q, zaddr_t elem_base)
     zspace_t space = zqueue_buf_grow(q, 1);
     if (space > 0) {
         q->count += 1;
+        ZQ_TM_HOOK(q, zq_tm_pushed(q, q->count - 1, 1));
         zaddr_t base = zqueue_get_back(q);
         if (elem_base) {
-            memcpy(base, elem_base, sizeof(q->elem_size));
+            memcpy(base, elem_base, q->elem_size);
         }
         return base;
     }
+    ZQ_TM_HOOK(q, q->telemetry->stats.rejects += 1);
     return 0;
 }
 
@@ -426,15 +855,17 @@ zcount_t zqueue_push_back_some_of_others(zqueue_t *dst, zqueue_t *src,
 {
     zcount_t src_count = zqueue_get_count(src);
     
-    if (0<=src_start && src_start < src_count) {
+    if (0<=src_start && 0<=merge_count && src_start + merge_count <= src_count) {
         zspace_t dst_space = zqueue_buf_grow(dst, merge_count);
-        zqidx_t  src_end = src_start + merge_count;
         if (dst_space>=merge_count) {
-            for ( ; src_start < src_end; ++src_start) {
-                zqueue_push_back(dst, zqueue_get_elem_base(src, src_start));
-            }
+            zq_span_t span[2];
+            zq_op_get_spans(src, src_start, merge_count, span);
+            zqueue_push_back_multi(dst, span[0].base, span[0].count);
+            zqueue_push_back_multi(dst, span[1].base, span[1].count);
+            return merge_count;
         }
     }
+    return 0;
 }
 
 zcount_t zqueue_push_back_all_of_others(zqueue_t *dst, zqueue_t *src)
@@ -442,27 +873,153 @@ zcount_t zqueue_push_back_all_of_others(zqueue_t *dst, zqueue_t *src)
     return zqueue_push_back_some_of_others(dst, src, 0, zqueue_get_count(src));
 }
 
+zcount_t zqueue_peek_spans(zqueue_t *q, zcount_t max_count, zq_span_t span[2])
+{
+    zcount_t count = CLIP(max_count, 0, zqueue_get_count(q));
+    return zq_op_get_spans(q, 0, count, span);
+}
+
+zcount_t zqueue_reserve_spans(zqueue_t *q, zcount_t want_count, zq_span_t span[2])
+{
+    zspace_t space = zqueue_buf_grow(q, MAX(want_count, 0));
+    zcount_t count = CLIP(want_count, 0, space);
+    return zq_op_get_spans(q, q->count, count, span);
+}
+
+zcount_t zqueue_commit(zqueue_t *q, zcount_t count)
+{
+    count = CLIP(count, 0, zqueue_get_space(q));
+    q->count += count;
+    ZQ_TM_HOOK(q, zq_tm_pushed(q, q->count - count, count));
+    return count;
+}
+
+zcount_t zqueue_consume(zqueue_t *q, zcount_t count)
+{
+    count = CLIP(count, 0, zqueue_get_count(q));
+    if (count > 0) {
+        q->count -= count;
+        q->start  = zq_op_qidx_2_bidx(q, count);
+        ZQ_TM_HOOK(q, zq_tm_popped(q, 0, count));
+    }
+    return count;
+}
+
+zcount_t zqueue_push_back_multi(zqueue_t *q, const void *elems, zcount_t count)
+{
+    zq_span_t span[2];
+    zcount_t  n = zqueue_reserve_spans(q, count, span);
+    if (n < count) {
+        ZQ_TM_HOOK(q, q->telemetry->stats.rejects += count - n);
+    }
+    if (n > 0) {
+        memcpy(span[0].base, elems, span[0].count * q->elem_size);
+        if (span[1].count) {
+            memcpy(span[1].base, (const char *)elems + span[0].count * q->elem_size,
+                   span[1].count * q->elem_size);
+        }
+    }
+    return zqueue_commit(q, n);
+}
+
+zcount_t zqueue_pop_front_multi(zqueue_t *q, void *elems, zcount_t count)
+{
+    zq_span_t span[2];
+    zcount_t  n = zqueue_peek_spans(q, count, span);
+    if (n > 0 && elems) {
+        memcpy(elems, span[0].base, span[0].count * q->elem_size);
+        if (span[1].count) {
+            memcpy((char *)elems + span[0].count * q->elem_size, span[1].base,
+                   span[1].count * q->elem_size);
+        }
+    }
+    return zqueue_consume(q, n);
+}
+
+/** reverse elems in buf [from, to) */
+static
+void zq_op_reverse(zqueue_t *q, zbidx_t from, zbidx_t to)
+{
+    for (-- to; from < to; ++ from, -- to) {
+        zmem_swap(ZQUEUE_ELEM_BASE(q, from), ZQUEUE_ELEM_BASE(q, to), q->elem_size, 1);
+    }
+}
+
+/**
+ * The wrapped ring is  B | free | A  in buf, with A = q[0 ... n1-1]
+ * at [start, depth) and B = q[n1 ... count-1] at [0, n2).
+ */
+zaddr_t zqueue_linearize(zqueue_t *q)
+{
+    zcount_t count = zqueue_get_count(q);
+    zcount_t n1 = q->depth - q->start;
+    zcount_t n2 = count - n1;
+    size_t   es = q->elem_size;
+    char    *buf = q->elem_array;
+    long long stack_tmp[512];
+    char    *tmp;
+
+    if (!buf || q->start == 0) {
+        return buf;
+    }
+    if (q->b_mirrored) {
+        /* already contiguous, can't memmove across the aliased pages */
+        return zq_op_qidx_2_base(q, 0);
+    }
+
+    if (n2 <= 0) {
+        memmove(buf, buf + q->start * es, count * es);
+    } else if (n1 <= q->start - n2) {
+        /* A fits in the free room: slide B up, then A down */
+        memmove(buf + n1 * es, buf, n2 * es);
+        memcpy(buf, buf + q->start * es, n1 * es);
+    } else {
+        size_t small = (size_t)MIN(n1, n2) * es;
+        tmp = small <= sizeof(stack_tmp) ? (char *)stack_tmp : malloc(small);
+        if (!tmp) {
+            /* in-place rotate left by start, A | B | free */
+            zq_op_reverse(q, 0, q->start);
+            zq_op_reverse(q, q->start, q->depth);
+            zq_op_reverse(q, 0, q->depth);
+        } else if (n2 <= n1) {
+            memcpy(tmp, buf, n2 * es);
+            memmove(buf, buf + q->start * es, n1 * es);
+            memcpy(buf + n1 * es, tmp, n2 * es);
+        } else {
+            memcpy(tmp, buf + q->start * es, n1 * es);
+            memmove(buf + n1 * es, buf, n2 * es);
+            memcpy(buf, tmp, n1 * es);
+        }
+        if (tmp && tmp != (char *)stack_tmp) {
+            free(tmp);
+        }
+    }
+    q->start = 0;
+    return buf;
+}
+
 zcount_t zqueue_pop_elem(zqueue_t *q, zqidx_t qidx, zaddr_t dst_base)
 {
     zaddr_t src_base = zqueue_get_elem_base(q, qidx);
     if (src_base) {
+        ZQ_TM_HOOK(q, zq_tm_popped(q, qidx, 1));
         if (dst_base) {
-            memcpy(dst_base, src_base, sizeof(q->elem_size);
+            memcpy(dst_base, src_base, q->elem_size);
         }
         if (qidx > q->count / 2) {
             for ( ; qidx < q->count - 1; ++ qidx) {
                 zaddr_t base0 = zqueue_get_elem_base(q, qidx);
                 zaddr_t base1 = zqueue_get_elem_base(q, qidx + 1);
-                memcpy(base0, base1, sizeof(q->elem_size);
+                memcpy(base0, base1, q->elem_size);
             }
             -- q->count;
         } else {
             for ( ; qidx > 0; -- qidx) {
                 zaddr_t base0 = zqueue_get_elem_base(q, qidx);
                 zaddr_t base1 = zqueue_get_elem_base(q, qidx - 1);
-                memcpy(base0, base1, sizeof(q->elem_size);
-                zq_op_pop_front_upd(q);
+                memcpy(base0, base1, q->elem_size);
             }
+            zq_op_pop_front_upd(q);
         }
         
         return 1;
@@ -484,25 +1041,29 @@ zaddr_t zqueue_insert_elem(zqueue_t *q, zqidx_t qidx, zaddr_t src_base)
             for (i=q->count-1; i>qidx; --i) {
                 zaddr_t base0 = zqueue_get_elem_base(q, i);
                 zaddr_t base1 = zqueue_get_elem_base(q, i-1);
-                memcpy(base0, base1, sizeof(q->elem_size);
+                memcpy(base0, base1, q->elem_size);
             }
             
         } else {
-            zq_op_push_front_upd(q)
-            for (i=0; i<=qidx; ++i) {
+            zq_op_push_front_upd(q);
+            for (i=0; i<qidx; ++i) {
                 zaddr_t base0 = zqueue_get_elem_base(q, i);
                 zaddr_t base1 = zqueue_get_elem_base(q, i + 1);
-                memcpy(base0, base1, sizeof(q->elem_size);
+                memcpy(base0, base1, q->elem_size);
             }
         }
         
-        zaddr_t dst_base  = zqueue_qidx_2_base_in_buf(q, qidx+1);
+        ZQ_TM_HOOK(q, zq_tm_pushed(q, qidx, 1));
+        zaddr_t dst_base  = zqueue_get_elem_base(q, qidx);
         if (src_base) {
-            memcpy(dst_base, src_base, sizeof(q->elem_size);
+            memcpy(dst_base, src_base, q->elem_size);
         }
         return dst_base;
     }
 
+    if (space < 1) {
+        ZQ_TM_HOOK(q, q->telemetry->stats.rejects += 1);
+    }
     return 0;
 }
 
@@ -528,26 +1089,6 @@ zaddr_t zqueue_set_elem_val_itnl(zqueue_t *q, zqidx_t dst_idx, zqidx_t src_idx)
     return 0;
 }
 
-static 
-zaddr_t zqueue_elem_2_swap(zqueue_t *q, zqidx_t qidx)
-{
-    zaddr_t base = zqueue_get_elem_base(q, qidx);
-    if (q->elem_swap && base) {
-        memcpy(q->elem_swap, base, q->elem_size);
-    }
-    return base;
-}
-
-static 
-zaddr_t zqueue_swap_2_elem(zqueue_t *q, zqidx_t qidx)
-{
-    zaddr_t base = zqueue_get_elem_base(q, qidx);
-    if (q->elem_swap && base) {
-        memcpy(base, q->elem_swap, q->elem_size);
-    }
-    return base;
-}
-
 static
 int32_t zqueue_safe_cmp(zq_cmp_func_t func, zaddr_t base1, zaddr_t base2)
 {
@@ -564,15 +1105,17 @@ int32_t zqueue_safe_cmp(zq_cmp_func_t func, zaddr_t base1, zaddr_t base2)
 
 zqidx_t zqueue_find_first_match_qidx(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func)
 {
-    zqidx_t qidx;
-    zcount_t count = zqueue_get_count(q);
-
-    for (qidx = 0; qidx < count; ++ qidx)
-    {
-        zaddr_t base = zqueue_get_elem_base(q, qidx);
-        if ( 0 == zqueue_safe_cmp(func, base, elem_base) )
-        {
-            return qidx;
+    zq_span_t span[2];
+    zarray_t  za;
+    zqidx_t   qidx;
+    int k;
+
+    zqueue_peek_spans(q, zqueue_get_count(q), span);
+    for (k=0; k<2; ++k) {
+        zq_op_array_view(q, &za, span[k].base, span[k].count);
+        qidx = zarray_find_first_match_qidx(&za, elem_base, func);
+        if (qidx >= 0) {
+            return k ? span[0].count + qidx : qidx;
         }
     }
 
@@ -582,7 +1125,7 @@ zqidx_t zqueue_find_first_match_qidx(zqueue_t *q, zaddr_t elem_base, zq_cmp_func
 zaddr_t zqueue_find_first_match(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func)
 {
     zqidx_t qidx = zqueue_find_first_match_qidx(q, elem_base, func);
-    if(qidx > 0) {
+    if(qidx >= 0) {
         return zqueue_get_elem_base(q, qidx);
     }
 
@@ -591,8 +1134,8 @@ zaddr_t zqueue_find_first_match(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t fu
 
 zcount_t zqueue_pop_first_match(zqueue_t *q, zaddr_t cmp_base, zq_cmp_func_t func, zaddr_t dst_base)
 {
-    zqidx_t qidx = zqueue_find_first_match_qidx(q, elem_base, func);
-    if(qidx > 0) {
+    zqidx_t qidx = zqueue_find_first_match_qidx(q, cmp_base, func);
+    if(qidx >= 0) {
         return zqueue_pop_elem(q, qidx, dst_base);
     }
 
@@ -614,115 +1157,56 @@ int zqueue_elem_cmp_itnl(zqueue_t *q, zq_cmp_func_t func, zqidx_t qidx_1, zqidx_
     return zqueue_safe_cmp(func, base1, base2);
 }
 
-static
-void zqueue_quick_sort_iter(zqueue_t *q, zq_cmp_func_t func, zqidx_t start, zqidx_t end)
+/**
+ * Sort & search on the contiguous buf with the zarray engines: sort
+ * linearizes the ring first, search works on the (at most 2) spans.
+ */
+void zqueue_quick_sort(zqueue_t *q, zq_cmp_func_t func)
 {
-    zqidx_t left = start;
-    zqidx_t right = end;
-
-    if (start>=end) {
-        return;
-    }
-
-    zqueue_elem_2_swap(q, right);
-
-    while (left!=right)
-    {
-        while(left<right && zqueue_elem_cmp(q, func, left, q->elem_swap) <= 0) {
-            ++ left;
-        }
-        zqueue_set_elem_val_itnl(q, right, left);   // first bigger to right
-
-        while(left<right && zqueue_elem_cmp(q, func, right, q->elem_swap) >= 0) {
-            -- right;
-        }
-        zqueue_set_elem_val_itnl(q, left, right);   // first smaller to left
-    }
-
-    zqueue_swap_2_elem(q, right);
+    zarray_t za;
+    zq_op_array_view(q, &za, zqueue_linearize(q), zqueue_get_count(q));
+    zarray_quick_sort(&za, func);
+    ZQ_TM_HOOK(q, zq_tm_restamp(q));
+}
 
-    zqueue_quick_sort_iter(q, func, start, left-1);    // smaller part
-    zqueue_quick_sort_iter(q, func, left+1, end);      // bigger part
+void zqueue_quick_sort_i32(zqueue_t *q)
+{
+    zarray_t za;
+    zq_op_array_view(q, &za, zqueue_linearize(q), zqueue_get_count(q));
+    zarray_quick_sort_i32(&za);
+    ZQ_TM_HOOK(q, zq_tm_restamp(q));
 }
 
-void zqueue_quick_sort(zqueue_t *q, zq_cmp_func_t func)
+void zqueue_quick_sort_u32(zqueue_t *q)
 {
-    zcount_t count = zqueue_get_count(q);
-    if (count > 2) {
-        long long static_swap[8];
-        if (q->elem_size > sizeof(static_swap)) {
-            q->elem_swap = malloc(q->elem_size);
-        } else {
-            q->elem_swap = static_swap;
-        }
-        
-        if (q->elem_swap) {
-            zqueue_quick_sort_iter(q, func, 0, count-1);
-            if (q->elem_size > sizeof(static_swap)) {
-                SIM_FREEP(q->elem_swap);
-            }
-        } else {
-            xerr("%s() failed!\n", __FUNCTION__);
-        }
-    }
-}
-
-#define ZQUEUE_QUICK_SORT_ITER(type_t, q, start, end)  \
-        zqueue_quick_sort_iter_##type_t(q, start, end)
-
-#define ZQUEUE_QUICK_SORT_ITER_DEFINE(type_t)           \
-static void zqueue_quick_sort_iter_##type_t             \
-(                                                       \
-    type_t *q,                                          \
-    zqidx_t start,                                     \
-    zqidx_t end                                        \
-)                                                       \
-{                                                       \
-    zqidx_t left = start;                              \
-    zqidx_t right = end;                               \
-    type_t   threshold;                                 \
-                                                        \
-    if (start>=end) {                                   \
-        return;                                         \
-    }                                                   \
-                                                        \
-    threshold = q[right];                               \
-                                                        \
-    while (left!=right)                                 \
-    {                                                   \
-        while(left<right && q[left] <= threshold) {     \
-            ++ left;                                    \
-        }                                               \
-        q[right] = q[left];                             \
-                                                        \
-        while(left<right && q[right] >= threshold) {    \
-            -- right;                                   \
-        }                                               \
-        q[left] = q[right];                             \
-    }                                                   \
-                                                        \
-    q[right] = threshold;                               \
-                                                        \
-    zqueue_quick_sort_iter_##type_t(q, start, left-1);  \
-    zqueue_quick_sort_iter_##type_t(q, left+1, end);    \
-}
-
-ZQUEUE_QUICK_SORT_ITER_DEFINE(int32_t)
-void zqueue_quick_sort_i32(zqueue_t *q)
+    zarray_t za;
+    zq_op_array_view(q, &za, zqueue_linearize(q), zqueue_get_count(q));
+    zarray_quick_sort_u32(&za);
+    ZQ_TM_HOOK(q, zq_tm_restamp(q));
+}
+
+zqidx_t zqueue_lower_bound(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func)
 {
-    zcount_t count = zqueue_get_count(q);
-    if (count > 2) {
-        ZQUEUE_QUICK_SORT_ITER(int32_t, q->elem_array, 0, count-1);
+    zq_span_t span[2];
+    zarray_t  za;
+
+    zqueue_peek_spans(q, zqueue_get_count(q), span);
+    if (span[1].count && func(span[1].base, elem_base) < 0) {
+        zq_op_array_view(q, &za, span[1].base, span[1].count);
+        return span[0].count + zarray_lower_bound(&za, elem_base, func);
     }
+    zq_op_array_view(q, &za, span[0].base, span[0].count);
+    return zarray_lower_bound(&za, elem_base, func);
 }
 
-ZQUEUE_QUICK_SORT_ITER_DEFINE(uint32_t)
-void zqueue_quick_sort_u32(zqueue_t *q)
+zqidx_t zqueue_bsearch_qidx(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func)
 {
-    zcount_t count = zqueue_get_count(q);
-    if (count > 2) {
-        ZQUEUE_QUICK_SORT_ITER(uint32_t, q->elem_array, 0, count-1);
+    zqidx_t qidx = zqueue_lower_bound(q, elem_base, func);
+    if (qidx < zqueue_get_count(q) && 
+        0 == func(zq_op_qidx_2_base(q, qidx), elem_base)) {
+        return qidx;
     }
+    return -1;
 }
 
 
@@ -34,9 +34,14 @@ typedef struct z_queue
     zaddr_t   elem_array;
     int       b_allocated;
     int       b_allow_realloc;        
+    int       b_mirrored;             //<! see zqueue_buf_malloc_mirror()
+    int       b_pow2;                 //<! see zqueue_buf_malloc_pow2()
 
 //private:
     zaddr_t   elem_swap;
+#ifdef ZQUEUE_TELEMETRY
+    struct zq_telemetry *telemetry;   //<! see zqueue_stats_enable()
+#endif
 }zqueue_t;
 
 zcount_t    zqueue_buf_attach(zqueue_t *q, zaddr_t buf, uint32_t elem_size, uint32_t depth);
@@ -47,7 +52,27 @@ zaddr_t     zqueue_buf_realloc(zqueue_t *q, uint32_t depth, int b_allow_realloc)
 void        zqueue_buf_free(zqueue_t *q);
 
 /**
- * Enlarge queue buffer.
+ * Keep depth a power of 2 (rounded up here and on every realloc/grow),
+ * so that qidx <-> bidx wrap is a mask instead of compare & subtract.
+ */
+zaddr_t     zqueue_buf_malloc_pow2(zqueue_t *q, uint32_t elem_size, uint32_t depth, int b_allow_realloc);
+int         zqueue_is_pow2(zqueue_t *q);
+
+/**
+ * Map the same pages twice back to back ("magic ring"), so that
+ * elem_array[depth + i] aliases elem_array[i]. Any span returned by
+ * zqueue_peek_spans()/zqueue_reserve_spans() is then a single segment,
+ * and queued elems can be parsed as one linear buffer.
+ * 
+ * @param depth  rounded up so that depth * elem_size is page aligned
+ * @note  the buf can't be reallocated. If double mapping is not
+ *        supported or fails, it falls back to zqueue_buf_malloc().
+ */
+zaddr_t     zqueue_buf_malloc_mirror(zqueue_t *q, uint32_t elem_size, uint32_t depth);
+int         zqueue_is_mirrored(zqueue_t *q);
+
+/**
+ * Enlarge queue buffer, geometrically.
  * In case of reallocation failure, the old buf is kept unchanged.
  * 
  * @param additional_count  the count of elem to be allocated
@@ -60,6 +85,9 @@ zspace_t    zqueue_buf_grow(zqueue_t *q, uint32_t additional_count);
 zqueue_t*   zqueue_malloc(uint32_t elem_size, uint32_t depth, int b_allow_realloc);
 zqueue_t*   zqueue_malloc_s(uint32_t elem_size, uint32_t depth);
 zqueue_t*   zqueue_malloc_d(uint32_t elem_size, uint32_t depth);
+zqueue_t*   zqueue_malloc_pow2(uint32_t elem_size, uint32_t depth, int b_allow_realloc);
+zqueue_t*   zqueue_malloc_mirror(uint32_t elem_size, uint32_t depth);
+#define     ZQUEUE_MALLOC_P(type_t, depth)    zqueue_malloc_pow2(sizeof(type_t), (depth), 1)
 #define     ZQUEUE_MALLOC_S(type_t, depth)    zqueue_malloc_s(sizeof(type_t), (depth))
 #define     ZQUEUE_MALLOC_D(type_t, depth)    zqueue_malloc_d(sizeof(type_t), (depth))
 void        zqueue_free(zqueue_t *q);
@@ -74,6 +102,10 @@ zspace_t    zqueue_get_space(zqueue_t *q);
 
 #define     ZQUEUE_ELEM_BASE(q, bidx) \
         ((zaddr_t)(((char *)q->elem_array) + (bidx) * q->elem_size))
+
+/** unchecked q[qidx] for pow2 queue, 0 <= qidx < depth */
+#define     ZQUEUE_POW2_ELEM(q, qidx) \
+        ZQUEUE_ELEM_BASE(q, ((q)->start + (qidx)) & ((q)->depth - 1))
 zaddr_t     zqueue_qidx_2_base_in_buf(zqueue_t *q, zqidx_t qidx);
 zaddr_t     zqueue_qidx_2_base_in_use(zqueue_t *q, zqidx_t qidx);
 int         zqueue_is_qidx_in_buf(zqueue_t *q, zqidx_t qidx);
@@ -146,6 +178,40 @@ zcount_t    zqueue_push_back_all_of_others(
 #define     zqueue_cat(dst, src)  zqueue_push_back_all_of_others((dst), (src))
 
 
+/**
+ * zero-copy batch access.
+ * The ring region is exposed as at most 2 contiguous segments, the 2nd
+ * one (if any) starts at elem_array[0]. Unused span[] entries are zeroed.
+ */
+typedef struct zqueue_span {
+    zaddr_t     base;
+    zcount_t    count;
+}zq_span_t;
+
+/**
+ * Readable elems q[0 ... n-1], n = MIN(@max_count, count).
+ * Call zqueue_consume() after reading to pop them.
+ * @return n
+ */
+zcount_t    zqueue_peek_spans(zqueue_t *q, zcount_t max_count, zq_span_t span[2]);
+
+/**
+ * Writable slots q[count ... count+n-1] right after the back.
+ * The buf is grown first if allowed and @want_count exceeds the space.
+ * Call zqueue_commit() after writing to push them back.
+ * @return n = MIN(@want_count, space)
+ */
+zcount_t    zqueue_reserve_spans(zqueue_t *q, zcount_t want_count, zq_span_t span[2]);
+
+/** @return the count actually committed/consumed */
+zcount_t    zqueue_commit(zqueue_t *q, zcount_t count);
+zcount_t    zqueue_consume(zqueue_t *q, zcount_t count);
+
+/** copy @count elems packed in @elems in/out with at most 2 memcpy */
+zcount_t    zqueue_push_back_multi(zqueue_t *q, const void *elems, zcount_t count);
+zcount_t    zqueue_pop_front_multi(zqueue_t *q, void *elems, zcount_t count);
+
+
 typedef int32_t (*zq_cmp_func_t)  (zaddr_t base1, zaddr_t base2);
 zqidx_t     zqueue_find_first_match_qidx(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func);
 zaddr_t     zqueue_find_first_match(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func);
@@ -155,10 +221,31 @@ zcount_t    zqueue_pop_first_match(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t
 int         zqueue_elem_cmp(zqueue_t *q, zq_cmp_func_t func, zqidx_t qidx, zaddr_t elem_base);       //<! q[qidx] - elem_base
 int         zqueue_elem_cmp_itnl(zqueue_t *q, zq_cmp_func_t func, zqidx_t qidx_1, zqidx_t qidx_2);    //<! q[qidx_1] - q[qidx_2]   
 
+/**
+ * Rotate the ring so that start == 0 and q[0 ... count-1] is one linear
+ * buf, with at most 3 bulk memmove. A mirrored queue is contiguous
+ * already and is left as it is.
+ * @return the base of q[0]
+ */
+zaddr_t     zqueue_linearize(zqueue_t *q);
+
+/**
+ * linearize, then sort with the zarray engines. With telemetry on, the
+ * push stamps can't follow the elems, so all queued elems are restamped
+ * as of the sort: their waits count from it, as on zqueue_stats_enable().
+ */
 void        zqueue_quick_sort(zqueue_t *q, zq_cmp_func_t func);
 void        zqueue_quick_sort_i32(zqueue_t *q);
 void        zqueue_quick_sort_u32(zqueue_t *q);
 
+/**
+ * Binary search on a sorted queue, in place (no linearize).
+ * lower_bound @return the first qidx with q[qidx] >= @elem_base, or count
+ * bsearch_qidx @return the qidx of a match or -1
+ */
+zqidx_t     zqueue_lower_bound(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func);
+zqidx_t     zqueue_bsearch_qidx(zqueue_t *q, zaddr_t elem_base, zq_cmp_func_t func);
+
 
 typedef void  (*zq_print_func_t)  (zqidx_t idx, zaddr_t elem_base);
 void        zqueue_print(zqueue_t *q, const char *q_name, zq_print_func_t func,
@@ -177,6 +264,51 @@ zaddr_t     zqueue_back(zq_iter_t *iter);
 zaddr_t     zqueue_prev(zq_iter_t *iter);
 
 
+/**
+ * Occupancy telemetry, built only with -DZQUEUE_TELEMETRY (make
+ * ZQUEUE_TELEMETRY=1), otherwise the hooks compile to nothing and
+ * zqueue_stats_enable() returns 0. All sources must agree on the flag,
+ * since it changes the zqueue_t layout.
+ *
+ *  -Counters of elems pushed, popped and rejected (push on a full queue
+ *   that can't grow), and the high-water count.
+ *  -Each elem is stamped at push (clock_gettime ns, or rdtsc ticks with
+ *   -DZQUEUE_TELEMETRY_TSC on x86) in a parallel zqueue of stamps, and
+ *   its wait is added to the latency histogram when popped.
+ *  -The histogram is log-bucketed HDR style: 2^ZQ_HIST_SUB_BITS linear
+ *   sub-buckets per power of 2, so any value is within 1/8 of its bucket.
+ */
+#define     ZQ_HIST_SUB_BITS    (3)
+#define     ZQ_HIST_SUB_COUNT   (1 << ZQ_HIST_SUB_BITS)
+#define     ZQ_HIST_BUCKETS     ((64 - ZQ_HIST_SUB_BITS + 1) * ZQ_HIST_SUB_COUNT)
+
+typedef struct zqueue_stats {
+    uint64_t    pushes;
+    uint64_t    pops;
+    uint64_t    rejects;
+    zcount_t    count;                  //<! at snapshot
+    zcount_t    high_water;
+    int         b_tsc;                  //<! latency unit is tsc tick, else ns
+    uint64_t    lat_count;
+    uint64_t    lat_sum;
+    uint64_t    lat_max;
+    uint64_t    hist[ZQ_HIST_BUCKETS];
+}zq_stats_t;
+
+/**
+ * Start (stamping the elems already queued as of now) or stop telemetry.
+ * Call with 0 before zqueue_buf_attach() on a queue you keep.
+ * @return 1 if enabled
+ */
+int         zqueue_stats_enable(zqueue_t *q, int b_enable);
+int         zqueue_stats_snapshot(zqueue_t *q, zq_stats_t *snap);    //<! @return 0 if off
+void        zqueue_stats_reset(zqueue_t *q);    //<! counters & histogram, not the stamps
+
+/** @return the upper bound of the bucket holding the @pct percentile (0~100) */
+uint64_t    zq_stats_percentile(const zq_stats_t *snap, double pct);
+void        zq_stats_print(const zq_stats_t *snap, const char *q_name);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
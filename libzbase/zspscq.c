@@ -0,0 +1,187 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zspscq.h"
+#include "sim_log.h"
+
+
+zspscq_t* zspscq_malloc(uint32_t elem_size, uint32_t depth)
+{
+    zspscq_t *sq = 0;
+    uint32_t pow2 = zpow2_roundup(depth);
+
+    if (!pow2 || pow2 > (1u<<30)) {
+        xerr("<zspscq> invalid depth %u\n", depth);
+        return 0;
+    }
+
+    sq = aligned_alloc(ZCACHE_LINE_SIZE, sizeof(zspscq_t));
+    if (!sq) {
+        xerr("<zspscq> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    memset(sq, 0, sizeof(zspscq_t));
+
+    if (!zqueue_buf_malloc(&sq->q, elem_size, pow2, 0)) {
+        free(sq);
+        return 0;
+    }
+
+    sq->mask = pow2 - 1;
+    atomic_init(&sq->head, 0);
+    atomic_init(&sq->tail, 0);
+    sq->tail_cache = 0;
+    sq->head_cache = 0;
+
+    return sq;
+}
+
+void zspscq_free(zspscq_t *sq)
+{
+    if (sq) {
+        zqueue_buf_free(&sq->q);
+        free(sq);
+    }
+}
+
+zcount_t zspscq_get_depth(zspscq_t *sq)
+{
+    return sq->q.depth;
+}
+
+zcount_t zspscq_get_count(zspscq_t *sq)
+{
+    /* head first: the tail read after is never behind it, but may be a
+       depth ahead of it if pops and pushes land between the loads */
+    uint64_t head = atomic_load_explicit(&sq->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&sq->tail, memory_order_acquire);
+    return (zcount_t)MIN(tail - head, (uint64_t)sq->q.depth);
+}
+
+/* copy @count elems between ring[pos...] and @elems, split at the wrap */
+static
+void zspscq_copy_in(zspscq_t *sq, uint64_t pos, const void *elems, zcount_t count)
+{
+    uint32_t elem_size = sq->q.elem_size;
+    zbidx_t  bidx  = (zbidx_t)(pos & sq->mask);
+    zcount_t first = MIN(count, sq->q.depth - bidx);
+
+    memcpy(ZQUEUE_ELEM_BASE((&sq->q), bidx), elems, first * elem_size);
+    if (count > first) {
+        memcpy(sq->q.elem_array, (const char *)elems + first * elem_size,
+               (count - first) * elem_size);
+    }
+}
+
+static
+void zspscq_copy_out(zspscq_t *sq, uint64_t pos, void *elems, zcount_t count)
+{
+    uint32_t elem_size = sq->q.elem_size;
+    zbidx_t  bidx  = (zbidx_t)(pos & sq->mask);
+    zcount_t first = MIN(count, sq->q.depth - bidx);
+
+    memcpy(elems, ZQUEUE_ELEM_BASE((&sq->q), bidx), first * elem_size);
+    if (count > first) {
+        memcpy((char *)elems + first * elem_size, sq->q.elem_array,
+               (count - first) * elem_size);
+    }
+}
+
+zcount_t zspscq_push(zspscq_t *sq, const void *elem_base)
+{
+    uint64_t tail = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+
+    if (tail - sq->head_cache >= (uint64_t)sq->q.depth) {
+        sq->head_cache = atomic_load_explicit(&sq->head, memory_order_acquire);
+        if (tail - sq->head_cache >= (uint64_t)sq->q.depth) {
+            return 0;
+        }
+    }
+
+    memcpy(ZQUEUE_ELEM_BASE((&sq->q), tail & sq->mask), elem_base, sq->q.elem_size);
+    atomic_store_explicit(&sq->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+zcount_t zspscq_pop(zspscq_t *sq, void *dst_base)
+{
+    uint64_t head = atomic_load_explicit(&sq->head, memory_order_relaxed);
+
+    if (head == sq->tail_cache) {
+        sq->tail_cache = atomic_load_explicit(&sq->tail, memory_order_acquire);
+        if (head == sq->tail_cache) {
+            return 0;
+        }
+    }
+
+    if (dst_base) {
+        memcpy(dst_base, ZQUEUE_ELEM_BASE((&sq->q), head & sq->mask), sq->q.elem_size);
+    }
+    atomic_store_explicit(&sq->head, head + 1, memory_order_release);
+    return 1;
+}
+
+zcount_t zspscq_push_multi(zspscq_t *sq, const void *elems, zcount_t count)
+{
+    uint64_t tail = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+    uint64_t space = sq->q.depth - (tail - sq->head_cache);
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (space < (uint64_t)count) {
+        sq->head_cache = atomic_load_explicit(&sq->head, memory_order_acquire);
+        space = sq->q.depth - (tail - sq->head_cache);
+        if (space == 0) {
+            return 0;
+        }
+        count = (zcount_t)MIN((uint64_t)count, space);
+    }
+
+    zspscq_copy_in(sq, tail, elems, count);
+    atomic_store_explicit(&sq->tail, tail + count, memory_order_release);
+    return count;
+}
+
+zcount_t zspscq_pop_multi(zspscq_t *sq, void *elems, zcount_t count)
+{
+    uint64_t head = atomic_load_explicit(&sq->head, memory_order_relaxed);
+    uint64_t avail = sq->tail_cache - head;
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (avail < (uint64_t)count) {
+        sq->tail_cache = atomic_load_explicit(&sq->tail, memory_order_acquire);
+        avail = sq->tail_cache - head;
+        if (avail == 0) {
+            return 0;
+        }
+        count = (zcount_t)MIN((uint64_t)count, avail);
+    }
+
+    if (elems) {
+        zspscq_copy_out(sq, head, elems, count);
+    }
+    atomic_store_explicit(&sq->head, head + count, memory_order_release);
+    return count;
+}
@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief lock-free single-producer/single-consumer ring on zqueue storage
+ *
+ *  -Exactly one thread may push and exactly one thread may pop.
+ *  -depth is rounded up to power of 2, so index wrap is a mask.
+ *  -head/tail are free running 64-bit counters living in separated
+ *   cache lines. Each side keeps a private copy of the other side's
+ *   counter and only reloads it (acquire) when the copy says full/empty.
+ *  -*_multi() publish the whole batch with one release store.
+ */
+
+#ifndef ZSPSCQ_H_
+#define ZSPSCQ_H_
+
+#include <stdatomic.h>
+#include "zdefs.h"
+#include "zqueue.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+typedef struct z_spsc_queue
+{
+    zqueue_t            q;                  //<! elem_array/elem_size/depth
+    uint64_t            mask;               //<! depth - 1
+
+    /* consumer side */
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_uint_fast64_t head;              //<! next elem to pop
+    uint64_t            tail_cache;         //<! consumer's copy of tail
+
+    /* producer side */
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_uint_fast64_t tail;              //<! next slot to push
+    uint64_t            head_cache;         //<! producer's copy of head
+}zspscq_t;
+
+
+/** @param depth    would be rounded up to power of 2 */
+zspscq_t*   zspscq_malloc(uint32_t elem_size, uint32_t depth);
+#define     ZSPSCQ_MALLOC(type_t, depth)    zspscq_malloc(sizeof(type_t), (depth))
+void        zspscq_free(zspscq_t *sq);
+
+zcount_t    zspscq_get_depth(zspscq_t *sq);
+zcount_t    zspscq_get_count(zspscq_t *sq);         //<! snapshot, may be stale
+
+/** producer side, @return 1 or 0 if full */
+zcount_t    zspscq_push(zspscq_t *sq, const void *elem_base);
+
+/** consumer side, @return 1 or 0 if empty */
+zcount_t    zspscq_pop(zspscq_t *sq, void *dst_base);
+
+/**
+ * Batch push/pop of elems packed in @elems.
+ * @return the count actually pushed/popped, 0 ~ @count
+ */
+zcount_t    zspscq_push_multi(zspscq_t *sq, const void *elems, zcount_t count);
+zcount_t    zspscq_pop_multi(zspscq_t *sq, void *elems, zcount_t count);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZSPSCQ_H_
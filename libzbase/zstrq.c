@@ -18,6 +18,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "zstrq.h"
 #include "sim_log.h"
@@ -27,6 +35,52 @@ const static uint32_t g_zsq_page = (1<<16);
 const static uint32_t g_zsq_max_size = (1<<24);
 
 
+/* entries grow down from the aligned end of str_buf */
+#define ZSQ_ENT_TOP(buf, size) \
+    ((zsq_entry_t *)((buf) + ((size) & ~(zspace_t)(sizeof(zsq_ptr_t) - 1))) - 1)
+
+#define ZSQ_ALIGN8(n)   (((n) + 7) & ~(uint64_t)7)
+
+static inline
+zsq_char_t* zsq_ent_str(zstrq_t *sq, zsq_entry_t *ent)
+{
+    return sq->chunk_size ? ent->str : sq->str_buf + ent->off;
+}
+
+static inline
+void zsq_ent_set_str(zstrq_t *sq, zsq_entry_t *ent, zsq_char_t *str)
+{
+    if (sq->chunk_size) {
+        ent->str = str;
+    } else {
+        ent->off = (uint64_t)(str - sq->str_buf);
+    }
+}
+
+/** the entry of @qidx, block b+1-ZSQ_ENT_BLK0_LOG2 starts at 2^b in chunked mode */
+static inline
+zsq_entry_t* zsq_ent(zstrq_t *sq, zqidx_t qidx)
+{
+    uint32_t b;
+
+    if (!sq->chunk_size) {
+        return &sq->ent_array[-qidx];
+    }
+    b = 31 - __builtin_clz((uint32_t)qidx | (ZSQ_ENT_BLK0 - 1));
+    return &sq->ent_blk[b + 1 - ZSQ_ENT_BLK0_LOG2][(uint32_t)qidx - ((1u << b) & ~(ZSQ_ENT_BLK0 - 1u))];
+}
+
+/** 0 for a deleted string */
+static inline
+uint32_t zsq_ent_len(const zsq_entry_t *ent)
+{
+    return (ent->len & ZSQ_ENT_DEAD) ? 0 : ent->len;
+}
+
+static void zsq_intern_free(zstrq_t *sq);
+static void zsq_intern_drop(zstrq_t *sq, zqidx_t id);
+static void zsq_gc_finish(zstrq_t *sq);
+
 zstrq_t* zstrq_malloc(uint32_t size)
 {
     zstrq_t *sq = calloc( 1, sizeof(zstrq_t) );
@@ -41,7 +95,7 @@ zstrq_t* zstrq_malloc(uint32_t size)
 
     if (sq->str_buf) {
         sq->buf_size = size;
-        sq->ptr_array = (zsq_ptr_t *)(sq->str_buf+size) - 1;
+        sq->ent_array = ZSQ_ENT_TOP(sq->str_buf, size);
     } else {
         xwarn("<zstrq> sizeof(str_buf)=0\n"); 
         return sq;
@@ -50,11 +104,424 @@ zstrq_t* zstrq_malloc(uint32_t size)
     return sq;
 }
 
+zstrq_t* zstrq_malloc_chunked(uint32_t chunk_size)
+{
+    zstrq_t *sq = calloc( 1, sizeof(zstrq_t) );
+    if (!sq) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        return 0;
+    } 
+
+    /* chunks and entries are allocated on the first push */
+    sq->chunk_size = chunk_size ? MIN(chunk_size, g_zsq_max_size) : g_zsq_page;
+    return sq;
+}
+
+zstrq_t* zstrq_open_image(const void *image, size_t size)
+{
+    const zsq_image_header_t *hdr = image;
+    zsq_char_t *str_buf = (zsq_char_t *)image + sizeof(zsq_image_header_t);
+    zsq_entry_t *ents;
+    zstrq_t *sq;
+
+    if (!image || ((uintptr_t)image & 7) || size < sizeof(zsq_image_header_t) ||
+        memcmp(hdr->magic, ZSQ_IMAGE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != ZSQ_IMAGE_VERSION || hdr->ent_size != sizeof(zsq_entry_t) ||
+        hdr->str_bytes > INT32_MAX || hdr->numstr > INT32_MAX ||
+        size != sizeof(zsq_image_header_t) + ZSQ_ALIGN8(hdr->str_bytes) + 
+                hdr->numstr * sizeof(zsq_entry_t)) {
+        xerr("<zstrq> invalid image\n");
+        return 0;
+    }
+
+    /* the entries are not walked here, it would touch the whole image */
+    ents = (zsq_entry_t *)(str_buf + ZSQ_ALIGN8(hdr->str_bytes));
+
+    sq = calloc( 1, sizeof(zstrq_t) );
+    if (!sq) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    sq->str_buf   = str_buf;
+    sq->buf_size  = (zspace_t)hdr->str_bytes;
+    sq->buf_used  = (zcount_t)hdr->str_bytes;
+    sq->numstr    = (zcount_t)hdr->numstr;
+    sq->ent_array = ents + hdr->numstr - 1;
+    sq->_b_fixed_size = 1;
+    sq->_b_view       = 1;
+    return sq;
+}
+
+zstrq_t* zstrq_open_mmap(const char *path)
+{
+    struct stat st;
+    void *base;
+    zstrq_t *sq;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        xerr("<zstrq> open(%s) failed\n", path);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        xerr("<zstrq> %s: empty or unreadable\n", path);
+        close(fd);
+        return 0;
+    }
+    base = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        xerr("<zstrq> mmap(%s) failed\n", path);
+        return 0;
+    }
+
+    sq = zstrq_open_image(base, (size_t)st.st_size);
+    if (!sq) {
+        munmap(base, (size_t)st.st_size);
+        return 0;
+    }
+    sq->map_base = base;
+    sq->map_size = (size_t)st.st_size;
+    return sq;
+}
+
+int zstrq_save(zstrq_t *sq, const char *path)
+{
+    static const char pad[8] = {0};
+    zsq_image_header_t hdr;
+    zsq_entry_t ent;
+    zqidx_t idx;
+    uint64_t off = 0;
+    int ok = 1;
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp) {
+        xerr("<zstrq> fopen(%s) failed\n", path);
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ZSQ_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version   = ZSQ_IMAGE_VERSION;
+    hdr.ent_size  = sizeof(zsq_entry_t);
+    hdr.numstr    = sq->numstr;
+    hdr.str_bytes = 0;
+    for (idx=0; idx<sq->numstr; ++idx) {
+        hdr.str_bytes += zsq_ent_len(zsq_ent(sq, idx)) + 1;
+    }
+    ok &= fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+    if (!sq->chunk_size && !sq->_b_no_term && hdr.str_bytes == (uint64_t)sq->buf_used) {
+        /* flat and packed, write the buffers as they are */
+        ok &= fwrite(sq->str_buf, 1, sq->buf_used, fp) == (size_t)sq->buf_used;
+        ok &= fwrite(pad, 1, ZSQ_ALIGN8(hdr.str_bytes) - hdr.str_bytes, fp) == 
+              ZSQ_ALIGN8(hdr.str_bytes) - hdr.str_bytes;
+        ok &= fwrite(sq->ent_array + 1 - sq->numstr, sizeof(zsq_entry_t), sq->numstr, fp) == 
+              (size_t)sq->numstr;
+    } else {
+        for (idx=0; idx<sq->numstr && ok; ++idx) {
+            zsq_entry_t *e = zsq_ent(sq, idx);
+            ok &= fwrite(zsq_ent_str(sq, e), 1, zsq_ent_len(e), fp) == zsq_ent_len(e);
+            ok &= fputc(0, fp) == 0;
+        }
+        ok &= fwrite(pad, 1, ZSQ_ALIGN8(hdr.str_bytes) - hdr.str_bytes, fp) == 
+              ZSQ_ALIGN8(hdr.str_bytes) - hdr.str_bytes;
+        /* entries go last one first, offsets are those of the packed strings */
+        for (idx=0; idx<sq->numstr; ++idx) {
+            off += zsq_ent_len(zsq_ent(sq, idx)) + 1;
+        }
+        for (idx=sq->numstr-1; idx>=0 && ok; --idx) {
+            ent = *zsq_ent(sq, idx);
+            off -= zsq_ent_len(&ent) + 1;
+            ent.off = off;
+            ok &= fwrite(&ent, sizeof(ent), 1, fp) == 1;
+        }
+    }
+
+    ok &= fclose(fp) == 0;
+    if (!ok) {
+        xerr("<zstrq> write(%s) failed\n", path);
+    }
+    return ok;
+}
+
+/* file index view */
+
+#define ZSQ_IDX_MAX_VEC         (4)
+#define ZSQ_IDX_MIN_PART        (1<<20)     //<! min bytes per thread
+#define ZSQ_IDX_MAX_THREADS     (64)
+
+typedef struct zsq_delim_set
+{
+    uint8_t         is_delim[256];
+    int             nvec;                   //<! 0 if too many delimiters
+#if defined(__SSE2__)
+    __m128i         vec[ZSQ_IDX_MAX_VEC];
+#endif
+}zsq_delim_set_t;
+
+typedef struct zsq_idx_part
+{
+    const zsq_char_t       *base;
+    size_t                  start;
+    size_t                  end;
+    int                     b_last;         //<! the text may end without delimiter
+    uint32_t                flags;
+    const zsq_delim_set_t  *dset;
+
+    zsq_entry_t            *ents;           //<! in field order
+    size_t                  count;
+    size_t                  depth;
+    int                     err;
+}zsq_idx_part_t;
+
+static
+void zsq_delim_set_init(zsq_delim_set_t *ds, const char *delims)
+{
+    int n = (int)strlen(delims), i;
+
+    memset(ds, 0, sizeof(zsq_delim_set_t));
+    for (i=0; i<n; ++i) {
+        ds->is_delim[(uint8_t)delims[i]] = 1;
+    }
+#if defined(__SSE2__)
+    if (n <= ZSQ_IDX_MAX_VEC) {
+        for (i=0; i<n; ++i) {
+            ds->vec[i] = _mm_set1_epi8(delims[i]);
+        }
+        ds->nvec = n;
+    }
+#endif
+}
+
+/** bit i set if @p[i] is a delimiter, 0 <= i < @n <= 16 */
+static inline
+uint32_t zsq_delim_mask(const zsq_delim_set_t *ds, const zsq_char_t *p, size_t n)
+{
+    uint32_t m = 0;
+    size_t i;
+#if defined(__SSE2__)
+    if (n == 16 && ds->nvec) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i e = _mm_cmpeq_epi8(v, ds->vec[0]);
+        int k;
+        for (k=1; k<ds->nvec; ++k) {
+            e = _mm_or_si128(e, _mm_cmpeq_epi8(v, ds->vec[k]));
+        }
+        return (uint32_t)_mm_movemask_epi8(e);
+    }
+#endif
+    for (i=0; i<n; ++i) {
+        m |= (uint32_t)ds->is_delim[(uint8_t)p[i]] << i;
+    }
+    return m;
+}
+
+static
+void zsq_idx_emit(zsq_idx_part_t *pt, size_t a, size_t b)
+{
+    zsq_entry_t *ents;
+    size_t depth;
+
+    if ((pt->flags & ZSQ_IDX_STRIP_CR) && b > a && pt->base[b - 1] == '\r') {
+        b -= 1;
+    }
+    if (b == a && (pt->flags & ZSQ_IDX_SKIP_EMPTY)) {
+        return;
+    }
+    if (b - a >= ZSQ_ENT_DEAD) {
+        pt->err = 1;
+        return;
+    }
+    if (pt->count == pt->depth) {
+        depth = MAX(pt->depth * 2, 1024);
+        ents = realloc(pt->ents, sizeof(zsq_entry_t) * depth);
+        if (!ents) {
+            pt->err = 1;
+            return;
+        }
+        pt->ents  = ents;
+        pt->depth = depth;
+    }
+    pt->ents[pt->count].off  = a;
+    pt->ents[pt->count].len  = (uint32_t)(b - a);
+    pt->ents[pt->count].hash = 0;
+    pt->count += 1;
+}
+
+static
+void* zsq_idx_scan(void *arg)
+{
+    zsq_idx_part_t *pt = arg;
+    const zsq_char_t *base = pt->base;
+    size_t p = pt->start, field = pt->start, n;
+    uint32_t m;
+
+    while (p < pt->end && !pt->err) {
+        n = MIN(16, pt->end - p);
+        for (m = zsq_delim_mask(pt->dset, base + p, n); m; m &= m - 1) {
+            size_t d = p + __builtin_ctz(m);
+            zsq_idx_emit(pt, field, d);
+            field = d + 1;
+        }
+        p += n;
+    }
+    if (pt->b_last && field < pt->end) {
+        zsq_idx_emit(pt, field, pt->end);
+    }
+    return 0;
+}
+
+/** @return the position after the first delimiter at or after @p */
+static
+size_t zsq_idx_next_field(const zsq_delim_set_t *ds, const zsq_char_t *base, size_t p, size_t end)
+{
+    for (; p < end; ++p) {
+        if (ds->is_delim[(uint8_t)base[p]]) {
+            return p + 1;
+        }
+    }
+    return end;
+}
+
+zstrq_t* zstrq_index_buf(const zsq_char_t *buf, size_t size, const char *delims,
+                         uint32_t flags, int n_threads)
+{
+    zsq_idx_part_t part[ZSQ_IDX_MAX_THREADS];
+    pthread_t tid[ZSQ_IDX_MAX_THREADS];
+    int b_joined[ZSQ_IDX_MAX_THREADS];
+    zsq_delim_set_t dset;
+    zstrq_t *sq = 0;
+    size_t total = 0, done = 0, k;
+    int nt, i, err = 0;
+
+    if (!buf || !delims || !delims[0]) {
+        xerr("<zstrq> %s(): no buf or delimiters\n", __FUNCTION__);
+        return 0;
+    }
+
+    if (n_threads <= 0) {
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    nt = (int)MIN((size_t)CLIP(n_threads, 1, ZSQ_IDX_MAX_THREADS), 
+                  MAX(size / ZSQ_IDX_MIN_PART, 1));
+
+    zsq_delim_set_init(&dset, delims);
+    memset(part, 0, sizeof(zsq_idx_part_t) * nt);
+    for (i=0; i<nt; ++i) {
+        part[i].base  = buf;
+        part[i].flags = flags;
+        part[i].dset  = &dset;
+        part[i].start = i ? part[i-1].end : 0;
+        part[i].end   = (i == nt - 1) ? size :
+            zsq_idx_next_field(&dset, buf, MAX(size / nt * (i + 1), part[i].start), size);
+        part[i].b_last = part[i].end == size;
+    }
+
+    for (i=1; i<nt; ++i) {
+        b_joined[i] = pthread_create(&tid[i], 0, zsq_idx_scan, &part[i]) == 0;
+        if (!b_joined[i]) {
+            zsq_idx_scan(&part[i]);         /* do it here then */
+        }
+    }
+    zsq_idx_scan(&part[0]);
+    for (i=1; i<nt; ++i) {
+        if (b_joined[i]) {
+            pthread_join(tid[i], 0);
+        }
+    }
+
+    for (i=0; i<nt; ++i) {
+        total += part[i].count;
+        err   |= part[i].err;
+    }
+    if (err || total > INT32_MAX) {
+        xerr("<zstrq> %s() failed, %zu fields\n", __FUNCTION__, total);
+        goto out;
+    }
+
+    sq = calloc( 1, sizeof(zstrq_t) );
+    if (!sq || (total && !(sq->ent_buf = malloc(sizeof(zsq_entry_t) * total)))) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(sq);
+        goto out;
+    }
+
+    /* entries go backwards, ent_array[-qidx] */
+    for (i=0; i<nt; ++i) {
+        for (k=0; k<part[i].count; ++k) {
+            sq->ent_buf[total - 1 - done - k] = part[i].ents[k];
+        }
+        done += part[i].count;
+    }
+    sq->str_buf    = (zsq_char_t *)buf;
+    sq->buf_size   = (zspace_t)MIN(size, INT32_MAX);
+    sq->buf_used   = sq->buf_size;
+    sq->total_size = size;
+    sq->numstr     = (zcount_t)total;
+    sq->ent_depth  = (zcount_t)total;
+    sq->ent_array  = total ? sq->ent_buf + total - 1 : 0;
+    sq->_b_fixed_size = 1;
+    sq->_b_view       = 1;
+    sq->_b_no_term    = 1;
+
+out:
+    for (i=0; i<nt; ++i) {
+        SIM_FREEP(part[i].ents);
+    }
+    return sq;
+}
+
+zstrq_t* zstrq_index_file(const char *path, const char *delims,
+                          uint32_t flags, int n_threads)
+{
+    static const zsq_char_t empty[1] = {0};
+    struct stat st;
+    void *base = 0;
+    zstrq_t *sq;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        xerr("<zstrq> open(%s) failed\n", path);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0) {
+        xerr("<zstrq> fstat(%s) failed\n", path);
+        close(fd);
+        return 0;
+    }
+    if (st.st_size > 0) {
+        base = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            xerr("<zstrq> mmap(%s) failed\n", path);
+            close(fd);
+            return 0;
+        }
+        madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    sq = zstrq_index_buf(base ? base : empty, (size_t)st.st_size, delims, flags, n_threads);
+    if (!sq) {
+        if (base) {
+            munmap(base, (size_t)st.st_size);
+        }
+        return 0;
+    }
+    sq->map_base = base;
+    sq->map_size = (size_t)st.st_size;
+    return sq;
+}
+
 zstrq_t* zstrq_realloc(zstrq_t *sq, uint32_t new_size)
 {
-    zqidx_t idx = 0;
-    zsq_ptr_t *old_ptr_array = 0;
-    zsq_ptr_t *new_ptr_array = 0;
+    zsq_entry_t *new_ent_array = 0;
+    size_t ent_bytes = sizeof(zsq_entry_t) * sq->numstr;
+    zspace_t old_size = sq->buf_size;
+
+    if (sq->chunk_size || sq->map_base || sq->_b_view) {
+        return sq;
+    }
 
     if (new_size > g_zsq_max_size) {
         xerr("<zstrq> realloc(): new_size exceed max allowed size\n");
@@ -65,29 +532,21 @@ zstrq_t* zstrq_realloc(zstrq_t *sq, uint32_t new_size)
 
     if ((int)new_size > sq->buf_size) 
     {
-        zsq_char_t *old_buf = sq->str_buf;
-        zsq_char_t *new_buf = realloc(old_buf, sizeof(zsq_char_t) * new_size);
+        zsq_char_t *new_buf = realloc(sq->str_buf, sizeof(zsq_char_t) * new_size);
         if (!new_buf) {
             xerr("<zstrq> realloc() str_buf failed\n");
             return sq;
         }
-
-        if (sq->str_buf != new_buf) {
-            if (sq->str_buf) {
-                memcpy(new_buf, sq->str_buf, sq->buf_used);
-                free(sq->str_buf);
-            }
-            sq->str_buf = new_buf;
-        }
+        sq->str_buf  = new_buf;
         sq->buf_size = new_size;
 
-        // move ptr_array to the new end;
-        old_ptr_array = sq->ptr_array;
-        new_ptr_array = (zsq_ptr_t *)(new_buf+new_size) - 1;
-        for (idx=0; idx<sq->numstr; ++idx) {
-            new_ptr_array[-idx] = new_buf + (old_ptr_array[-idx] - old_buf);
+        // move ent_array to the new end, offsets stay as they are;
+        new_ent_array = ZSQ_ENT_TOP(new_buf, new_size);
+        if (ent_bytes) {
+            memmove(new_ent_array + 1 - sq->numstr, 
+                    ZSQ_ENT_TOP(new_buf, old_size) + 1 - sq->numstr, ent_bytes);
         }
-        sq->ptr_array = new_ptr_array;
+        sq->ent_array = new_ent_array;
     }
 
     return sq;
@@ -95,14 +554,36 @@ zstrq_t* zstrq_realloc(zstrq_t *sq, uint32_t new_size)
 
 void zstrq_free(zstrq_t *sq)
 {
+    zsq_chunk_t *c, *prev;
+    int i;
+
     if (sq) {
-        if (sq->str_buf) {
+        zsq_intern_free(sq);
+        if (sq->chunk_size) {
+            for (c=sq->chunk; c; c=prev) {
+                prev = c->prev;
+                free(c);
+            }
+        } else if (sq->map_base) {
+            munmap(sq->map_base, sq->map_size);
+        } else if (sq->_b_view) {
+            /* a view of a user image */
+        } else if (sq->str_buf) {
             free(sq->str_buf);
         }
+        for (i=0; i<ZSQ_ENT_BLKS; ++i) {
+            SIM_FREEP(sq->ent_blk[i]);
+        }
+        SIM_FREEP(sq->ent_buf);
         free (sq);
     }
 }
 
+void zstrq_set_hash_func(zstrq_t *sq, zsq_hash_func_t func)
+{
+    sq->hash_func = func;
+}
+
 zspace_t zstrq_get_buf_size(zstrq_t *sq)
 {
     return sq->buf_size;
@@ -113,23 +594,39 @@ zcount_t zstrq_get_str_count(zstrq_t *sq)
     return sq->numstr;
 }
 
-zspace_t zstrq_get_buf_space(zstrq_t *sq)
+uint64_t zstrq_get_total_size(zstrq_t *sq)
 {
-    /* reserve one zsq_ptr_t space for future use */
-    return sq->buf_size - sq->buf_used - sizeof(zsq_ptr_t) * (1 + sq->numstr);
+    if (sq->_b_no_term) {
+        return sq->total_size;
+    }
+    return sq->chunk_size ? sq->total_size : (uint64_t)sq->buf_size;
 }
 
-static
-zsq_char_t* zstrq_set_str_base(zstrq_t *sq, zqidx_t qidx, zsq_char_t *base)
+uint64_t zstrq_get_total_used(zstrq_t *sq)
+{
+    if (sq->_b_no_term) {
+        return sq->total_size;
+    }
+    return sq->chunks_used + sq->buf_used;
+}
+
+zspace_t zstrq_get_buf_space(zstrq_t *sq)
 {
-    return sq->ptr_array[-qidx] = base;
+    if (!sq->str_buf || sq->_b_view) {
+        return 0;
+    }
+    if (sq->chunk_size) {
+        return sq->buf_size - sq->buf_used;
+    }
+    /* reserve one zsq_entry_t space for future use, the last push may
+       have taken it already */
+    return MAX((zspace_t)((zsq_char_t *)(sq->ent_array - sq->numstr) - sq->str_buf) - sq->buf_used, 0);
 }
 
 zsq_char_t* zstrq_get_str_base(zstrq_t *sq, zqidx_t qidx)
 {
-    if (0<=qidx && qidx <= sq->numstr) {
-        zsq_char_t* str = sq->ptr_array[-qidx];
-        return str;
+    if (0<=qidx && qidx < sq->numstr && !(zsq_ent(sq, qidx)->len & ZSQ_ENT_DEAD)) {
+        return zsq_ent_str(sq, zsq_ent(sq, qidx));
     }
 
     return 0;
@@ -137,60 +634,190 @@ zsq_char_t* zstrq_get_str_base(zstrq_t *sq, zqidx_t qidx)
 
 uint32_t    zstrq_get_str_size(zstrq_t *sq, zqidx_t qidx)
 {
-    if (0<=qidx && qidx <= sq->numstr) {
-        zsq_char_t* str = sq->ptr_array[-qidx];
-        return strlen(str);
+    if (0<=qidx && qidx < sq->numstr) {
+        return zsq_ent_len(zsq_ent(sq, qidx));
     }
 
     return 0;
 }
 
-zaddr_t  zstrq_push_back(zstrq_t *sq, const zsq_char_t* str, uint32_t str_len)
+uint32_t    zstrq_get_str_hash(zstrq_t *sq, zqidx_t qidx)
+{
+    if (0<=qidx && qidx < sq->numstr && !(zsq_ent(sq, qidx)->len & ZSQ_ENT_DEAD)) {
+        return zsq_ent(sq, qidx)->hash;
+    }
+
+    return 0;
+}
+
+static
+int zsq_chunked_reserve(zstrq_t *sq, size_t str_bytes, zcount_t n_ent)
+{
+    zsq_chunk_t *c;
+    size_t size;
+    int k;
+
+    /* add entry blocks, the old ones stay where they are */
+    if ((int64_t)sq->numstr + MAX(n_ent, 1) > INT32_MAX) {
+        return 0;
+    }
+    while (sq->ent_depth - sq->numstr < MAX(n_ent, 1)) {
+        k = sq->ent_depth ? 32 - __builtin_clz((uint32_t)sq->ent_depth) - ZSQ_ENT_BLK0_LOG2 : 0;
+        size = k ? (size_t)ZSQ_ENT_BLK0 << (k - 1) : ZSQ_ENT_BLK0;
+        sq->ent_blk[k] = malloc(sizeof(zsq_entry_t) * size);
+        if (!sq->ent_blk[k]) {
+            xerr("<zstrq> malloc() entry block failed\n");
+            return 0;
+        }
+        sq->ent_depth = (zcount_t)MIN((int64_t)ZSQ_ENT_BLK0 << k, INT32_MAX);
+    }
+
+    if ((size_t)(sq->buf_size - sq->buf_used) >= str_bytes) {
+        return 1;
+    }
+
+    size = MAX(sq->chunk_size, str_bytes);
+    if (size > INT32_MAX) {
+        return 0;
+    }
+    c = malloc(sizeof(zsq_chunk_t) + size);
+    if (!c) {
+        xerr("<zstrq> malloc() chunk failed\n");
+        return 0;
+    }
+
+    if (sq->chunk && sq->buf_used == 0) {
+        /* an empty current chunk is left by pop, drop it */
+        zsq_chunk_t *empty = sq->chunk;
+        sq->chunk = empty->prev;
+        sq->total_size -= empty->size;
+        free(empty);
+    } else if (sq->chunk) {
+        sq->chunk->used  = sq->buf_used;
+        sq->chunks_used += sq->buf_used;
+    }
+    c->prev = sq->chunk;
+    c->next = 0;
+    c->size = (zspace_t)size;
+    c->used = 0;
+    if (sq->chunk) {
+        sq->chunk->next = c;
+    }
+    sq->chunk       = c;
+    sq->str_buf     = c->data;
+    sq->buf_size    = c->size;
+    sq->buf_used    = 0;
+    sq->total_size += size;
+    return 1;
+}
+
+/** make room for @str_bytes chars and @n_ent entries, @return 1 if ok */
+static
+int zstrq_reserve(zstrq_t *sq, size_t str_bytes, zcount_t n_ent)
+{
+    size_t need = str_bytes + sizeof(zsq_entry_t) * n_ent;
+    size_t more;
+
+    if (sq->chunk_size) {
+        return zsq_chunked_reserve(sq, str_bytes, n_ent);
+    }
+
+    if ((size_t)zstrq_get_buf_space(sq) >= need) {
+        return 1;
+    }
+    if (sq->_b_fixed_size) {
+        return 0;
+    }
+
+    /* whole pages, with room for the realigned entry top */
+    more = (need + sizeof(zsq_entry_t) + g_zsq_page - 1) / g_zsq_page * g_zsq_page;
+    if (sq->buf_size + more > g_zsq_max_size) {
+        return 0;
+    }
+    zstrq_realloc(sq, (uint32_t)(sq->buf_size + more));
+    return (size_t)zstrq_get_buf_space(sq) >= need;
+}
+
+static
+zaddr_t  zstrq_push_back_internal(zstrq_t *sq, const zsq_char_t* str, 
+                                 uint32_t str_len, uint32_t hash, int b_hashed)
 {
-    zsq_char_t  c = 0;
-    zspace_t i = 0;
-    zspace_t space = 0;
     zsq_char_t *dst =0;
+    zsq_entry_t *ent = 0;
 
     if (!str) {
         xerr("<zstrq> null str\n");
         return 0;
     }
 
-    space = zstrq_get_buf_space(sq) - 1;
-    str_len = str_len ? str_len : strlen(str);
-    if (!sq->_b_fixed_size && space<(int)str_len) {
-        sq = zstrq_realloc(sq, sq->buf_size + g_zsq_page);
-        space = zstrq_get_buf_space(sq) - 1;
-    }
-    
-    if (space<(int)str_len) {
+    if (!zstrq_reserve(sq, (size_t)str_len + 1, 0)) {
         xerr("<zstrq> str buf overflow\n");
         return 0;
     }
 
     dst = sq->str_buf + sq->buf_used;
-    for (i=0; (c=str[i]) && i<(int)str_len && i<space; ++i) {
-        dst[i] = c;
-    } 
+    memcpy(dst, str, str_len);
+    dst[str_len] = 0;
+    sq->buf_used += str_len + 1;
 
-    dst[i] = 0;
-    sq->buf_used += (i+1);
-    sq->ptr_array[- sq->numstr] = dst;
+    ent = zsq_ent(sq, sq->numstr);
+    zsq_ent_set_str(sq, ent, dst);
+    ent->len  = str_len;
+    ent->hash = b_hashed ? hash : (sq->hash_func ? sq->hash_func(dst, str_len) : 0);
     sq->numstr += 1;
     return dst; 
 }
 
+zaddr_t  zstrq_push_back(zstrq_t *sq, const zsq_char_t* str, uint32_t str_len)
+{
+    str_len = (str && !str_len) ? strlen(str) : str_len;
+    return zstrq_push_back_internal(sq, str, str_len, 0, 0);
+}
+
+zaddr_t  zstrq_push_back_hashed(zstrq_t *sq, const zsq_char_t* str,
+                                uint32_t str_len, uint32_t hash)
+{
+    str_len = (str && !str_len) ? strlen(str) : str_len;
+    return zstrq_push_back_internal(sq, str, str_len, hash, 1);
+}
+
 zaddr_t  zstrq_pop_back(zstrq_t *sq, uint32_t *str_len)
 {
+    zsq_char_t *str;
+
     if (sq->numstr>0) {
-        zsq_char_t *base = sq->ptr_array[ 1 - sq->numstr ];
-        sq->buf_used  = base - sq->str_buf;
+        zsq_entry_t *ent = zsq_ent(sq, sq->numstr - 1);
+        if (ent->len & ZSQ_ENT_DEAD) {
+            sq->numdead    -= 1;
+            sq->dead_bytes -= ent->hash;
+        } else if (sq->intern) {
+            zsq_intern_drop(sq, sq->numstr - 1);
+        }
+        if (sq->chunk_size && sq->buf_used == 0 && sq->chunk->prev) {
+            /* the current chunk was emptied by last pop, back to the previous */
+            zsq_chunk_t *c = sq->chunk;
+            sq->chunk        = c->prev;
+            sq->chunk->next  = 0;
+            sq->total_size  -= c->size;
+            sq->str_buf      = sq->chunk->data;
+            sq->buf_size     = sq->chunk->size;
+            sq->buf_used     = sq->chunk->used;
+            sq->chunks_used -= sq->chunk->used;
+            free(c);
+        }
+        str = zsq_ent_str(sq, ent);
+        if (!sq->_b_no_term && !sq->_b_unpacked) {
+            sq->buf_used = str - sq->str_buf;
+        }
         sq->numstr -= 1;
+        if (sq->_b_gc && sq->gc_next >= sq->numstr) {
+            /* the rest was moved already, the pass is done */
+            zsq_gc_finish(sq);
+        }
         if (str_len) {
-            *str_len = strlen(base);
+            *str_len = zsq_ent_len(ent);
         }
-        return base;
+        return str;
     }
     return 0;
 }
@@ -224,25 +851,64 @@ zcount_t zstrq_push_back_multi(zstrq_t *dst, zstrq_t *src,
                                   zcount_t push_count)
 {
     zqidx_t qidx = 0;
-    zaddr_t src_base = 0;
-    zaddr_t dst_base = 0;
+    zcount_t pushed = 0;
+    zsq_entry_t *s_ent, *d_ent;
+    zsq_char_t *s_base, *d_base;
+    size_t bytes;
+    int b_rehash, b_packed;
 
-    for (qidx=0; qidx<push_count; ++qidx) {
-        src_base = zstrq_get_str_base(src, src_start+qidx);
-        if (!src_base) {
-            break;
-        }
+    if (src_start < 0 || src_start >= src->numstr || push_count <= 0) {
+        return 0;
+    }
+    push_count = MIN(push_count, src->numstr - src_start);
 
-        dst_base = zstrq_push_back(dst, src_base, 0);
-        if (!dst_base) {
-            break;
+    /* strings of a flat src are packed in push order, copy them at once */
+    s_ent = zsq_ent(src, src_start);
+    b_packed = !src->chunk_size && !src->_b_no_term && !src->numdead;
+    bytes = !b_packed ? 0 :
+        (size_t)(s_ent[1 - push_count].off + s_ent[1 - push_count].len + 1 - s_ent[0].off);
+    if (!b_packed || !zstrq_reserve(dst, bytes, push_count)) {
+        if (dst == src && b_packed) {
+            return 0;
+        }
+        /* packed over chunks, not terminated, with tombstones, or doesn't 
+           fit as a whole: one by one */
+        for (qidx=0; qidx<push_count; ++qidx) {
+            s_ent = zsq_ent(src, src_start + qidx);
+            if (s_ent->len & ZSQ_ENT_DEAD) {
+                continue;
+            }
+            if (!zstrq_push_back_internal(dst, zsq_ent_str(src, s_ent), s_ent->len, 
+                                          s_ent->hash, dst->hash_func == src->hash_func)) {
+                break;
+            }
+            pushed += 1;
         }
+        return pushed;
     }
 
-    return qidx;
-}
+    /* re-read, dst may be src and have been moved by reserve */
+    s_ent  = zsq_ent(src, src_start);
+    s_base = zsq_ent_str(src, s_ent);
+    d_base = dst->str_buf + dst->buf_used;
+    memcpy(d_base, s_base, bytes);
 
-zcount_t zstrq_push_back_all (zstrq_t *dst, zstrq_t *src)
+    b_rehash = dst->hash_func != src->hash_func;
+    for (qidx=0; qidx<push_count; ++qidx) {
+        zsq_char_t *str = d_base + (s_ent[-qidx].off - s_ent[0].off);
+        d_ent = zsq_ent(dst, dst->numstr + qidx);
+        zsq_ent_set_str(dst, d_ent, str);
+        d_ent->len  = s_ent[-qidx].len;
+        d_ent->hash = !b_rehash ? s_ent[-qidx].hash :
+            (dst->hash_func ? dst->hash_func(str, d_ent->len) : 0);
+    }
+    dst->buf_used += bytes;
+    dst->numstr   += push_count;
+
+    return push_count;
+}
+
+zcount_t zstrq_push_back_all (zstrq_t *dst, zstrq_t *src)
 {
     zcount_t src_count = zstrq_get_str_count(src);
 
@@ -267,6 +933,696 @@ zcount_t zstrq_push_back_list(zstrq_t *dst,
     return zstrq_get_str_count(dst) - ori_count;
 }
 
+/* deletion and compaction */
+
+zcount_t zstrq_del_str(zstrq_t *sq, zqidx_t qidx)
+{
+    zsq_entry_t *ent;
+
+    if (qidx < 0 || qidx >= sq->numstr || (sq->_b_view && !sq->_b_no_term)) {
+        return 0;
+    }
+    ent = zsq_ent(sq, qidx);
+    if (ent->len & ZSQ_ENT_DEAD) {
+        return 0;
+    }
+
+    if (qidx == sq->numstr - 1) {
+        /* the tail never ends with a tombstone */
+        zstrq_pop_back(sq, 0);
+        while (sq->numstr > 0 && (zsq_ent(sq, sq->numstr - 1)->len & ZSQ_ENT_DEAD)) {
+            zstrq_pop_back(sq, 0);
+        }
+        return 1;
+    }
+
+    if (sq->intern) {
+        zsq_intern_drop(sq, qidx);
+    }
+    ent->hash = ent->len + 1;
+    ent->len  = ZSQ_ENT_DEAD;
+    sq->numdead    += 1;
+    sq->dead_bytes += ent->hash;
+    if (!sq->_b_gc || qidx < sq->gc_next) {
+        sq->dead_min = MIN(sq->dead_min, qidx);
+    }
+    return 1;
+}
+
+zcount_t zstrq_get_dead_count(zstrq_t *sq)
+{
+    return sq->numdead;
+}
+
+uint64_t zstrq_get_live_bytes(zstrq_t *sq)
+{
+    return zstrq_get_total_used(sq) - sq->dead_bytes - sq->gc_gap;
+}
+
+/** start a pass at the first deleted string, @return 0 if there's none */
+static
+int zsq_gc_start(zstrq_t *sq)
+{
+    zsq_chunk_t *c = 0;
+    zsq_char_t *p;
+
+    sq->gc_next  = MIN(MAX(sq->dead_min, 0), sq->numstr);
+    sq->dead_min = INT32_MAX;
+    if (sq->dead_bytes == 0 || sq->gc_next >= sq->numstr) {
+        return 0;
+    }
+
+    /* the strings before it are packed already */
+    p = zsq_ent_str(sq, zsq_ent(sq, sq->gc_next));
+    if (sq->chunk_size) {
+        for (c=sq->chunk; c && !(p >= c->data && p <= c->data + c->size); c=c->prev) {
+        }
+        if (!c) {
+            xerr("<zstrq> %s(): string %d out of chunks\n", __FUNCTION__, sq->gc_next);
+            return 0;
+        }
+    }
+    sq->gc_chunk = c;
+    sq->gc_woff  = (uint64_t)(p - (c ? c->data : sq->str_buf));
+    sq->gc_gap   = 0;
+    sq->_b_gc    = 1;
+    return 1;
+}
+
+/** where a string of @bytes goes, to the next chunk if it doesn't fit */
+static inline
+zsq_char_t* zsq_gc_dst(zstrq_t *sq, uint32_t bytes)
+{
+    if (!sq->chunk_size) {
+        return sq->str_buf + sq->gc_woff;
+    }
+    if (sq->gc_woff + bytes > (uint64_t)sq->gc_chunk->size) {
+        /* the string is in a later chunk then, so there is a next */
+        sq->gc_chunk->used = (zspace_t)sq->gc_woff;
+        sq->gc_chunk = sq->gc_chunk->next;
+        sq->gc_woff  = 0;
+    }
+    return sq->gc_chunk->data + sq->gc_woff;
+}
+
+/** all strings are moved: the write position is the new end */
+static
+void zsq_gc_finish(zstrq_t *sq)
+{
+    zsq_chunk_t *c, *prev;
+
+    if (sq->chunk_size) {
+        for (c=sq->chunk; c!=sq->gc_chunk; c=prev) {
+            prev = c->prev;
+            sq->total_size -= c->size;
+            free(c);
+        }
+        c->next = 0;
+        sq->chunk    = c;
+        sq->str_buf  = c->data;
+        sq->buf_size = c->size;
+        sq->chunks_used = 0;
+        for (c=c->prev; c; c=c->prev) {
+            sq->chunks_used += c->used;
+        }
+    }
+    sq->buf_used = (zcount_t)sq->gc_woff;
+    sq->gc_gap   = 0;
+    sq->_b_gc    = 0;
+}
+
+int zstrq_compact_step(zstrq_t *sq, uint32_t max_bytes, zsq_reloc_func_t func, void *ctx)
+{
+    zsq_entry_t *ent;
+    zsq_char_t *old, *dst;
+    uint64_t moved = 0;
+
+    if (sq->_b_view || sq->_b_no_term || sq->map_base || sq->_b_unpacked) {
+        return 0;
+    }
+    if (!sq->_b_gc && !zsq_gc_start(sq)) {
+        return 0;
+    }
+
+    /* entries count in the budget too, a step is bounded by either */
+    while (sq->gc_next < sq->numstr && moved <= max_bytes) {
+        ent = zsq_ent(sq, sq->gc_next);
+        if (ent->len & ZSQ_ENT_DEAD) {
+            /* keep where it would be, for pop */
+            sq->dead_bytes -= ent->hash;
+            sq->gc_gap     += ent->hash;
+            ent->hash = 0;
+            zsq_ent_set_str(sq, ent, zsq_gc_dst(sq, 0));
+        } else {
+            dst = zsq_gc_dst(sq, ent->len + 1);
+            old = zsq_ent_str(sq, ent);
+            if (dst != old) {
+                memmove(dst, old, ent->len + 1);
+                zsq_ent_set_str(sq, ent, dst);
+                if (func) {
+                    func(ctx, sq->gc_next, old, dst);
+                }
+                moved += ent->len + 1;
+            }
+            sq->gc_woff += ent->len + 1;
+        }
+        moved += sizeof(zsq_entry_t);
+        sq->gc_next += 1;
+    }
+
+    if (sq->gc_next >= sq->numstr) {
+        zsq_gc_finish(sq);
+    }
+    return sq->_b_gc;
+}
+
+uint64_t zstrq_compact(zstrq_t *sq, zsq_reloc_func_t func, void *ctx)
+{
+    uint64_t used = zstrq_get_total_used(sq);
+    int pass;
+
+    /* a running pass may have passed strings deleted since, then one more */
+    for (pass=0; pass<2; ++pass) {
+        while (zstrq_compact_step(sq, UINT32_MAX, func, ctx)) {
+        }
+    }
+    return used - zstrq_get_total_used(sq);
+}
+
+/* interning */
+
+typedef struct zsq_islot
+{
+    uint32_t    id;                 //<! ZSQ_NO_ID if empty
+    uint32_t    hash;
+}zsq_islot_t;
+
+struct zsq_intern
+{
+    zsq_islot_t    *slots;
+    uint32_t        mask;           //<! slot count - 1
+    zcount_t        count;
+    zsq_hash_func_t hash_func;
+    uint64_t        lookups;
+    uint64_t        hits;
+    uint64_t        saved_bytes;
+};
+
+uint32_t zstrq_hash(const zsq_char_t *str, uint32_t str_len)
+{
+    const zsq_char_t *end = str + str_len;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ str_len;
+    uint64_t w;
+
+    for (; end - str >= 8; str += 8) {
+        memcpy(&w, str, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    if (str < end) {
+        w = 0;
+        memcpy(&w, str, end - str);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+static
+void zsq_intern_free(zstrq_t *sq)
+{
+    if (sq->intern) {
+        SIM_FREEP(sq->intern->slots);
+        SIM_FREEP(sq->intern);
+    }
+}
+
+static
+int zsq_intern_resize(struct zsq_intern *ix, uint32_t nslot)
+{
+    zsq_islot_t *slots = malloc(sizeof(zsq_islot_t) * nslot);
+    uint32_t i, j;
+
+    if (!slots) {
+        xerr("<zstrq> intern index malloc failed\n");
+        return 0;
+    }
+    memset(slots, 0xff, sizeof(zsq_islot_t) * nslot);
+    for (i=0; ix->slots && i<=ix->mask; ++i) {
+        if (ix->slots[i].id != ZSQ_NO_ID) {
+            for (j=ix->slots[i].hash & (nslot - 1); slots[j].id != ZSQ_NO_ID; j=(j+1) & (nslot - 1)) {
+            }
+            slots[j] = ix->slots[i];
+        }
+    }
+    SIM_FREEP(ix->slots);
+    ix->slots = slots;
+    ix->mask  = nslot - 1;
+    return 1;
+}
+
+/** @return the slot of @str, or the empty slot to put it in */
+static
+uint32_t zsq_intern_probe(zstrq_t *sq, uint32_t hash, const zsq_char_t *str, uint32_t str_len)
+{
+    struct zsq_intern *ix = sq->intern;
+    uint32_t i;
+    zsq_entry_t *ent;
+
+    for (i=hash & ix->mask; ix->slots[i].id != ZSQ_NO_ID; i=(i+1) & ix->mask) {
+        if (ix->slots[i].hash == hash) {
+            ent = zsq_ent(sq, (zqidx_t)ix->slots[i].id);
+            if (ent->len == str_len && memcmp(zsq_ent_str(sq, ent), str, str_len) == 0) {
+                break;
+            }
+        }
+    }
+    return i;
+}
+
+static
+int zsq_intern_init(zstrq_t *sq)
+{
+    struct zsq_intern *ix = calloc(1, sizeof(struct zsq_intern));
+    zsq_entry_t *ent;
+    zqidx_t id;
+    uint32_t h, i;
+
+    if (!ix || !zsq_intern_resize(ix, zpow2_roundup(MAX(64, sq->numstr * 2)))) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(ix);
+        return 0;
+    }
+    ix->hash_func = sq->hash_func ? sq->hash_func : zstrq_hash;
+    sq->intern = ix;
+
+    for (id=0; id<sq->numstr; ++id) {
+        ent = zsq_ent(sq, id);
+        if (ent->len & ZSQ_ENT_DEAD) {
+            continue;
+        }
+        h = ix->hash_func(zsq_ent_str(sq, ent), ent->len);
+        i = zsq_intern_probe(sq, h, zsq_ent_str(sq, ent), ent->len);
+        if (ix->slots[i].id == ZSQ_NO_ID) {
+            ix->slots[i].id   = id;
+            ix->slots[i].hash = h;
+            ix->count += 1;
+        }
+    }
+    return 1;
+}
+
+/** remove @id from the index, with backward shift of the cluster after it */
+static
+void zsq_intern_drop(zstrq_t *sq, zqidx_t id)
+{
+    struct zsq_intern *ix = sq->intern;
+    zsq_entry_t *ent = zsq_ent(sq, id);
+    uint32_t h = ix->hash_func(zsq_ent_str(sq, ent), ent->len);
+    uint32_t i, j, home;
+
+    for (i=h & ix->mask; ix->slots[i].id != (uint32_t)id; i=(i+1) & ix->mask) {
+        if (ix->slots[i].id == ZSQ_NO_ID) {
+            return;                 /* not interned */
+        }
+    }
+    for (j=(i+1) & ix->mask; ix->slots[j].id != ZSQ_NO_ID; j=(j+1) & ix->mask) {
+        home = ix->slots[j].hash & ix->mask;
+        /* move j back to i unless its home lies cyclically in (i, j] */
+        if (((j - home) & ix->mask) >= ((j - i) & ix->mask)) {
+            ix->slots[i] = ix->slots[j];
+            i = j;
+        }
+    }
+    ix->slots[i].id = ZSQ_NO_ID;
+    ix->count -= 1;
+}
+
+static
+uint32_t zsq_intern_touch(zstrq_t *sq, const zsq_char_t *str, uint32_t str_len, 
+                          uint32_t hash, int b_insert)
+{
+    struct zsq_intern *ix = sq->intern;
+    uint32_t i = zsq_intern_probe(sq, hash, str, str_len);
+
+    ix->lookups += 1;
+    if (ix->slots[i].id != ZSQ_NO_ID) {
+        ix->hits += 1;
+        ix->saved_bytes += str_len + 1 + sizeof(zsq_entry_t);
+        return ix->slots[i].id;
+    }
+    if (!b_insert || (uint32_t)ix->count >= ix->mask) {
+        return ZSQ_NO_ID;           /* full if the last resize failed */
+    }
+    if (!zstrq_push_back_internal(sq, str, str_len, hash, 1)) {
+        return ZSQ_NO_ID;
+    }
+
+    /* keep the load <= 3/4 */
+    ix->slots[i].id   = sq->numstr - 1;
+    ix->slots[i].hash = hash;
+    ix->count += 1;
+    if ((uint64_t)ix->count * 4 > (uint64_t)(ix->mask + 1) * 3) {
+        zsq_intern_resize(ix, (ix->mask + 1) * 2);
+    }
+    return sq->numstr - 1;
+}
+
+uint32_t zstrq_intern(zstrq_t *sq, const zsq_char_t *str, uint32_t str_len)
+{
+    if (!str || (!sq->intern && !zsq_intern_init(sq))) {
+        return ZSQ_NO_ID;
+    }
+    str_len = str_len ? str_len : strlen(str);
+    return zsq_intern_touch(sq, str, str_len, sq->intern->hash_func(str, str_len), 1);
+}
+
+uint32_t zstrq_intern_find(zstrq_t *sq, const zsq_char_t *str, uint32_t str_len)
+{
+    if (!str || (!sq->intern && !zsq_intern_init(sq))) {
+        return ZSQ_NO_ID;
+    }
+    str_len = str_len ? str_len : strlen(str);
+    return zsq_intern_touch(sq, str, str_len, sq->intern->hash_func(str, str_len), 0);
+}
+
+zcount_t zstrq_intern_multi(zstrq_t *sq, const zsq_char_t **strs, 
+                            const uint32_t *lens, zcount_t count, uint32_t *ids)
+{
+    enum { ZSQ_IBATCH = 64 };
+    uint32_t hash[ZSQ_IBATCH], len[ZSQ_IBATCH];
+    zcount_t done = 0, n, i;
+    struct zsq_intern *ix;
+
+    if (!sq->intern && !zsq_intern_init(sq)) {
+        return 0;
+    }
+    ix = sq->intern;
+
+    for (; count > 0; count -= n, strs += n, ids += n, lens = lens ? lens + n : 0) {
+        n = MIN(count, ZSQ_IBATCH);
+
+        /* hash the batch first, the slots are fetched meanwhile */
+        for (i=0; i<n; ++i) {
+            len[i]  = (lens && lens[i]) ? lens[i] : (uint32_t)strlen(strs[i]);
+            hash[i] = ix->hash_func(strs[i], len[i]);
+            __builtin_prefetch(&ix->slots[hash[i] & ix->mask]);
+        }
+        for (i=0; i<n; ++i) {
+            ids[i] = zsq_intern_touch(sq, strs[i], len[i], hash[i], 1);
+            done  += ids[i] != ZSQ_NO_ID;
+            ix = sq->intern;
+        }
+    }
+    return done;
+}
+
+void zstrq_intern_stats(zstrq_t *sq, zsq_intern_stats_t *st)
+{
+    struct zsq_intern *ix = sq->intern;
+
+    memset(st, 0, sizeof(zsq_intern_stats_t));
+    st->str_bytes = zstrq_get_total_used(sq);
+    st->ent_bytes = (uint64_t)sq->numstr * sizeof(zsq_entry_t);
+    if (ix) {
+        st->unique      = ix->count;
+        st->lookups     = ix->lookups;
+        st->hits        = ix->hits;
+        st->index_bytes = sizeof(struct zsq_intern) + (uint64_t)(ix->mask + 1) * sizeof(zsq_islot_t);
+        st->saved_bytes = ix->saved_bytes;
+    }
+}
+
+
+/* sorting */
+
+#define ZSQ_SORT_SMALL      (16)
+
+typedef struct zsq_sort_item
+{
+    uint64_t            key;        //<! 8 bytes from depth, big endian
+    const uint8_t      *str;
+    uint32_t            len;
+    uint32_t            id;
+}zsq_sort_item_t;
+
+static inline
+uint64_t zsq_key_at(const uint8_t *str, uint32_t len, uint32_t depth)
+{
+    uint64_t w = 0;
+    if (depth < len) {
+        memcpy(&w, str + depth, MIN(8, len - depth));
+    }
+    return __builtin_bswap64(w);
+}
+
+/** memcmp order, then shorter first, from @depth known equal */
+static inline
+int zsq_sort_cmp(const zsq_sort_item_t *a, const zsq_sort_item_t *b, uint32_t depth)
+{
+    uint32_t n = MIN(a->len, b->len);
+    int r;
+
+    if (a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    if (n > depth + 8) {
+        r = memcmp(a->str + depth + 8, b->str + depth + 8, n - depth - 8);
+        if (r) {
+            return r;
+        }
+    }
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+static
+void zsq_sort_small(zsq_sort_item_t *it, zcount_t n, uint32_t depth)
+{
+    zsq_sort_item_t t;
+    zcount_t i, j;
+
+    for (i=1; i<n; ++i) {
+        t = it[i];
+        for (j=i; j>0 && zsq_sort_cmp(&t, &it[j-1], depth) < 0; --j) {
+            it[j] = it[j-1];
+        }
+        it[j] = t;
+    }
+}
+
+static inline
+uint64_t zsq_med3(uint64_t a, uint64_t b, uint64_t c)
+{
+    return a < b ? (b < c ? b : (a < c ? c : a)) 
+                 : (b > c ? b : (a > c ? c : a));
+}
+
+/**
+ * Multikey quicksort on 8 bytes at a time: 3-way partition by the cached
+ * key, < and > keep their keys, = goes 8 bytes deeper.
+ */
+static
+void zsq_mkqsort(zsq_sort_item_t *it, zcount_t n, uint32_t depth)
+{
+    zsq_sort_item_t t;
+    zcount_t lt, gt, i, ended;
+    uint64_t pivot;
+
+    while (n > ZSQ_SORT_SMALL) {
+        if (n > 256) {
+            zcount_t s = n / 8;
+            pivot = zsq_med3(zsq_med3(it[0].key, it[s].key, it[2*s].key),
+                             zsq_med3(it[3*s].key, it[4*s].key, it[5*s].key),
+                             zsq_med3(it[6*s].key, it[7*s].key, it[n-1].key));
+        } else {
+            pivot = zsq_med3(it[0].key, it[n/2].key, it[n-1].key);
+        }
+
+        /* [0, lt) <, [lt, i) =, [gt, n) > */
+        for (lt=0, i=0, gt=n; i<gt; ) {
+            if (it[i].key < pivot) {
+                t = it[lt]; it[lt++] = it[i]; it[i++] = t;
+            } else if (it[i].key > pivot) {
+                t = it[--gt]; it[gt] = it[i]; it[i] = t;
+            } else {
+                ++i;
+            }
+        }
+
+        if (lt < n - gt) {
+            zsq_mkqsort(it, lt, depth);
+        } else {
+            zsq_mkqsort(it + gt, n - gt, depth);
+        }
+
+        /* the = part: strings ended within the key go first, by length */
+        for (ended=lt, i=lt; i<gt; ++i) {
+            if (it[i].len <= depth + 8) {
+                t = it[ended]; it[ended++] = it[i]; it[i] = t;
+            }
+        }
+        zsq_sort_small(it + lt, ended - lt, depth);
+        if (gt - ended > 1) {
+            for (i=ended; i<gt; ++i) {
+                it[i].key = zsq_key_at(it[i].str, it[i].len, depth + 8);
+            }
+            zsq_mkqsort(it + ended, gt - ended, depth + 8);
+        }
+
+        if (lt < n - gt) {
+            it += gt;
+            n  -= gt;
+        } else {
+            n = lt;
+        }
+    }
+    zsq_sort_small(it, n, depth);
+}
+
+static
+uint32_t zsq_lcp(const uint8_t *a, uint32_t alen, const uint8_t *b, uint32_t blen)
+{
+    uint32_t n = MIN(alen, blen), i = 0;
+    uint64_t wa, wb;
+
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&wa, a + i, 8);
+        memcpy(&wb, b + i, 8);
+        if (wa != wb) {
+            return i + (__builtin_ctzll(wa ^ wb) >> 3);
+        }
+    }
+    for (; i < n && a[i] == b[i]; ++i) {
+    }
+    return i;
+}
+
+/** sorted items of the live strings, @n their count */
+static
+zsq_sort_item_t* zsq_sort_items(zstrq_t *sq, zcount_t *n)
+{
+    zsq_sort_item_t *it = malloc(sizeof(zsq_sort_item_t) * MAX(sq->numstr, 1));
+    zqidx_t i;
+
+    if (!it) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    for (i=0, *n=0; i<sq->numstr; ++i) {
+        zsq_entry_t *ent = zsq_ent(sq, i);
+        if (ent->len & ZSQ_ENT_DEAD) {
+            continue;
+        }
+        it[*n].str = (const uint8_t *)zsq_ent_str(sq, ent);
+        it[*n].len = ent->len;
+        it[*n].id  = i;
+        it[*n].key = zsq_key_at(it[*n].str, it[*n].len, 0);
+        *n += 1;
+    }
+    zsq_mkqsort(it, *n, 0);
+    return it;
+}
+
+static
+void zsq_sort_lcp(zsq_sort_item_t *it, zcount_t n, uint32_t *lcp)
+{
+    zcount_t i;
+    if (lcp && n > 0) {
+        lcp[0] = 0;
+        for (i=1; i<n; ++i) {
+            lcp[i] = zsq_lcp(it[i-1].str, it[i-1].len, it[i].str, it[i].len);
+        }
+    }
+}
+
+zcount_t zstrq_sort_perm(zstrq_t *sq, uint32_t *perm, uint32_t *lcp)
+{
+    zcount_t n;
+    zsq_sort_item_t *it = zsq_sort_items(sq, &n);
+    zqidx_t i;
+
+    if (!it) {
+        return 0;
+    }
+    for (i=0; i<n; ++i) {
+        perm[i] = it[i].id;
+    }
+    zsq_sort_lcp(it, n, lcp);
+    free(it);
+    return n;
+}
+
+zcount_t zstrq_sort(zstrq_t *sq, uint32_t *lcp)
+{
+    zsq_sort_item_t *it;
+    zsq_entry_t *ents;
+    zsq_char_t *buf = 0, *dst;
+    zcount_t n = 0;
+    zqidx_t i;
+
+    if (sq->_b_view && !sq->_b_no_term) {
+        xerr("<zstrq> %s(): an image view can't be reordered\n", __FUNCTION__);
+        return 0;
+    }
+    if (sq->numstr == 0) {
+        return 0;
+    }
+
+    it   = zsq_sort_items(sq, &n);
+    ents = malloc(sizeof(zsq_entry_t) * sq->numstr);
+    if (!sq->chunk_size && !sq->_b_no_term) {
+        buf = malloc(sq->buf_size);
+    }
+    if (!it || !ents || (!sq->chunk_size && !sq->_b_no_term && !buf)) {
+        xerr("<zstrq> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(it);
+        SIM_FREEP(ents);
+        SIM_FREEP(buf);
+        return 0;
+    }
+    zsq_sort_lcp(it, n, lcp);
+
+    for (i=0; i<n; ++i) {
+        ents[i] = *zsq_ent(sq, (zqidx_t)it[i].id);
+    }
+    if (buf) {
+        /* flat: repack the strings in sorted order, entries at the new end */
+        zsq_entry_t *top = ZSQ_ENT_TOP(buf, sq->buf_size);
+        for (dst=buf, i=0; i<n; ++i) {
+            memcpy(dst, it[i].str, ents[i].len + 1);
+            top[-i] = ents[i];
+            top[-i].off = (uint64_t)(dst - buf);
+            dst += ents[i].len + 1;
+        }
+        free(sq->str_buf);
+        sq->str_buf   = buf;
+        sq->ent_array = top;
+        sq->buf_used  = (zcount_t)(dst - buf);
+    } else {
+        /* strings stay where they are, pop can't free them any more */
+        for (i=0; i<n; ++i) {
+            *zsq_ent(sq, i) = ents[i];
+        }
+        sq->_b_unpacked = 1;
+    }
+
+    /* tombstones are dropped, a running compaction pass is moot */
+    sq->numstr     = n;
+    sq->numdead    = 0;
+    sq->dead_bytes = 0;
+    sq->dead_min   = INT32_MAX;
+    sq->gc_gap     = 0;
+    sq->_b_gc      = 0;
+
+    /* ids have changed, the index is rebuilt on the next intern */
+    zsq_intern_free(sq);
+
+    free(ents);
+    free(it);
+    return n;
+}
 
 void zstrq_print(zstrq_t *sq, char *sq_name, zsq_print_func_t func,
                 const char *delimiters, const char *terminator)
@@ -274,13 +1630,15 @@ void zstrq_print(zstrq_t *sq, char *sq_name, zsq_print_func_t func,
     zqidx_t qidx;
     zcount_t count = zstrq_get_str_count(sq);
 
-    xprint("<zstrq> %s: buf_size=%d, count=%d, buf_used=%d+%d*4+4=%d, space=%d\n", 
+    xprint("<zstrq> %s: buf_size=%d, count=%d, buf_used=%d+%d*%d+%d=%d, space=%d\n", 
         sq_name, 
         sq->buf_size, 
         count,
         sq->buf_used,
         count,
-        sq->buf_used + 4 * count + 4,
+        (int)sizeof(zsq_entry_t),
+        (int)sizeof(zsq_entry_t),
+        sq->buf_used + (int)sizeof(zsq_entry_t) * (count + 1),
         zstrq_get_buf_space(sq)
         );
 
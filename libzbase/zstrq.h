@@ -29,31 +29,181 @@ extern "C" {
 typedef     char            zsq_char_t;
 typedef     zsq_char_t*     zsq_ptr_t;
 
+typedef uint32_t (*zsq_hash_func_t)(const zsq_char_t *str, uint32_t str_len);
+
+#define     ZSQ_ENT_BLK0_LOG2   (6)
+#define     ZSQ_ENT_BLK0        (1 << ZSQ_ENT_BLK0_LOG2)
+#define     ZSQ_ENT_BLKS        (32 - ZSQ_ENT_BLK0_LOG2)
+
+/**
+ * Entries are stored backwards from the end of str_buf, ent_array[-qidx],
+ * but in blocks in chunked mode.
+ * The length excludes the terminating 0 which is always appended.
+ * In a flat str_buf the entry keeps the offset of the string, so the buf
+ * can be moved, saved and mapped back as is. Chunked mode keeps pointers.
+ */
+typedef struct z_string_entry
+{
+    union {
+        uint64_t    off;            //<! from str_buf, flat buf
+        zsq_ptr_t   str;            //<! chunked mode
+    };
+    uint32_t        len;
+    uint32_t        hash;           //<! 0 if not computed
+}zsq_entry_t;
+
+/**
+ * A deleted string keeps its entry (a tombstone) so the qidx of the others
+ * don't change: len is ZSQ_ENT_DEAD and hash holds the bytes it still takes.
+ */
+#define     ZSQ_ENT_DEAD        (0x80000000u)
+
+/**
+ * Image of a flat zstrq, as saved by zstrq_save(), native byte order:
+ *  [header][str_bytes chars][pad to 8][numstr entries, last one first]
+ */
+#define     ZSQ_IMAGE_MAGIC     "ZSTRQIM"
+#define     ZSQ_IMAGE_VERSION   (1)
+
+typedef struct z_string_image_header
+{
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        ent_size;       //<! sizeof(zsq_entry_t)
+    uint64_t        numstr;
+    uint64_t        str_bytes;
+}zsq_image_header_t;
+
+/**
+ * In chunked mode strings are put in a list of chunks which are never
+ * moved, so the saved strings keep their address until popped or freed,
+ * or moved by a compaction pass.
+ */
+typedef struct z_string_chunk
+{
+    struct z_string_chunk  *prev;
+    struct z_string_chunk  *next;
+    zspace_t        size;
+    zspace_t        used;           //<! valid when it's not the current chunk
+    zsq_char_t      data[];
+}zsq_chunk_t;
+
+struct zsq_intern;
 
 typedef struct z_string_array
 {
     zspace_t        buf_size;
     zcount_t        buf_used;
-    zsq_char_t*     str_buf;
+    zsq_char_t*     str_buf;        //<! current chunk data in chunked mode
 
     zcount_t        numstr;
-    zsq_ptr_t*      ptr_array;
+    zsq_entry_t*    ent_array;
+
+    zsq_hash_func_t hash_func;      //<! hash of pushed strings, optional
 
-    int             _b_fixed_size;
+    int             _b_fixed_size;  //<! don't grow str_buf, still writable
+    int             _b_unpacked;    //<! entries reordered, pop keeps the chars
+
+    /* chunked mode only */
+    uint32_t        chunk_size;     //<! 0 if not chunked
+    zsq_chunk_t*    chunk;          //<! current chunk
+    zsq_entry_t*    ent_blk[ZSQ_ENT_BLKS];  //<! entries, see zstrq_malloc_chunked()
+    zcount_t        ent_depth;
+    zsq_entry_t*    ent_buf;        //<! file index view: ent_array grows down from its end
+    uint64_t        total_size;     //<! size of all chunks, or of the indexed file
+    uint64_t        chunks_used;    //<! used of all chunks but the current
+
+    /* read-only image or file index view */
+    void*           map_base;       //<! to munmap, 0 if not mapped
+    size_t          map_size;
+    int             _b_view;        //<! read-only, str_buf not owned
+    int             _b_no_term;     //<! file index view, strings not 0-terminated
+
+    struct zsq_intern *intern;      //<! 0 until the first zstrq_intern()
+
+    /* deletion and compaction */
+    zcount_t        numdead;        //<! tombstones in ent_array
+    uint64_t        dead_bytes;     //<! chars still taken by deleted strings
+    zqidx_t         dead_min;       //<! first qidx deleted since the last pass
+    int             _b_gc;          //<! a compaction pass is running
+    zqidx_t         gc_next;        //<! next entry to move
+    zsq_chunk_t*    gc_chunk;       //<! where its string goes, chunked mode
+    uint64_t        gc_woff;        //<! offset in str_buf or gc_chunk
+    uint64_t        gc_gap;         //<! chars reclaimed by the running pass
 }zstrq_t;
 
 
 zstrq_t*    zstrq_malloc(uint32_t size);
+
+/**
+ * Chunked mode, strings never move (but by compaction) and there is no max size.
+ * Entries never move either, they're kept in blocks: ent_blk[0] holds
+ * qidx 0 ~ ZSQ_ENT_BLK0-1, and ent_blk[k] the next ZSQ_ENT_BLK0 << (k-1),
+ * so a push never copies the index, the room doubles with each block.
+ * @param chunk_size    0 for default, larger strings get a chunk of their own
+ */
+zstrq_t*    zstrq_malloc_chunked(uint32_t chunk_size);
+
+/**
+ * Read-only view of an @image made by zstrq_save(), nothing is copied.
+ * @image must be 8 bytes aligned and outlive the zstrq. Only the header
+ * and the size are checked, the entries are trusted.
+ * @return 0 if @image is not valid
+ */
+zstrq_t*    zstrq_open_image(const void *image, size_t size);
+
+/** map a file saved by zstrq_save() as a read-only view */
+zstrq_t*    zstrq_open_mmap(const char *path);
+
+/** @return 1 if saved, 0 if failed */
+int         zstrq_save(zstrq_t *sq, const char *path);
+
+/**
+ * Index view of a text: each line or field is an entry (offset, length)
+ * into the text, nothing is copied. The strings are NOT 0-terminated,
+ * use zstrq_get_str_size(). Hashes are 0.
+ *  -Fields are split at any char of @delims, "\n" for lines. A text
+ *   after the last delimiter is a field too, an empty one is not.
+ *  -The scan tests 16 chars at a time (SSE2) for up to 4 delimiters.
+ *  -With @n_threads > 1 (0 for the count of cpus) a large text is cut
+ *   at delimiters into ranges indexed in parallel.
+ */
+#define     ZSQ_IDX_SKIP_EMPTY  (1<<0)      //<! drop empty fields
+#define     ZSQ_IDX_STRIP_CR    (1<<1)      //<! drop a '\r' ending a field
+
+zstrq_t*    zstrq_index_buf(const zsq_char_t *buf, size_t size, const char *delims,
+                            uint32_t flags, int n_threads);
+
+/** index view of a mmap'ed file */
+zstrq_t*    zstrq_index_file(const char *path, const char *delims,
+                             uint32_t flags, int n_threads);
+
+/** no-op in chunked mode */
 zstrq_t*    zstrq_realloc(zstrq_t *sq, uint32_t new_size);
 void        zstrq_free(zstrq_t *sq);
-zspace_t    zstrq_get_buf_size(zstrq_t *sq);
+zspace_t    zstrq_get_buf_size(zstrq_t *sq);        /** of the current chunk if chunked */
 zcount_t    zstrq_get_str_count(zstrq_t *sq);       /** num of str in array */
 zspace_t    zstrq_get_buf_space(zstrq_t *sq);       /** size of usable character buf */
+uint64_t    zstrq_get_total_size(zstrq_t *sq);      /** size of all chunks */
+uint64_t    zstrq_get_total_used(zstrq_t *sq);      /** chars used, 0-terminators included */
+
+/** hash every string pushed from now on with @func, 0 to stop */
+void        zstrq_set_hash_func(zstrq_t *sq, zsq_hash_func_t func);
 
+/** 0 for a deleted string */
 zsq_char_t* zstrq_get_str_base(zstrq_t *sq, zqidx_t qidx);    //<! 0<= qidx < count
 uint32_t    zstrq_get_str_size(zstrq_t *sq, zqidx_t qidx);    //<! 0<= qidx < count
+uint32_t    zstrq_get_str_hash(zstrq_t *sq, zqidx_t qidx);    //<! 0<= qidx < count
 
+/**
+ * @param str_len   bytes of @str to copy as is, 0 for strlen(@str)
+ * @return the saved copy, 0-terminated
+ */
 zaddr_t     zstrq_push_back(zstrq_t *sq,const zsq_char_t* str, uint32_t str_len);
+
+/** push with a @hash computed by the caller, hash_func is not called */
+zaddr_t     zstrq_push_back_hashed(zstrq_t *sq, const zsq_char_t* str,
+                                   uint32_t str_len, uint32_t hash);
 zaddr_t     zstrq_pop_back(zstrq_t *sq, uint32_t *str_len);
 
 
@@ -61,6 +211,10 @@ zaddr_t     zstrq_pop_back(zstrq_t *sq, uint32_t *str_len);
 zcount_t    zstrq_push_back_v(zstrq_t *sq, zcount_t n, 
                               const zsq_char_t* cstr, ...);
 
+/**
+ * Strings of a flat (or mapped) @src are copied with one memcpy,
+ * lengths and hashes kept. Deleted strings of @src are skipped.
+ */
 zcount_t    zstrq_push_back_multi(zstrq_t *dst, zstrq_t *src, 
                                   zqidx_t src_start, 
                                   zcount_t push_count);
@@ -71,6 +225,108 @@ zcount_t    zstrq_push_back_list(zstrq_t *dst,
                                  zsq_char_t *delemiters);
 
 
+/**
+ * Interning: the string is pushed only if not in sq yet, and its qidx is
+ * returned as id, so ids are dense if sq is only fed by zstrq_intern().
+ *  -The index is an open addressing table of (id, hash), built over the
+ *   strings already in sq at the first call, the first of equal ones wins.
+ *   Strings pushed by other calls later are not indexed.
+ *  -Use zstrq_get_str_base()/zstrq_get_str_size() to get a string by id,
+ *   equal ids mean equal strings.
+ *  -zstrq_pop_back() drops the popped string from the index as well.
+ *  -hash_func is used if set, zstrq_hash() otherwise.
+ */
+#define     ZSQ_NO_ID       (0xffffffffu)
+
+typedef struct z_string_intern_stats
+{
+    zcount_t        unique;         //<! strings in the index
+    uint64_t        lookups;
+    uint64_t        hits;
+    uint64_t        str_bytes;      //<! chars in sq, 0-terminators included
+    uint64_t        ent_bytes;      //<! entries in sq
+    uint64_t        index_bytes;
+    uint64_t        saved_bytes;    //<! chars + entries not stored thanks to hits
+}zsq_intern_stats_t;
+
+uint32_t    zstrq_hash(const zsq_char_t *str, uint32_t str_len);
+
+/** @return id of @str, ZSQ_NO_ID if it can't be pushed */
+uint32_t    zstrq_intern(zstrq_t *sq, const zsq_char_t *str, uint32_t str_len);
+
+/** @return id of @str, ZSQ_NO_ID if not interned */
+uint32_t    zstrq_intern_find(zstrq_t *sq, const zsq_char_t *str, uint32_t str_len);
+
+/**
+ * Intern @count strings, hashing them all before probing the index.
+ * @param lens      0 for strlen() of each
+ * @return count of strings interned, ids of the rest are ZSQ_NO_ID
+ */
+zcount_t    zstrq_intern_multi(zstrq_t *sq, const zsq_char_t **strs, 
+                               const uint32_t *lens, zcount_t count, uint32_t *ids);
+
+void        zstrq_intern_stats(zstrq_t *sq, zsq_intern_stats_t *st);
+
+
+/**
+ * Sort in memcmp order, a prefix goes before the longer strings.
+ * Multikey quicksort over an 8-byte big endian key cached per string,
+ * so common prefixes are compared 8 bytes at a time and only once.
+ * @param lcp   optional, lcp[i] = common prefix of sorted i-1 and i, lcp[0] = 0
+ */
+
+/** @param perm  qidx of the live strings in sorted order, sq is not changed */
+zcount_t    zstrq_sort_perm(zstrq_t *sq, uint32_t *perm, uint32_t *lcp);
+
+/**
+ * Reorder sq. A flat buf is repacked in sorted order, strings of chunked
+ * mode and index views stay where they are. Image views can't be sorted.
+ * Interned ids change, deleted strings are dropped.
+ * @return count of strings sorted
+ */
+zcount_t    zstrq_sort(zstrq_t *sq, uint32_t *lcp);
+
+
+/**
+ * Deletion: the string becomes a tombstone, the qidx of the others stay.
+ * Deleting the last string pops it, with the tombstones before it.
+ * Its chars are reclaimed by the next compaction pass, or by pop.
+ * Its entry is not: it's kept until it reaches the tail or zstrq_sort()
+ * renumbers, and push never reuses it. So pushing and deleting forever
+ * still grows ent_array (the top of str_buf in flat mode) by an entry per
+ * deleted string; such a user moves the live strings to a new sq once the
+ * tombstones outnumber them, as zhash does with its keys.
+ *
+ * Compaction slides the live strings down over the dead ones, in qidx
+ * order from the first deleted; in chunked mode across chunks, and the
+ * chunks emptied at the end are freed. It runs in steps between which sq
+ * may be used as usual, so a large buffer is compacted without a long
+ * stall. Each moved string is reported to @func, e.g. for a hash table
+ * keeping its address to fix it up (a flat buf moves as a whole when it
+ * grows, so only chunked mode has stable addresses).
+ * Read-only views and chunked sq reordered by zstrq_sort() aren't compacted.
+ */
+typedef void  (*zsq_reloc_func_t)(void *ctx, zqidx_t qidx, 
+                                  const zsq_char_t *old_str, zsq_char_t *new_str);
+
+/** @return 1 if deleted, 0 if out of range, deleted already, or an image view */
+zcount_t    zstrq_del_str(zstrq_t *sq, zqidx_t qidx);
+zcount_t    zstrq_get_dead_count(zstrq_t *sq);
+uint64_t    zstrq_get_live_bytes(zstrq_t *sq);      /** used minus dead chars */
+
+/**
+ * Run a compaction pass for about @max_bytes, of chars moved plus an entry
+ * size per entry visited, at least one entry. @old_str is only the old
+ * address, the chars may be overwritten.
+ * @return 1 if the pass goes on, 0 if it's done or there's nothing to do
+ */
+int         zstrq_compact_step(zstrq_t *sq, uint32_t max_bytes,
+                               zsq_reloc_func_t func, void *ctx);
+
+/** a whole pass, @return bytes reclaimed */
+uint64_t    zstrq_compact(zstrq_t *sq, zsq_reloc_func_t func, void *ctx);
+
+
 typedef void  (*zsq_print_func_t)  (zqidx_t idx, zaddr_t elem_base);
 void        zstrq_print(zstrq_t *sq, char *sq_name, zsq_print_func_t func,
                         const char *delimiters, const char *terminator);
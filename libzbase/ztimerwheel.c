@@ -0,0 +1,257 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ztimerwheel.h"
+#include "sim_log.h"
+
+
+#define ZTW_LN_SHIFT(level)     (ZTW_L0_BITS + ((level) - 1) * ZTW_LN_BITS)
+#define ZTW_LN_SLOT(level, i)   (ZTW_L0_SIZE + ((level) - 1) * ZTW_LN_SIZE + (i))
+#define ZTW_MAX_SPAN            (0xffffffffull)
+
+static
+int ztw_nodes_grow(ztimerwheel_t *tw, uint32_t depth)
+{
+    ztw_node_t *nodes;
+    uint32_t i;
+
+    if (depth <= tw->node_depth || depth >= ZTW_NIL) {
+        xerr("<ztimerwheel> invalid depth %u\n", depth);
+        return 0;
+    }
+    nodes = realloc(tw->nodes, (size_t)depth * sizeof(ztw_node_t));
+    if (!nodes) {
+        xerr("<ztimerwheel> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+
+    /* link new nodes to the free list in index order */
+    for (i=tw->node_depth; i<depth; ++i) {
+        nodes[i].gen  = 1;
+        nodes[i].slot = ZTW_NIL;
+        nodes[i].next = (i + 1 < depth) ? i + 1 : tw->free_head;
+    }
+    tw->free_head  = tw->node_depth;
+    tw->nodes      = nodes;
+    tw->node_depth = depth;
+    return 1;
+}
+
+ztimerwheel_t* ztimerwheel_malloc(uint64_t now, uint32_t depth_hint)
+{
+    ztimerwheel_t *tw = calloc(1, sizeof(ztimerwheel_t));
+    if (!tw) {
+        xerr("<ztimerwheel> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+
+    memset(tw->slots, 0xff, sizeof(tw->slots));
+    tw->tick = now;
+    tw->free_head = ZTW_NIL;
+    if (!ztw_nodes_grow(tw, MAX(depth_hint, 64))) {
+        free(tw);
+        return 0;
+    }
+    return tw;
+}
+
+void ztimerwheel_free(ztimerwheel_t *tw)
+{
+    if (tw) {
+        SIM_FREEP(tw->nodes);
+        free(tw);
+    }
+}
+
+zcount_t ztimerwheel_get_count(ztimerwheel_t *tw)
+{
+    return tw->count;
+}
+
+static
+uint32_t ztw_slot_of(ztimerwheel_t *tw, uint64_t expire)
+{
+    uint64_t span;
+    int level;
+
+    if (expire < tw->tick) {
+        expire = tw->tick;
+    }
+    span = expire - tw->tick;
+    if (span < ZTW_L0_SIZE) {
+        return (uint32_t)(expire & (ZTW_L0_SIZE - 1));
+    }
+    if (span > ZTW_MAX_SPAN) {
+        expire = tw->tick + ZTW_MAX_SPAN;       /* park, re-filed on cascade */
+        span   = ZTW_MAX_SPAN;
+    }
+    for (level=1; level<ZTW_LEVELS-1; ++level) {
+        if (span < (1ull << ZTW_LN_SHIFT(level + 1))) {
+            break;
+        }
+    }
+    return ZTW_LN_SLOT(level, (expire >> ZTW_LN_SHIFT(level)) & (ZTW_LN_SIZE - 1));
+}
+
+static
+void ztw_link(ztimerwheel_t *tw, uint32_t idx)
+{
+    ztw_node_t *n = &tw->nodes[idx];
+    uint32_t slot = ztw_slot_of(tw, n->expire);
+    uint32_t head = tw->slots[slot];
+
+    n->slot = slot;
+    n->prev = ZTW_NIL;
+    n->next = head;
+    if (head != ZTW_NIL) {
+        tw->nodes[head].prev = idx;
+    }
+    tw->slots[slot] = idx;
+}
+
+static
+void ztw_unlink(ztimerwheel_t *tw, uint32_t idx)
+{
+    ztw_node_t *n = &tw->nodes[idx];
+
+    if (n->prev != ZTW_NIL) {
+        tw->nodes[n->prev].next = n->next;
+    } else {
+        tw->slots[n->slot] = n->next;
+    }
+    if (n->next != ZTW_NIL) {
+        tw->nodes[n->next].prev = n->prev;
+    }
+}
+
+static
+void ztw_release(ztimerwheel_t *tw, uint32_t idx)
+{
+    ztw_node_t *n = &tw->nodes[idx];
+
+    n->slot = ZTW_NIL;
+    n->gen += 1;
+    n->next = tw->free_head;
+    tw->free_head = idx;
+    tw->count -= 1;
+}
+
+ztimer_id_t ztimerwheel_schedule(ztimerwheel_t *tw, uint64_t expire, void *user)
+{
+    uint32_t idx;
+    ztw_node_t *n;
+
+    if (tw->free_head == ZTW_NIL &&
+        !ztw_nodes_grow(tw, (uint32_t)MIN(2ull * tw->node_depth, ZTW_NIL - 1))) {
+        return 0;
+    }
+
+    idx = tw->free_head;
+    n = &tw->nodes[idx];
+    tw->free_head = n->next;
+    tw->count += 1;
+
+    n->expire = expire;
+    n->user   = user;
+    ztw_link(tw, idx);
+
+    return ((ztimer_id_t)n->gen << 32) | (idx + 1);
+}
+
+zcount_t ztimerwheel_cancel(ztimerwheel_t *tw, ztimer_id_t id)
+{
+    uint32_t idx = (uint32_t)id - 1;
+
+    if (idx >= tw->node_depth || tw->nodes[idx].gen != (uint32_t)(id >> 32) ||
+        tw->nodes[idx].slot == ZTW_NIL) {
+        return 0;
+    }
+    ztw_unlink(tw, idx);
+    ztw_release(tw, idx);
+    return 1;
+}
+
+/** re-file all timers in the slot, @return @i */
+static
+uint32_t ztw_cascade(ztimerwheel_t *tw, int level, uint32_t i)
+{
+    uint32_t slot = ZTW_LN_SLOT(level, i);
+    uint32_t idx = tw->slots[slot], next;
+
+    tw->slots[slot] = ZTW_NIL;
+    for (; idx != ZTW_NIL; idx = next) {
+        next = tw->nodes[idx].next;
+        ztw_link(tw, idx);
+    }
+    return i;
+}
+
+zcount_t ztimerwheel_advance(ztimerwheel_t *tw, uint64_t now,
+                    ztw_expire_func_t func, void *ctx)
+{
+    void *users[ZTW_BATCH];
+    zcount_t fired = 0, n;
+    uint32_t idx, next;
+    int level;
+
+    while (tw->tick <= now) {
+        if (tw->count == 0) {
+            tw->tick = now + 1;             /* nothing to cascade either */
+            break;
+        }
+
+        idx = (uint32_t)(tw->tick & (ZTW_L0_SIZE - 1));
+        if (idx == 0) {
+            for (level=1; level<ZTW_LEVELS; ++level) {
+                uint32_t i = (uint32_t)(tw->tick >> ZTW_LN_SHIFT(level)) & (ZTW_LN_SIZE - 1);
+                if (ztw_cascade(tw, level, i) != 0) {
+                    break;
+                }
+            }
+        }
+
+        /* detach the slot first, timers scheduled by @func go to later ticks,
+           and unschedule all of it: @func may cancel one not fired yet */
+        next = tw->slots[idx];
+        tw->slots[idx] = ZTW_NIL;
+        tw->tick += 1;
+        for (idx=next; idx!=ZTW_NIL; idx=tw->nodes[idx].next) {
+            tw->nodes[idx].slot = ZTW_NIL;
+        }
+
+        n = 0;
+        while (next != ZTW_NIL) {
+            idx  = next;
+            next = tw->nodes[idx].next;
+            users[n++] = tw->nodes[idx].user;
+            ztw_release(tw, idx);
+            if (n == ZTW_BATCH) {
+                func(ctx, users, n);
+                fired += n;
+                n = 0;
+            }
+        }
+        if (n) {
+            func(ctx, users, n);
+            fired += n;
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,112 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief hierarchical timing wheel
+ *
+ *  -Time is counted in ticks, the unit is up to the user.
+ *  -Level 0 has 256 slots of 1 tick, level 1~4 have 64 slots each,
+ *   covering 2^14, 2^20, 2^26, 2^32 ticks ahead. Farther timers are
+ *   parked in the last level and re-filed when it comes around.
+ *  -Every time level 0 wraps, one slot of the upper level is cascaded
+ *   (re-filed) down, so each timer is moved at most 4 times.
+ *  -Slots are intrusive doubly linked lists of timer nodes, linked by
+ *   index in a node pool, so schedule and cancel are O(1).
+ *  -A timer id carries a generation, so cancel of an id that already
+ *   fired (and whose node got reused) is detected and ignored.
+ */
+
+#ifndef ZTIMERWHEEL_H_
+#define ZTIMERWHEEL_H_
+
+#include "zdefs.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+#define     ZTW_L0_BITS         (8)
+#define     ZTW_LN_BITS         (6)
+#define     ZTW_LEVELS          (5)
+#define     ZTW_L0_SIZE         (1 << ZTW_L0_BITS)
+#define     ZTW_LN_SIZE         (1 << ZTW_LN_BITS)
+#define     ZTW_SLOTS           (ZTW_L0_SIZE + (ZTW_LEVELS - 1) * ZTW_LN_SIZE)
+#define     ZTW_BATCH           (256)       //<! max timers per expire callback
+#define     ZTW_NIL             (0xffffffffu)
+
+typedef     uint64_t            ztimer_id_t;    //<! 0 is never a valid id
+
+typedef struct z_timer_node
+{
+    uint64_t    expire;
+    void       *user;
+    uint32_t    prev;
+    uint32_t    next;
+    uint32_t    gen;
+    uint32_t    slot;                   //<! ZTW_NIL if not scheduled
+}ztw_node_t;
+
+typedef struct z_timer_wheel
+{
+    uint64_t    tick;                   //<! next tick to process
+    zcount_t    count;                  //<! scheduled timers
+    uint32_t    slots[ZTW_SLOTS];       //<! list head of each slot
+
+    ztw_node_t *nodes;
+    uint32_t    node_depth;
+    uint32_t    free_head;              //<! free nodes linked by next
+}ztimerwheel_t;
+
+/**
+ * Called with up to ZTW_BATCH expired timers at once, in expire order
+ * between batches. The timers are already released, so the callback may
+ * schedule (and cancel) other timers. All timers of the tick being fired
+ * are unscheduled before the first call: cancelling one of the later
+ * batches returns 0, and it still fires.
+ */
+typedef void (*ztw_expire_func_t)(void *ctx, void **users, zcount_t count);
+
+
+/** @param now          initial tick */
+ztimerwheel_t*  ztimerwheel_malloc(uint64_t now, uint32_t depth_hint);
+void            ztimerwheel_free(ztimerwheel_t *tw);
+
+zcount_t        ztimerwheel_get_count(ztimerwheel_t *tw);
+
+/**
+ * Fire @user at tick @expire, or at the next advance if already passed.
+ * @return timer id, or 0 if out of memory
+ */
+ztimer_id_t     ztimerwheel_schedule(ztimerwheel_t *tw, uint64_t expire, void *user);
+
+/** @return 1, or 0 if @id already fired or was cancelled */
+zcount_t        ztimerwheel_cancel(ztimerwheel_t *tw, ztimer_id_t id);
+
+/**
+ * Process ticks up to @now (included), firing all timers due.
+ * @return the count of timers fired
+ */
+zcount_t        ztimerwheel_advance(ztimerwheel_t *tw, uint64_t now,
+                    ztw_expire_func_t func, void *ctx);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZTIMERWHEEL_H_
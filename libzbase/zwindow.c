@@ -0,0 +1,237 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zwindow.h"
+#include "sim_log.h"
+
+
+zwindow_t* zwindow_malloc(zcount_t max_count, int64_t max_age)
+{
+    zwindow_t *zw = calloc(1, sizeof(zwindow_t));
+    zcount_t depth = max_count > 0 ? max_count : 64;
+
+    if (!zw) {
+        xerr("<zwindow> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+
+    zw->samples = ZQUEUE_MALLOC_D(zwin_sample_t, depth);
+    zw->minq    = ZQUEUE_MALLOC_D(zwin_mono_t, MIN(depth, 64));
+    zw->maxq    = ZQUEUE_MALLOC_D(zwin_mono_t, MIN(depth, 64));
+    if (!zw->samples || !zw->minq || !zw->maxq) {
+        xerr("<zwindow> %s() failed!\n", __FUNCTION__);
+        zwindow_free(zw);
+        return 0;
+    }
+
+    zw->max_count = max_count;
+    zw->max_age   = max_age;
+    return zw;
+}
+
+void zwindow_free(zwindow_t *zw)
+{
+    if (zw) {
+        zqueue_free(zw->samples);
+        zqueue_free(zw->minq);
+        zqueue_free(zw->maxq);
+        free(zw);
+    }
+}
+
+void zwindow_clear(zwindow_t *zw)
+{
+    zw->seq_front += zqueue_get_count(zw->samples);
+    zqueue_clear(zw->samples);
+    zqueue_clear(zw->minq);
+    zqueue_clear(zw->maxq);
+    zw->sum     = 0;
+    zw->sumsq   = 0;
+    zw->anchor  = 0;
+    zw->evicted = 0;
+}
+
+/** re-sum the window around its current mean */
+static
+void zwin_reanchor(zwindow_t *zw)
+{
+    zcount_t count = zqueue_get_count(zw->samples);
+    zq_span_t span[2];
+    double sum = 0, sumsq = 0, d;
+    int s, i;
+
+    zw->anchor  = zwindow_get_mean(zw);
+    zw->evicted = 0;
+    zqueue_peek_spans(zw->samples, count, span);
+    for (s=0; s<2; ++s) {
+        zwin_sample_t *p = span[s].base;
+        for (i=0; i<span[s].count; ++i) {
+            d = p[i].v - zw->anchor;
+            sum   += d;
+            sumsq += d * d;
+        }
+    }
+    zw->sum   = sum;
+    zw->sumsq = sumsq;
+}
+
+static
+void zwin_evict_front(zwindow_t *zw)
+{
+    zwin_sample_t s;
+    zwin_mono_t  *m;
+    double d;
+
+    zqueue_pop_front(zw->samples, &s);
+    d = s.v - zw->anchor;
+    zw->sum   -= d;
+    zw->sumsq -= d * d;
+
+    m = zqueue_get_front_base(zw->minq);
+    if (m && m->seq == zw->seq_front) {
+        zqueue_pop_front(zw->minq, 0);
+    }
+    m = zqueue_get_front_base(zw->maxq);
+    if (m && m->seq == zw->seq_front) {
+        zqueue_pop_front(zw->maxq, 0);
+    }
+    zw->seq_front += 1;
+
+    if (++ zw->evicted >= MAX(zqueue_get_count(zw->samples), ZWIN_REANCHOR_MIN)) {
+        zwin_reanchor(zw);
+    }
+}
+
+static
+void zwin_push_one(zwindow_t *zw, double v, int64_t t)
+{
+    zwin_sample_t s = {v, t};
+    zwin_mono_t   m = {v, zw->seq_front + zqueue_get_count(zw->samples)};
+    zwin_mono_t  *b;
+    double d;
+
+    if (zqueue_get_count(zw->samples) == 0) {
+        zw->anchor = v;
+        zw->sum    = 0;
+        zw->sumsq  = 0;
+    }
+    zqueue_push_back(zw->samples, &s);
+
+    while ((b = zqueue_get_back_base(zw->minq)) && b->v >= v) {
+        zqueue_pop_back(zw->minq, 0);
+    }
+    zqueue_push_back(zw->minq, &m);
+    while ((b = zqueue_get_back_base(zw->maxq)) && b->v <= v) {
+        zqueue_pop_back(zw->maxq, 0);
+    }
+    zqueue_push_back(zw->maxq, &m);
+
+    d = v - zw->anchor;
+    zw->sum   += d;
+    zw->sumsq += d * d;
+}
+
+void zwindow_evict(zwindow_t *zw, int64_t now)
+{
+    zwin_sample_t *s;
+    if (zw->max_age > 0) {
+        while ((s = zqueue_get_front_base(zw->samples)) && s->t <= now - zw->max_age) {
+            zwin_evict_front(zw);
+        }
+    }
+}
+
+void zwindow_push(zwindow_t *zw, double v, int64_t t)
+{
+    if (zw->max_count > 0 && zqueue_get_count(zw->samples) >= zw->max_count) {
+        zwin_evict_front(zw);
+    }
+    zwin_push_one(zw, v, t);
+    zwindow_evict(zw, t);
+}
+
+void zwindow_push_multi(zwindow_t *zw, const double *vals, zcount_t count, int64_t t)
+{
+    zcount_t i, over;
+
+    if (count <= 0) {
+        return;
+    }
+
+    /* only the last max_count of the block would survive */
+    if (zw->max_count > 0) {
+        if (count >= zw->max_count) {
+            vals += count - zw->max_count;
+            count = zw->max_count;
+            zwindow_clear(zw);
+        } else {
+            over = zqueue_get_count(zw->samples) + count - zw->max_count;
+            for (i=0; i<over; ++i) {
+                zwin_evict_front(zw);
+            }
+        }
+    }
+
+    zqueue_buf_grow(zw->samples, count);
+    for (i=0; i<count; ++i) {
+        zwin_push_one(zw, vals[i], t);
+    }
+    zwindow_evict(zw, t);
+}
+
+zcount_t zwindow_get_count(zwindow_t *zw)
+{
+    return zqueue_get_count(zw->samples);
+}
+
+double zwindow_get_sum(zwindow_t *zw)
+{
+    return zw->sum + zw->anchor * zqueue_get_count(zw->samples);
+}
+
+double zwindow_get_min(zwindow_t *zw)
+{
+    zwin_mono_t *m = zqueue_get_front_base(zw->minq);
+    return m ? m->v : 0;
+}
+
+double zwindow_get_max(zwindow_t *zw)
+{
+    zwin_mono_t *m = zqueue_get_front_base(zw->maxq);
+    return m ? m->v : 0;
+}
+
+double zwindow_get_mean(zwindow_t *zw)
+{
+    zcount_t count = zqueue_get_count(zw->samples);
+    return count ? zw->anchor + zw->sum / count : 0;
+}
+
+double zwindow_get_var(zwindow_t *zw)
+{
+    zcount_t count = zqueue_get_count(zw->samples);
+    double   mean_d, var;
+    if (!count) {
+        return 0;
+    }
+    mean_d = zw->sum / count;
+    var = zw->sumsq / count - mean_d * mean_d;
+    return var > 0 ? var : 0;
+}
@@ -0,0 +1,105 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief sliding-window aggregates over a zqueue of samples
+ *
+ *  -Samples (value, time) are kept in a zqueue, oldest at front.
+ *   They're evicted by count (@max_count) and/or by age (@max_age).
+ *  -min/max are the fronts of two monotonic zqueues of (value, seq),
+ *   each sample is pushed and popped at most once: O(1) amortized.
+ *  -sum and sum of squares of (v - anchor) are updated on push/evict.
+ *   Once every MAX(count, ZWIN_REANCHOR_MIN) evictions the anchor is moved
+ *   to the current mean and the window is re-summed from scratch. This
+ *   clears the drift of the add/sub pairs and keeps the variance free of
+ *   cancellation, still O(1) amortized.
+ */
+
+#ifndef ZWINDOW_H_
+#define ZWINDOW_H_
+
+#include "zdefs.h"
+#include "zqueue.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+#define     ZWIN_REANCHOR_MIN   (1024)
+
+typedef struct z_win_sample
+{
+    double      v;
+    int64_t     t;
+}zwin_sample_t;
+
+typedef struct z_win_mono
+{
+    double      v;
+    uint64_t    seq;
+}zwin_mono_t;
+
+typedef struct z_window
+{
+    zqueue_t   *samples;                //<! zwin_sample_t
+    zqueue_t   *minq;                   //<! zwin_mono_t, increasing
+    zqueue_t   *maxq;                   //<! zwin_mono_t, decreasing
+
+    zcount_t    max_count;              //<! <= 0 for no count limit
+    int64_t     max_age;                //<! <= 0 for no age limit
+    uint64_t    seq_front;              //<! seq of samples[0]
+
+    double      anchor;                 //<! sums are of (v - anchor)
+    double      sum;
+    double      sumsq;
+    zcount_t    evicted;                //<! since last re-anchor
+}zwindow_t;
+
+
+/**
+ * @param max_count     keep the last @max_count samples, <= 0 no limit
+ * @param max_age       keep samples with t > newest t - @max_age, <= 0 no limit
+ */
+zwindow_t*  zwindow_malloc(zcount_t max_count, int64_t max_age);
+void        zwindow_free(zwindow_t *zw);
+void        zwindow_clear(zwindow_t *zw);
+
+/** @param t    not less than the t of the last push */
+void        zwindow_push(zwindow_t *zw, double v, int64_t t);
+
+/** push @count samples all stamped @t */
+void        zwindow_push_multi(zwindow_t *zw, const double *vals, zcount_t count, int64_t t);
+
+/** evict samples older than @now - max_age, for idle streams */
+void        zwindow_evict(zwindow_t *zw, int64_t now);
+
+zcount_t    zwindow_get_count(zwindow_t *zw);
+double      zwindow_get_sum(zwindow_t *zw);
+
+/** all 0 if the window is empty */
+double      zwindow_get_min(zwindow_t *zw);
+double      zwindow_get_max(zwindow_t *zw);
+double      zwindow_get_mean(zwindow_t *zw);
+double      zwindow_get_var(zwindow_t *zw);     //<! population variance
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZWINDOW_H_
@@ -0,0 +1,249 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zwsdeque.h"
+#include "sim_log.h"
+
+
+#define ZWSD_WORD       sizeof(atomic_uint_fast64_t)
+#define ZWSD_SLOT(a, i) \
+        ((atomic_uint_fast64_t *)ZQUEUE_ELEM_BASE((&(a)->q), (i) & ((a)->q.depth - 1)))
+
+static
+zwsarray_t* zwsd_array_malloc(uint32_t slot_size, uint32_t depth)
+{
+    zwsarray_t *a = calloc(1, sizeof(zwsarray_t));
+    if (!a || !zqueue_buf_malloc_pow2(&a->q, slot_size, depth, 0)) {
+        xerr("<zwsdeque> %s() failed!\n", __FUNCTION__);
+        SIM_FREEP(a);
+        return 0;
+    }
+    return a;
+}
+
+static
+void zwsd_array_free(zwsarray_t *a)
+{
+    if (a) {
+        zqueue_buf_free(&a->q);
+        free(a);
+    }
+}
+
+static
+void zwsd_slot_store(zwsdeque_t *wd, atomic_uint_fast64_t *slot, const char *src)
+{
+    uint32_t off;
+    for (off=0; off<wd->elem_size; off+=ZWSD_WORD, ++slot) {
+        uint_fast64_t w = 0;
+        memcpy(&w, src + off, MIN(ZWSD_WORD, wd->elem_size - off));
+        atomic_store_explicit(slot, w, memory_order_relaxed);
+    }
+}
+
+static
+void zwsd_slot_load(zwsdeque_t *wd, char *dst, atomic_uint_fast64_t *slot)
+{
+    uint32_t off;
+    for (off=0; off<wd->elem_size; off+=ZWSD_WORD, ++slot) {
+        uint_fast64_t w = atomic_load_explicit(slot, memory_order_relaxed);
+        if (dst) {
+            memcpy(dst + off, &w, MIN(ZWSD_WORD, wd->elem_size - off));
+        }
+    }
+}
+
+zwsdeque_t* zwsdeque_malloc(uint32_t elem_size, uint32_t depth)
+{
+    zwsdeque_t *wd = 0;
+    zwsarray_t *a = 0;
+    uint32_t pow2 = zpow2_roundup(MAX(depth, 2));
+
+    if (!elem_size || !pow2 || pow2 > (1u<<30)) {
+        xerr("<zwsdeque> invalid elem_size %u or depth %u\n", elem_size, depth);
+        return 0;
+    }
+
+    wd = aligned_alloc(ZCACHE_LINE_SIZE, sizeof(zwsdeque_t));
+    if (!wd) {
+        xerr("<zwsdeque> %s() failed!\n", __FUNCTION__);
+        return 0;
+    }
+    memset(wd, 0, sizeof(zwsdeque_t));
+
+    wd->elem_size = elem_size;
+    wd->slot_size = (uint32_t)((elem_size + ZWSD_WORD - 1) / ZWSD_WORD * ZWSD_WORD);
+    a = zwsd_array_malloc(wd->slot_size, pow2);
+    if (!a) {
+        free(wd);
+        return 0;
+    }
+
+    atomic_init(&wd->top, 0);
+    atomic_init(&wd->bottom, 0);
+    atomic_init(&wd->stealing, 0);
+    atomic_init(&wd->array, a);
+
+    return wd;
+}
+
+void zwsdeque_free(zwsdeque_t *wd)
+{
+    zwsarray_t *a, *next;
+    if (wd) {
+        for (a=wd->retired; a; a=next) {
+            next = a->retired_next;
+            zwsd_array_free(a);
+        }
+        zwsd_array_free(atomic_load_explicit(&wd->array, memory_order_relaxed));
+        free(wd);
+    }
+}
+
+zcount_t zwsdeque_get_depth(zwsdeque_t *wd)
+{
+    return atomic_load_explicit(&wd->array, memory_order_relaxed)->q.depth;
+}
+
+zcount_t zwsdeque_get_count(zwsdeque_t *wd)
+{
+    int64_t b = atomic_load_explicit(&wd->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&wd->top, memory_order_relaxed);
+    return b > t ? (zcount_t)(b - t) : 0;
+}
+
+void zwsdeque_reclaim(zwsdeque_t *wd)
+{
+    zwsarray_t *a, *next;
+
+    /**
+     * A thief announces itself in @stealing before it loads @array.
+     * Both sides are seq_cst, so if it's 0 here any later thief can only
+     * see the current array, not the retired ones.
+     */
+    if (!wd->retired || atomic_load_explicit(&wd->stealing, memory_order_seq_cst) != 0) {
+        return;
+    }
+    for (a=wd->retired; a; a=next) {
+        next = a->retired_next;
+        zwsd_array_free(a);
+    }
+    wd->retired = 0;
+}
+
+static
+zwsarray_t* zwsd_grow(zwsdeque_t *wd, zwsarray_t *a, int64_t t, int64_t b)
+{
+    zwsarray_t *na;
+    int64_t i;
+
+    if (a->q.depth >= (1<<30)) {
+        xerr("<zwsdeque> %s() failed, depth %d\n", __FUNCTION__, a->q.depth);
+        return 0;
+    }
+    na = zwsd_array_malloc(wd->slot_size, a->q.depth * 2);
+    if (!na) {
+        return 0;
+    }
+
+    /* only the owner writes slots, so plain copies of [t, b) are safe */
+    for (i=t; i<b; ++i) {
+        memcpy(ZWSD_SLOT(na, i), ZWSD_SLOT(a, i), wd->slot_size);
+    }
+    atomic_store_explicit(&wd->array, na, memory_order_seq_cst);
+
+    a->retired_next = wd->retired;
+    wd->retired = a;
+    zwsdeque_reclaim(wd);
+
+    return na;
+}
+
+zcount_t zwsdeque_push(zwsdeque_t *wd, const void *elem_base)
+{
+    int64_t b = atomic_load_explicit(&wd->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&wd->top, memory_order_acquire);
+    zwsarray_t *a = atomic_load_explicit(&wd->array, memory_order_relaxed);
+
+    if (b - t > a->q.depth - 1) {
+        a = zwsd_grow(wd, a, t, b);
+        if (!a) {
+            return 0;
+        }
+    }
+
+    zwsd_slot_store(wd, ZWSD_SLOT(a, b), elem_base);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+zcount_t zwsdeque_pop(zwsdeque_t *wd, void *dst_base)
+{
+    int64_t b = atomic_load_explicit(&wd->bottom, memory_order_relaxed) - 1;
+    zwsarray_t *a = atomic_load_explicit(&wd->array, memory_order_relaxed);
+    int64_t t;
+    zcount_t ret = 1;
+
+    atomic_store_explicit(&wd->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&wd->top, memory_order_relaxed);
+
+    if (t > b) {
+        /* empty */
+        atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    zwsd_slot_load(wd, dst_base, ZWSD_SLOT(a, b));
+    if (t == b) {
+        /* last elem, race with thieves */
+        if (!atomic_compare_exchange_strong_explicit(&wd->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            ret = 0;
+        }
+        atomic_store_explicit(&wd->bottom, b + 1, memory_order_relaxed);
+    }
+    return ret;
+}
+
+zcount_t zwsdeque_steal(zwsdeque_t *wd, void *dst_base)
+{
+    int64_t t = atomic_load_explicit(&wd->top, memory_order_acquire);
+    int64_t b;
+    zwsarray_t *a;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&wd->bottom, memory_order_acquire);
+    if (t >= b) {
+        return 0;
+    }
+
+    atomic_fetch_add_explicit(&wd->stealing, 1, memory_order_seq_cst);
+    a = atomic_load_explicit(&wd->array, memory_order_seq_cst);
+    zwsd_slot_load(wd, dst_base, ZWSD_SLOT(a, t));
+    atomic_fetch_sub_explicit(&wd->stealing, 1, memory_order_release);
+
+    if (!atomic_compare_exchange_strong_explicit(&wd->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return ZWSDEQUE_ABORT;
+    }
+    return 1;
+}
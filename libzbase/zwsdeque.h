@@ -0,0 +1,99 @@
+/*****************************************************************************
+ * Copyright 2014 Jeff <ggjogh@gmail.com>
+ *****************************************************************************
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*****************************************************************************/
+
+/**
+ * \brief Chase-Lev work-stealing deque
+ *
+ *  -The owner thread pushes and pops at the bottom, lock-free and CAS
+ *   free except when taking the very last elem.
+ *  -Any thread may steal from the top, one CAS per steal.
+ *  -Storage is a pow2 zqueue_t ring indexed by the free running top/bottom.
+ *   When full, the owner copies the live elems into a ring twice as big.
+ *  -The old ring may still be read by thieves. It is retired and only
+ *   freed by the owner once no steal is in flight (or on zwsdeque_free).
+ *  -Slots are copied as relaxed atomic 64-bit words, so a thief racing
+ *   with the owner reuse of a slot is well defined in C11 (the value it
+ *   read is dropped when its CAS fails).
+ *  -Memory ordering follows Le, Pop, Cohen, Zappa Nardelli,
+ *   "Correct and Efficient Work-Stealing for Weak Memory Models", 2013.
+ */
+
+#ifndef ZWSDEQUE_H_
+#define ZWSDEQUE_H_
+
+#include <stdatomic.h>
+#include "zdefs.h"
+#include "zqueue.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+typedef struct z_ws_array
+{
+    zqueue_t            q;                  //<! pow2 ring, slot_size per elem
+    struct z_ws_array  *retired_next;
+}zwsarray_t;
+
+typedef struct z_ws_deque
+{
+    uint32_t            elem_size;
+    uint32_t            slot_size;          //<! elem_size rounded up to 8
+    zwsarray_t         *retired;            //<! owner only
+
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_int_fast64_t top;                //<! next elem to steal
+    atomic_uint         stealing;           //<! steals holding an array pointer
+
+    ZALIGNED(ZCACHE_LINE_SIZE)
+    atomic_int_fast64_t bottom;             //<! next slot to push
+    _Atomic(zwsarray_t*) array;
+}zwsdeque_t;
+
+#define     ZWSDEQUE_ABORT      (-1)        //<! steal lost a race, retry
+
+
+/** @param depth    initial depth, rounded up to power of 2; grows as needed */
+zwsdeque_t* zwsdeque_malloc(uint32_t elem_size, uint32_t depth);
+#define     ZWSDEQUE_MALLOC(type_t, depth)  zwsdeque_malloc(sizeof(type_t), (depth))
+void        zwsdeque_free(zwsdeque_t *wd);
+
+zcount_t    zwsdeque_get_depth(zwsdeque_t *wd);     //<! owner only
+zcount_t    zwsdeque_get_count(zwsdeque_t *wd);     //<! snapshot, may be stale
+
+/** owner side, @return 1, or 0 if the ring failed to grow */
+zcount_t    zwsdeque_push(zwsdeque_t *wd, const void *elem_base);
+
+/** owner side, LIFO, @return 1 or 0 if empty */
+zcount_t    zwsdeque_pop(zwsdeque_t *wd, void *dst_base);
+
+/**
+ * Any thread, FIFO. @dst_base is scratch until the steal succeeds.
+ * @return 1, 0 if empty, or ZWSDEQUE_ABORT if another pop/steal won
+ */
+zcount_t    zwsdeque_steal(zwsdeque_t *wd, void *dst_base);
+
+/** owner side, free retired rings if no steal is in flight */
+void        zwsdeque_reclaim(zwsdeque_t *wd);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif //ZWSDEQUE_H_
@@ -15,15 +15,29 @@
 *****************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "zlist.h"
 //#include "zopt.h"
 #include "zarray.h"
+#include "zqueue.h"
 #include "zstrq.h"
 #include "zhash.h"
 #include "zhtree.h"
+#include "zspscq.h"
+#include "zmpmcq.h"
+#include "zbqueue.h"
+#include "zwsdeque.h"
+#include "ztimerwheel.h"
+#include "zwindow.h"
+#include "zfcstrq.h"
+#include "zacmatch.h"
 
 #include "sim_opt.h"
 
@@ -51,6 +65,14 @@ void str_printf(zqidx_t idx, zaddr_t elem_base)
     printf("%s", elem_base);
 }
 
+static
+double ztest_now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 int zlist_test(int argc, char** argv)
 {
     int item, idx;
@@ -163,6 +185,411 @@ int zarray_test(int argc, char** argv)
     return 0;
 }
 
+int zqueue_test(int argc, char** argv)
+{
+    int item, idx;
+    zaddr_t ret, popped = &item;
+
+    zqueue_t *q = ZQUEUE_MALLOC_D(int, 8);
+    for(idx=1; idx<8; ++idx)
+        zqueue_push_back(q, &idx);
+    zqueue_print(q, "init with 1~7, size=8", int_printf, ", ", "\n\n");
+
+    zqueue_pop_front(q, popped) ? printf("pop front = %d \n", DEREF_I32(popped)) : printf("pop fail \n");
+    zqueue_pop_front(q, popped) ? printf("pop front = %d \n", DEREF_I32(popped)) : printf("pop fail \n");
+    ret = zqueue_push_back(q, SET_ITEM(8));    printf("push %d %s \n", item, ret ? "success" : "fail");
+    ret = zqueue_push_back(q, SET_ITEM(9));    printf("push %d %s \n", item, ret ? "success" : "fail");
+    zqueue_print(q, "pop front 2 items, push 8,9 (wrapped)", int_printf, ", ", "\n\n");
+
+    ret = zqueue_push_back(q, SET_ITEM(10));   printf("push %d %s \n", item, ret ? "success" : "fail");
+    ret = zqueue_push_front(q, SET_ITEM(2));   printf("push front %d %s \n", item, ret ? "success" : "fail");
+    zqueue_print(q, "push 10, push front 2 (grow)", int_printf, ", ", "\n\n");
+
+    zqueue_pop_first_match(q, SET_ITEM(7), int_cmpf, popped) 
+        ? printf("pop %d = %d \n", item, DEREF_I32(popped)) 
+        : printf("pop %d failed\n", item);
+    ret = zqueue_insert_elem(q, 2, SET_ITEM(11));
+    printf("insert %d at 2 %s \n", item, ret ? "success" : "fail");
+    zqueue_print(q, "pop first match 7, insert 11 at 2", int_printf, ", ", "\n\n");
+
+    zqueue_quick_sort(q, int_cmpf);
+    zqueue_print(q, "quick sort", int_printf, ", ", "\n\n");
+
+    {
+        zq_span_t span[2];
+        int *p, n, sum = 0;
+        zqueue_consume(q, 5);
+        n = zqueue_reserve_spans(q, 5, span);
+        printf("reserve %d in spans of %d + %d\n", n, span[0].count, span[1].count);
+        for (idx=0, p=span[0].base; idx<span[0].count; ++idx) { p[idx] = 20 + idx; }
+        for (idx=0, p=span[1].base; idx<span[1].count; ++idx) { p[idx] = 20 + span[0].count + idx; }
+        zqueue_commit(q, n);
+        zqueue_print(q, "consume 5, reserve & commit 20~24", int_printf, ", ", "\n");
+
+        n = zqueue_peek_spans(q, 100, span);
+        for (idx=0, p=span[0].base; idx<span[0].count; ++idx) { sum += p[idx]; }
+        for (idx=0, p=span[1].base; idx<span[1].count; ++idx) { sum += p[idx]; }
+        printf("peek %d in spans of %d + %d, sum=%d\n\n", n, span[0].count, span[1].count, sum);
+        assert(n == 9 && sum == 9+10+11+20+21+22+23+24 + 8);
+    }
+
+    zqueue_free(q);
+
+    {
+        /* spans across the end of the buf: 8 slots, the back at slot 6 */
+        zq_span_t span[2];
+        int *p, n;
+        q = ZQUEUE_MALLOC_S(int, 8);
+        for (idx=0; idx<6; ++idx) {
+            zqueue_push_back(q, &idx);
+        }
+        zqueue_consume(q, 5);
+        n = zqueue_reserve_spans(q, 6, span);
+        assert(n == 6 && span[0].count == 2 && span[1].count == 4);
+        assert(span[0].base == ZQUEUE_ELEM_BASE(q, 6) && span[1].base == ZQUEUE_ELEM_BASE(q, 0));
+        for (idx=0, p=span[0].base; idx<span[0].count; ++idx) { p[idx] = 30 + idx; }
+        for (idx=0, p=span[1].base; idx<span[1].count; ++idx) { p[idx] = 32 + idx; }
+        assert(zqueue_commit(q, n) == 6 && zqueue_get_count(q) == 7);
+        for (idx=0; idx<7; ++idx) {
+            assert(DEREF_I32(zqueue_get_elem_base(q, idx)) == (idx ? 29 + idx : 5));
+        }
+
+        /* q[0] is at slot 5: 3 before the end, 4 after */
+        n = zqueue_peek_spans(q, 7, span);
+        assert(n == 7 && span[0].count == 3 && span[1].count == 4);
+        assert(span[0].base == ZQUEUE_ELEM_BASE(q, 5) && span[1].base == ZQUEUE_ELEM_BASE(q, 0));
+        p = span[0].base;
+        assert(p[0] == 5 && p[1] == 30 && p[2] == 31);
+        p = span[1].base;
+        assert(p[0] == 32 && p[1] == 33 && p[2] == 34 && p[3] == 35);
+        assert(zqueue_consume(q, 4) == 4 && zqueue_get_count(q) == 3);
+        for (idx=0; idx<3; ++idx) {
+            assert(DEREF_I32(zqueue_get_elem_base(q, idx)) == 33 + idx);
+        }
+        printf("reserve & peek spans across the buf end: 2 + 4, 3 + 4\n\n");
+        zqueue_free(q);
+    }
+
+    {
+        /* random ops against a plain array model, with grow & shrink */
+        static int model[1<<16];
+        int lo = 1<<15, hi = 1<<15, k, v, errors = 0;
+        for (k=0; k<2; ++k) {
+            q = k ? ZQUEUE_MALLOC_P(int, 3) : ZQUEUE_MALLOC_D(int, 3);
+            lo = hi = 1<<15;
+            for (idx=0; idx<20000; ++idx) {
+                int op = rand() % 9;
+                if (op < 3) {
+                    v = rand(); zqueue_push_back(q, &v); model[hi++] = v;
+                } else if (op < 5) {
+                    v = rand(); zqueue_push_front(q, &v); model[--lo] = v;
+                } else if (op < 7) {
+                    if (zqueue_pop_front(q, &v)) { errors += (v != model[lo++]); }
+                } else if (op < 8) {
+                    if (zqueue_pop_back(q, &v)) { errors += (v != model[--hi]); }
+                } else if (rand() % 16 == 0) {
+                    zqueue_buf_realloc(q, zqueue_get_count(q) + rand() % 4, 1);
+                }
+            }
+            errors += (zqueue_get_count(q) != hi - lo);
+            for (v=0; v<hi-lo; ++v) {
+                errors += (*(int *)zqueue_get_elem(q, v) != model[lo+v]);
+            }
+            printf("<zqueue> %s random push/pop/realloc vs model: count=%d, depth=%d, errors=%d\n", 
+                k ? "pow2" : "any ", zqueue_get_count(q), zqueue_get_depth(q), errors);
+            assert(errors == 0);
+            zqueue_free(q);
+        }
+    }
+
+    {
+        /* byte ring: records written across the wrap stay contiguous */
+        static const char rec[] = "key=value;";
+        zq_span_t span[2];
+        zqueue_t *mq = zqueue_malloc_mirror(1, 100);
+        zcount_t depth = zqueue_get_depth(mq);
+        int n;
+
+        printf("<zqueue> mirror=%d, depth=%d\n", zqueue_is_mirrored(mq), depth);
+        zqueue_commit(mq, depth - 4);
+        zqueue_consume(mq, depth - 4);
+        n = zqueue_reserve_spans(mq, sizeof(rec) - 1, span);
+        if (zqueue_is_mirrored(mq)) {
+            assert(span[1].count == 0);
+            memcpy(span[0].base, rec, n);
+            zqueue_commit(mq, n);
+            n = zqueue_peek_spans(mq, depth, span);
+            assert(span[1].count == 0 && memcmp(span[0].base, rec, n) == 0);
+            printf("record across wrap: %.*s\n\n", n, (char *)span[0].base);
+        }
+        zqueue_free(mq);
+    }
+
+    {
+        /* linearize every start/count layout, then sort & search */
+        static const int depths[] = {7, 64, 3000};
+        int errors = 0, d, start, count, i, key;
+
+        for (d=0; d<ARRAY_SIZE(depths); ++d) {
+            int depth = depths[d];
+            int step = depth > 100 ? 97 : 1;
+            zqueue_t *q = ZQUEUE_MALLOC_S(int, depth);
+            int *tmp = malloc(depth * sizeof(int));
+            for (start=0; start<depth; start+=step) {
+                for (count=0; count<=depth; count+=step) {
+                    zqueue_clear(q);
+                    zqueue_commit(q, start);
+                    zqueue_consume(q, start);
+                    for (i=0; i<count; ++i) {
+                        key = (i * 7919) % 1000;
+                        zqueue_push_back(q, &key);
+                    }
+                    zqueue_linearize(q);
+                    errors += (q->start != 0 || zqueue_get_count(q) != count);
+                    for (i=0; i<count; ++i) {
+                        errors += (((int *)q->elem_array)[i] != (i * 7919) % 1000);
+                    }
+
+                    /* re-wrap, sort, rotate back so it's wrapped, search */
+                    for (i=0; i<count/2; ++i) {
+                        zqueue_pop_front(q, &key);
+                        zqueue_push_back(q, &key);
+                    }
+                    zqueue_quick_sort(q, int_cmpf);
+                    zqueue_pop_front_multi(q, tmp, count);
+                    zqueue_clear(q);
+                    zqueue_commit(q, depth - count / 2);
+                    zqueue_consume(q, depth - count / 2);
+                    zqueue_push_back_multi(q, tmp, count);
+                    for (i=1; i<count; ++i) {
+                        errors += int_cmpf(zqueue_get_elem(q, i-1), zqueue_get_elem(q, i)) > 0;
+                    }
+                    for (key=-1; key<=1000; key+=(count ? 37 : 1001)) {
+                        zqidx_t lb = zqueue_lower_bound(q, &key, int_cmpf);
+                        zqidx_t bs = zqueue_bsearch_qidx(q, &key, int_cmpf);
+                        errors += (lb < count && *(int *)zqueue_get_elem(q, lb) < key);
+                        errors += (lb > 0 && *(int *)zqueue_get_elem(q, lb-1) >= key);
+                        errors += (bs >= 0) != (lb < count && *(int *)zqueue_get_elem(q, lb) == key);
+                    }
+                }
+            }
+            free(tmp);
+            zqueue_free(q);
+        }
+        printf("<zqueue> linearize & sort & search on wrapped layouts, errors=%d\n", errors);
+        assert(errors == 0);
+    }
+
+    return 0;
+}
+
+int zqueue_stats_test(int argc, char **argv)
+{
+    zqueue_t *q = ZQUEUE_MALLOC_S(int, 64);
+    zq_stats_t st;
+    struct timespec ts = {0, 2000000};
+    double t0, t1, t2;
+    int i, v = 0;
+
+    if (!zqueue_stats_enable(q, 1)) {
+        xprint("<zqueue> telemetry compiled out, build with: make ZQUEUE_TELEMETRY=1\n");
+        assert(zqueue_stats_snapshot(q, &st) == 0);
+        zqueue_free(q);
+        return 0;
+    }
+
+    /* counters & high-water, static queue rejects when full */
+    for (i=0; i<100; ++i) {
+        zqueue_push_back(q, &i);
+    }
+    for (i=0; i<10; ++i) {
+        zqueue_pop_front(q, &v);
+    }
+    zqueue_stats_snapshot(q, &st);
+    assert(st.pushes == 64 && st.rejects == 36 && st.pops == 10);
+    assert(st.high_water == 64 && st.count == 54 && st.lat_count == 10);
+
+    /* stamps follow middle insert/pop: the old elems waited >= 2ms */
+    nanosleep(&ts, 0);
+    zqueue_insert_elem(q, 20, &v);
+    zqueue_pop_elem(q, 20, &v);
+    assert(zqueue_stats_snapshot(q, &st) && st.lat_max < 2000000);
+    zqueue_pop_elem(q, 30, &v);
+    zqueue_pop_front_multi(q, 0, 100);
+    zqueue_stats_snapshot(q, &st);
+    assert(st.pushes == 65 && st.pops == 65 && st.count == 0);
+    assert(st.b_tsc || zq_stats_percentile(&st, 99) >= 2000000);
+    assert(zq_stats_percentile(&st, 0) <= zq_stats_percentile(&st, 50));
+    zq_stats_print(&st, "telemetry");
+
+    /* a sort restamps the queued elems as of the sort */
+    zqueue_stats_reset(q);
+    for (i=0; i<32; ++i) {
+        v = 32 - i;
+        zqueue_push_back(q, &v);
+    }
+    nanosleep(&ts, 0);
+    zqueue_quick_sort_i32(q);
+    zqueue_pop_front_multi(q, 0, 32);
+    zqueue_stats_snapshot(q, &st);
+    assert(st.lat_count == 32 && st.lat_max < 2000000);
+
+    /* hook overhead */
+    zqueue_stats_reset(q);
+    t0 = ztest_now_sec();
+    for (i=0; i<(1<<22); ++i) {
+        zqueue_push_back(q, &i);
+        zqueue_pop_front(q, &v);
+    }
+    t1 = ztest_now_sec();
+    zqueue_stats_snapshot(q, &st);
+    zqueue_stats_enable(q, 0);
+    for (i=0; i<(1<<22); ++i) {
+        zqueue_push_back(q, &i);
+        zqueue_pop_front(q, &v);
+    }
+    t2 = ztest_now_sec();
+    zq_stats_print(&st, "push+pop");
+    xprint("<zqueue> push+pop %.1f ns with telemetry, %.1f ns without\n", 
+        (t1 - t0) * 1e9 / (1<<22), (t2 - t1) * 1e9 / (1<<22));
+
+    zqueue_free(q);
+    return 0;
+}
+
+static
+void zqueue_bench_fill(zqueue_t *q, zcount_t count)
+{
+    zq_span_t span[2];
+    zcount_t  i, k;
+    int32_t  *p;
+
+    /* start near the end of buf, so the content is wrapped */
+    zqueue_clear(q);
+    zqueue_commit(q, zqueue_get_depth(q) - count / 2);
+    zqueue_consume(q, zqueue_get_count(q));
+    zqueue_reserve_spans(q, count, span);
+    for (k=0; k<2; ++k) {
+        for (i=0, p=span[k].base; i<span[k].count; ++i) {
+            p[i] = rand();
+        }
+    }
+    zqueue_commit(q, count);
+}
+
+int zqueue_bench(int argc, char** argv)
+{
+    const zcount_t count = argc > 1 ? atoi(argv[1]) : 700000;
+    const int rounds = 20;
+    zqueue_t *qs[2];
+    int k, r;
+
+    qs[0] = ZQUEUE_MALLOC_D(int32_t, count + count / 8);
+    qs[1] = ZQUEUE_MALLOC_P(int32_t, count);
+
+    for (k=0; k<2; ++k) {
+        zqueue_t *q = qs[k];
+        zq_iter_t iter = zqueue_iter(q);
+        int32_t *p, sum = 0;
+        uint32_t seed = 1;
+        double t0, t1, t2, t3;
+
+        zqueue_bench_fill(q, count);
+        t0 = ztest_now_sec();
+        for (r=0; r<rounds; ++r) {
+            for (p = zqueue_front(&iter); p; p = zqueue_next(&iter)) {
+                sum += *p;
+            }
+        }
+        t1 = ztest_now_sec();
+        for (r=0; r<rounds * count; ++r) {
+            seed = seed * 1103515245 + 12345;
+            sum += *(int32_t *)zqueue_get_elem(q, (seed >> 8) % count);
+        }
+        t2 = ztest_now_sec();
+        zqueue_quick_sort_i32(q);
+        t3 = ztest_now_sec();
+
+        for (r=1; r<count; ++r) {
+            assert(*(int32_t *)zqueue_get_elem(q, r-1) <= *(int32_t *)zqueue_get_elem(q, r));
+        }
+        xprint("<zqueue> %s depth=%-8d seq %.2f ns/elem, random %.2f ns/elem, sort_i32 %.1f ms (%d)\n",
+            zqueue_is_pow2(q) ? "pow2" : "any ", zqueue_get_depth(q),
+            (t1 - t0) * 1e9 / rounds / count, (t2 - t1) * 1e9 / rounds / count,
+            (t3 - t2) * 1e3, sum & 1);
+
+        /* generic sort on a wrapped queue */
+        zqueue_bench_fill(q, count);
+        t0 = ztest_now_sec();
+        zqueue_quick_sort(q, int_cmpf);
+        t1 = ztest_now_sec();
+        for (r=1; r<count; ++r) {
+            assert(*(int32_t *)zqueue_get_elem(q, r-1) <= *(int32_t *)zqueue_get_elem(q, r));
+        }
+        xprint("<zqueue> %s wrapped quick_sort(cmp) %.1f ms\n",
+            zqueue_is_pow2(q) ? "pow2" : "any ", (t1 - t0) * 1e3);
+
+        /* linearize & binary search on a wrapped sorted queue */
+        zqueue_consume(q, count / 3);
+        zqueue_commit(q, count / 3);
+        t0 = ztest_now_sec();
+        for (r=0; r<count; ++r) {
+            int32_t key = rand();
+            sum += zqueue_lower_bound(q, &key, int_cmpf);
+        }
+        t1 = ztest_now_sec();
+        zqueue_linearize(q);
+        t2 = ztest_now_sec();
+        xprint("<zqueue> %s wrapped lower_bound %.1f ns, linearize %.2f ms (%d)\n",
+            zqueue_is_pow2(q) ? "pow2" : "any ", (t1 - t0) * 1e9 / count, 
+            (t2 - t1) * 1e3, sum & 1);
+        zqueue_free(q);
+    }
+
+    {
+        /* wrapped growth from 1 to 8M elems */
+        zqueue_t *q = ZQUEUE_MALLOC_D(int32_t, 1);
+        double t0 = ztest_now_sec(), t1;
+        for (r=0; r<(8<<20); ++r) {
+            zqueue_push_back(q, &r);
+            if ((r & 3) == 0) {
+                zqueue_pop_front(q, 0);
+                zqueue_push_back(q, &r);
+            }
+        }
+        t1 = ztest_now_sec();
+        xprint("<zqueue> grow by push_back to count=%d depth=%d: %.2f ns/push\n", 
+            zqueue_get_count(q), zqueue_get_depth(q), (t1 - t0) * 1e9 / (r + r / 4));
+        zqueue_free(q);
+    }
+
+    return 0;
+}
+
+static
+uint32_t str_time33(const zsq_char_t *str, uint32_t len)
+{
+    uint32_t i, hash = 0;
+    for (i=0; i<len; ++i) {
+        hash = hash * 33 + str[i];
+    }
+    return hash;
+}
+
+typedef struct zstrq_test_reloc {
+    zsq_char_t    **addr;
+    int             moved;
+    int             b_bad;
+}zstrq_test_reloc_t;
+
+static
+void zstrq_test_on_reloc(void *ctx, zqidx_t qidx, const zsq_char_t *old_str, zsq_char_t *new_str)
+{
+    zstrq_test_reloc_t *rc = ctx;
+    rc->b_bad |= rc->addr[qidx] != old_str;
+    rc->addr[qidx] = new_str;
+    rc->moved += 1;
+}
 
 int zstrq_test(int argc, char** argv)
 {
@@ -191,6 +618,558 @@ int zstrq_test(int argc, char** argv)
     zstrq_free(q1);
     zstrq_free(q2);
 
+    /* stored lengths & hashes, bulk copy, growth past one page */
+    {
+        static char big[3 << 16];
+        uint32_t len = 0, i;
+        zqidx_t qidx;
+        int ok = 1;
+
+        q1 = zstrq_malloc(0);
+        q2 = zstrq_malloc(0);
+        zstrq_set_hash_func(q1, str_time33);
+        zstrq_set_hash_func(q2, str_time33);
+
+        zstrq_push_back(q1, "a\0b", 3);
+        zstrq_push_back(q1, "hello", 0);
+        zstrq_push_back(q1, "hello world", 5);
+        memset(big, 'x', sizeof(big) - 1);
+        ok &= zstrq_push_back(q1, big, 0) != 0;
+        for (i=0; i<1000; ++i) {
+            char tmp[16];
+            snprintf(tmp, sizeof(tmp), "k%u", i);
+            zstrq_push_back(q1, tmp, 0);
+        }
+        ok &= zstrq_get_str_count(q1) == 1004;
+        ok &= zstrq_get_str_size(q1, 0) == 3 && memcmp(zstrq_get_str_base(q1, 0), "a\0b", 4) == 0;
+        ok &= zstrq_get_str_size(q1, 2) == 5 && strcmp(zstrq_get_str_base(q1, 2), "hello") == 0;
+        ok &= zstrq_get_str_size(q1, 3) == sizeof(big) - 1;
+        ok &= zstrq_get_str_hash(q1, 1) == str_time33("hello", 5);
+        ok &= zstrq_get_str_hash(q1, 1) == zstrq_get_str_hash(q1, 2);
+        ok &= zstrq_get_str_base(q1, 1004) == 0;
+
+        ok &= zstrq_push_back_multi(q2, q1, 1, 1003) == 1003;
+        ok &= zstrq_push_back_multi(q2, q2, 0, 2) == 2;
+        for (qidx=0; qidx<1003; ++qidx) {
+            ok &= zstrq_get_str_size(q2, qidx) == zstrq_get_str_size(q1, qidx + 1);
+            ok &= zstrq_get_str_hash(q2, qidx) == zstrq_get_str_hash(q1, qidx + 1);
+            ok &= strcmp(zstrq_get_str_base(q2, qidx), zstrq_get_str_base(q1, qidx + 1)) == 0;
+        }
+        ok &= strcmp(zstrq_get_str_base(q2, 1004), "hello") == 0;
+
+        str = zstrq_pop_back(q1, &len);
+        ok &= len == 4 && strcmp(str, "k999") == 0;
+        str = zstrq_push_back_hashed(q1, "k999", 0, 7);
+        ok &= zstrq_get_str_hash(q1, 1003) == 7;
+
+        zstrq_free(q1);
+        zstrq_free(q2);
+        xprint("<zstrq> entry len/hash test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* chunked mode: saved strings never move */
+    {
+        static char big[300];
+        zsq_char_t *saved[2000];
+        uint64_t used = 0;
+        uint32_t len = 0;
+        int i, ok = 1;
+
+        q1 = zstrq_malloc_chunked(256);
+        q2 = zstrq_malloc(0);
+        memset(big, 'y', sizeof(big) - 1);
+        for (i=0; i<2000; ++i) {
+            char tmp[16];
+            snprintf(tmp, sizeof(tmp), "s%d", i);
+            saved[i] = zstrq_push_back(q1, (i % 500 == 7) ? big : tmp, 0);
+            ok &= saved[i] != 0;
+            used += strlen(saved[i]) + 1;
+        }
+        for (i=0; i<2000; ++i) {
+            ok &= zstrq_get_str_base(q1, i) == saved[i];
+            ok &= zstrq_get_str_size(q1, i) == strlen(saved[i]);
+        }
+        ok &= zstrq_get_total_used(q1) == used;
+        ok &= zstrq_get_total_size(q1) >= used;
+
+        /* pop across chunk borders, then push again */
+        for (i=1999; i>=1000; --i) {
+            ok &= zstrq_pop_back(q1, &len) == saved[i] && len == strlen(saved[i]);
+        }
+        for (i=1000; i<2000; ++i) {
+            saved[i] = zstrq_push_back(q1, "again", 0);
+        }
+        ok &= zstrq_get_str_count(q1) == 2000;
+        ok &= strcmp(zstrq_get_str_base(q1, 999), "s999") == 0;
+        ok &= strcmp(zstrq_get_str_base(q1, 1999), "again") == 0;
+        ok &= zstrq_get_str_base(q1, 7) == saved[7] && saved[7][298] == 'y';
+
+        ok &= zstrq_push_back_multi(q2, q1, 0, 2000) == 2000;
+        ok &= zstrq_push_back_multi(q1, q2, 0, 10) == 10;
+        ok &= zstrq_push_back_multi(q1, q1, 0, 10) == 10;
+        for (i=0; i<10; ++i) {
+            ok &= strcmp(zstrq_get_str_base(q1, 2000 + i), zstrq_get_str_base(q1, i)) == 0;
+            ok &= strcmp(zstrq_get_str_base(q1, 2010 + i), zstrq_get_str_base(q2, i)) == 0;
+        }
+        ok &= zstrq_get_str_base(q1, 0) == saved[0];
+        zstrq_free(q1);
+
+        /* entries over several blocks: read, delete, and pop back over
+           the block borders then push again */
+        q1 = zstrq_malloc_chunked(0);
+        for (i=0; i<1034; ++i) {
+            char tmp[16];
+            zstrq_push_back(q1, tmp, snprintf(tmp, sizeof(tmp), "m%d", i));
+        }
+        ok &= zstrq_del_str(q1, 20) == 1 && zstrq_del_str(q1, 500) == 1;
+        for (i=0; i<1034; ++i) {
+            char tmp[16];
+            snprintf(tmp, sizeof(tmp), "m%d", i);
+            ok &= (i == 20 || i == 500) ? zstrq_get_str_base(q1, i) == 0 :
+                  strcmp(zstrq_get_str_base(q1, i), tmp) == 0;
+        }
+        while (zstrq_get_str_count(q1) > 600) {
+            zstrq_pop_back(q1, 0);
+        }
+        for (i=600; i<3000; ++i) {
+            char tmp[16];
+            zstrq_push_back(q1, tmp, snprintf(tmp, sizeof(tmp), "n%d", i));
+        }
+        for (i=0; i<3000; ++i) {
+            char tmp[16];
+            snprintf(tmp, sizeof(tmp), i < 600 ? "m%d" : "n%d", i);
+            ok &= (i == 20 || i == 500) ? zstrq_get_str_base(q1, i) == 0 :
+                  strcmp(zstrq_get_str_base(q1, i), tmp) == 0;
+        }
+        ok &= zstrq_get_dead_count(q1) == 2;
+
+        zstrq_free(q1);
+        zstrq_free(q2);
+        xprint("<zstrq> chunked test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* save, map back, and bulk append from the mapped image */
+    {
+        const char *path = "ztest_strq.img";
+        zstrq_t *qm, *qc;
+        zqidx_t i;
+        int ok = 1;
+
+        q1 = zstrq_malloc(0);
+        qc = zstrq_malloc_chunked(128);
+        zstrq_set_hash_func(q1, str_time33);
+        zstrq_set_hash_func(qc, str_time33);
+        for (i=0; i<3000; ++i) {
+            char tmp[32];
+            snprintf(tmp, sizeof(tmp), "key-%d-%x", i, i * 2654435761u);
+            zstrq_push_back(q1, tmp, 0);
+            zstrq_push_back(qc, tmp, 0);
+        }
+        zstrq_push_back(q1, "", 0);
+        zstrq_push_back(qc, "", 0);
+
+        ok &= zstrq_save(q1, path);
+        qm = zstrq_open_mmap(path);
+        ok &= qm != 0;
+        for (i=0; qm && i<zstrq_get_str_count(q1); ++i) {
+            ok &= zstrq_get_str_size(qm, i) == zstrq_get_str_size(q1, i);
+            ok &= zstrq_get_str_hash(qm, i) == zstrq_get_str_hash(q1, i);
+            ok &= strcmp(zstrq_get_str_base(qm, i), zstrq_get_str_base(q1, i)) == 0;
+        }
+        if (qm) {
+            ok &= zstrq_get_str_count(qm) == 3001;
+            ok &= zstrq_push_back(qm, "read-only", 0) == 0;
+
+            /* the chunked one saves to the same image */
+            q2 = zstrq_malloc(0);
+            zstrq_set_hash_func(q2, str_time33);
+            zstrq_push_back(q2, "head", 0);
+            ok &= zstrq_push_back_all(q2, qm) == 3001;
+            zstrq_free(qm);
+            ok &= zstrq_save(qc, path);
+            qm = zstrq_open_mmap(path);
+            ok &= qm != 0 && zstrq_get_str_count(qm) == 3001;
+            for (i=0; qm && i<3001; ++i) {
+                ok &= strcmp(zstrq_get_str_base(qm, i), zstrq_get_str_base(q2, i + 1)) == 0;
+                ok &= zstrq_get_str_hash(qm, i) == zstrq_get_str_hash(q2, i + 1);
+            }
+            zstrq_free(qm);
+            zstrq_free(q2);
+        }
+        remove(path);
+
+        /* an owned fixed-size one is writable, it just doesn't grow */
+        q2 = zstrq_malloc(256);
+        q2->_b_fixed_size = 1;
+        for (i=0; zstrq_push_back(q2, "fixed", 0); ++i) {
+        }
+        ok &= i > 0 && zstrq_get_buf_size(q2) == 256 && zstrq_get_str_count(q2) == i;
+        ok &= zstrq_del_str(q2, 0) == 1 && strcmp(zstrq_get_str_base(q2, i - 1), "fixed") == 0;
+        zstrq_free(q2);
+
+        zstrq_free(q1);
+        zstrq_free(qc);
+        xprint("<zstrq> image test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* interning */
+    {
+        static const char *words[] = {"id", "name", "type", "size", "", "name2", "a\0b"};
+        const zsq_char_t *strs[256];
+        uint32_t ids[256], id, ref[7];
+        zsq_intern_stats_t st;
+        char last[16];
+        zstrq_t *qi;
+        double t0;
+        int i, n, ok = 1;
+
+        qi = zstrq_malloc_chunked(0);
+        for (i=0; i<6; ++i) {
+            ref[i] = zstrq_intern(qi, words[i], 0);
+            ok &= ref[i] == (uint32_t)i;
+        }
+        ref[6] = zstrq_intern(qi, words[6], 3);
+        ok &= ref[6] == 6 && zstrq_intern(qi, "a", 0) == 7;
+        for (i=0; i<1000; ++i) {
+            n = rand() % 6;
+            ok &= zstrq_intern(qi, words[n], 0) == ref[n];
+        }
+        ok &= zstrq_intern(qi, words[6], 3) == 6;
+        ok &= zstrq_get_str_count(qi) == 8;
+        ok &= zstrq_get_str_size(qi, ref[1]) == 4 && strcmp(zstrq_get_str_base(qi, ref[1]), "name") == 0;
+        ok &= zstrq_intern_find(qi, "nam", 0) == ZSQ_NO_ID && zstrq_intern_find(qi, "size", 0) == 3;
+
+        /* batch, with enough distinct strings to resize the index */
+        for (n=0; n<20; ++n) {
+            char tmp[256][16];
+            for (i=0; i<256; ++i) {
+                snprintf(tmp[i], sizeof(tmp[i]), "f%d", rand() % 3000);
+                strs[i] = tmp[i];
+            }
+            ok &= zstrq_intern_multi(qi, strs, 0, 256, ids) == 256;
+            for (i=0; i<256; ++i) {
+                ok &= strcmp(zstrq_get_str_base(qi, ids[i]), strs[i]) == 0;
+                ok &= zstrq_intern_find(qi, strs[i], 0) == ids[i];
+            }
+        }
+
+        /* pop drops it from the index */
+        id = zstrq_get_str_count(qi) - 1;
+        snprintf(last, sizeof(last), "%s", zstrq_get_str_base(qi, id));
+        zstrq_pop_back(qi, 0);
+        ok &= zstrq_intern_find(qi, last, 0) == ZSQ_NO_ID;
+        ok &= zstrq_intern(qi, last, 0) == id;
+        for (i=0; i<(int)zstrq_get_str_count(qi); ++i) {
+            ok &= zstrq_intern_find(qi, zstrq_get_str_base(qi, i), zstrq_get_str_size(qi, i)) == (uint32_t)i
+                  || zstrq_get_str_size(qi, i) == 0;
+        }
+
+        zstrq_intern_stats(qi, &st);
+        ok &= st.unique == zstrq_get_str_count(qi) && st.hits > 0 && st.saved_bytes > 0;
+        xprint("<zstrq> intern: unique=%d lookups=%llu hits=%llu str=%llu ent=%llu index=%llu saved=%llu bytes\n",
+            st.unique, (unsigned long long)st.lookups, (unsigned long long)st.hits,
+            (unsigned long long)st.str_bytes, (unsigned long long)st.ent_bytes,
+            (unsigned long long)st.index_bytes, (unsigned long long)st.saved_bytes);
+
+        t0 = ztest_now_sec();
+        for (i=0; i<(1<<20); ++i) {
+            char tmp[16];
+            snprintf(tmp, sizeof(tmp), "tag%u", (unsigned)(i * 2654435761u) % 10000);
+            zstrq_intern(qi, tmp, 0);
+        }
+        xprint("<zstrq> intern 1M strings of 10K distinct: %.1f ns/intern (snprintf included)\n",
+            (ztest_now_sec() - t0) * 1e9 / (1<<20));
+
+        zstrq_free(qi);
+        xprint("<zstrq> intern test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* line/field index views */
+    {
+        static const char *delims[] = {"\n", ",\n", ",; \t\n"};
+        const char *path = "ztest_strq.txt";
+        size_t size = 6 << 20, i;
+        char *text = malloc(size);
+        zstrq_t *qv, *qp, *qm;
+        uint32_t flags;
+        double t0;
+        int d, ok = 1;
+
+        for (i=0; i<size; ++i) {
+            text[i] = "abcdefgh,;\r\n \t"[rand() % ((i & 0xfff) < 64 ? 14 : 9)];
+        }
+        for (d=0; d<3; ++d) {
+            for (flags=0; flags<4; ++flags) {
+                size_t n = (d == 0) ? size : 5000 + flags;
+                zqidx_t qidx = 0;
+                size_t field = 0;
+
+                qv = zstrq_index_buf(text, n, delims[d], flags, 1);
+                qp = zstrq_index_buf(text, n, delims[d], flags, 4);
+                ok &= qv && qp && zstrq_get_str_count(qv) == zstrq_get_str_count(qp);
+
+                /* check against a plain split */
+                for (i=0; qv && i<=n; ++i) {
+                    if (i == n || strchr(delims[d], text[i])) {
+                        size_t len = i - field;
+                        if (i == n && len == 0) {
+                            break;
+                        }
+                        if ((flags & ZSQ_IDX_STRIP_CR) && len && text[field + len - 1] == '\r') {
+                            len -= 1;
+                        }
+                        if (len || !(flags & ZSQ_IDX_SKIP_EMPTY)) {
+                            ok &= zstrq_get_str_base(qv, qidx) == text + field;
+                            ok &= zstrq_get_str_size(qv, qidx) == len;
+                            ok &= zstrq_get_str_base(qp, qidx) == text + field;
+                            ok &= zstrq_get_str_size(qp, qidx) == len;
+                            qidx += 1;
+                        }
+                        field = i + 1;
+                    }
+                }
+                ok &= qv && qidx == zstrq_get_str_count(qv);
+                zstrq_free(qv);
+                zstrq_free(qp);
+            }
+        }
+
+        /* a file of lines, interned and saved back as 0-terminated */
+        {
+            FILE *fp = fopen(path, "wb");
+            fputs("alpha\r\nbeta\r\n\r\nalpha\r\ngamma", fp);
+            fclose(fp);
+        }
+        qv = zstrq_index_file(path, "\n", ZSQ_IDX_STRIP_CR | ZSQ_IDX_SKIP_EMPTY, 0);
+        ok &= qv && zstrq_get_str_count(qv) == 4;
+        if (qv) {
+            ok &= zstrq_get_str_size(qv, 3) == 5 && memcmp(zstrq_get_str_base(qv, 3), "gamma", 5) == 0;
+            ok &= zstrq_intern_find(qv, "alpha", 0) == 0 && zstrq_intern_find(qv, "beta", 0) == 1;
+            ok &= zstrq_push_back(qv, "x", 0) == 0;
+            ok &= zstrq_save(qv, "ztest_strq.img");
+            qm = zstrq_open_mmap("ztest_strq.img");
+            ok &= qm && strcmp(zstrq_get_str_base(qm, 1), "beta") == 0;
+            zstrq_free(qm);
+            qm = zstrq_malloc(0);
+            ok &= zstrq_push_back_all(qm, qv) == 4 && strcmp(zstrq_get_str_base(qm, 3), "gamma") == 0;
+            zstrq_free(qm);
+            zstrq_free(qv);
+        }
+        remove("ztest_strq.img");
+
+        {
+            FILE *fp = fopen(path, "wb");
+            fwrite(text, 1, size, fp);
+            fclose(fp);
+        }
+        for (d=1; d<=4; d*=4) {
+            t0 = ztest_now_sec();
+            qv = zstrq_index_file(path, "\n", 0, d);
+            t0 = ztest_now_sec() - t0;
+            xprint("<zstrq> index %zu MB file, %d thread(s): %d lines, %.2f GB/s\n",
+                size >> 20, d, qv ? zstrq_get_str_count(qv) : -1, size / t0 * 1e-9);
+            zstrq_free(qv);
+        }
+        remove(path);
+        free(text);
+
+        xprint("<zstrq> index view test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* sort, against qsort with memcmp + length */
+    {
+        int n = 5000, i, mode, ok = 1;
+        uint32_t *perm = malloc(sizeof(uint32_t) * n);
+        uint32_t *lcp  = malloc(sizeof(uint32_t) * n);
+        char *text = malloc(n * 40);
+        size_t tlen = 0;
+
+        for (mode=0; mode<3; ++mode) {
+            zstrq_t *qs = mode == 0 ? zstrq_malloc(0) : zstrq_malloc_chunked(512);
+            if (mode == 2) {
+                zstrq_free(qs);
+                qs = zstrq_index_buf(text, tlen, "\n", 0, 1);
+            }
+            for (i=0; mode < 2 && i<n; ++i) {
+                char tmp[40];
+                int len = rand() % 30, k;
+                /* long shared prefixes, some embedded 0s, some prefixes of others */
+                for (k=0; k<len; ++k) {
+                    tmp[k] = k < 12 ? "https://a.b/"[k] : "ab\0\xff/"[rand() % (k & 1 ? 5 : 2)];
+                }
+                zstrq_push_back(qs, tmp, len ? len : 0);
+                if (mode == 0) {
+                    for (k=0; k<len; ++k) {
+                        text[tlen++] = tmp[k] ? tmp[k] : '0';
+                    }
+                    text[tlen++] = '\n';
+                }
+            }
+            n = zstrq_get_str_count(qs);
+            ok &= zstrq_sort_perm(qs, perm, lcp) == n;
+            for (i=1; i<n; ++i) {
+                const zsq_char_t *a = zstrq_get_str_base(qs, perm[i-1]);
+                const zsq_char_t *b = zstrq_get_str_base(qs, perm[i]);
+                uint32_t la = zstrq_get_str_size(qs, perm[i-1]);
+                uint32_t lb = zstrq_get_str_size(qs, perm[i]);
+                uint32_t k;
+                int r = memcmp(a, b, MIN(la, lb));
+                ok &= r < 0 || (r == 0 && la <= lb);
+                for (k=0; k<MIN(la, lb) && a[k]==b[k]; ++k) {
+                }
+                ok &= lcp[i] == k;
+            }
+
+            /* reorder the table, a flat buf is repacked */
+            {
+                zstrq_t *expect = zstrq_malloc_chunked(0);
+                for (i=0; i<n; ++i) {
+                    zstrq_push_back_multi(expect, qs, perm[i], 1);
+                }
+                ok &= zstrq_sort(qs, 0) == n;
+                for (i=0; i<n; ++i) {
+                    ok &= zstrq_get_str_size(qs, i) == zstrq_get_str_size(expect, i) &&
+                          memcmp(zstrq_get_str_base(qs, i), zstrq_get_str_base(expect, i), 
+                                 zstrq_get_str_size(qs, i)) == 0;
+                }
+                zstrq_free(expect);
+            }
+            if (mode == 0) {
+                ok &= zstrq_push_back(qs, "zz", 0) && zstrq_pop_back(qs, 0) &&
+                      zstrq_get_str_count(qs) == n;
+            } else if (mode == 1) {
+                ok &= zstrq_pop_back(qs, 0) && zstrq_get_str_count(qs) == n - 1;
+            }
+            zstrq_free(qs);
+        }
+
+        free(perm);
+        free(lcp);
+        free(text);
+        xprint("<zstrq> sort test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    /* delete and compact, chunked with the addresses kept like a hash table would */
+    {
+        int cap = 60000, n = 0, round, i, k, mode, ok = 1;
+
+        for (mode=0; mode<2 && ok; ++mode) {
+            zstrq_t *qs  = mode ? zstrq_malloc_chunked(4096) : zstrq_malloc(0);
+            zstrq_t *ref = zstrq_malloc_chunked(0);
+            zsq_char_t **addr = calloc(cap, sizeof(zsq_char_t *));
+            zstrq_test_reloc_t rc = {addr, 0, 0};
+            zsq_reloc_func_t func = mode ? zstrq_test_on_reloc : 0;
+            uint64_t live, peak = 0;
+
+            for (round=0, n=0; round<40 && ok; ++round) {
+                /* push, delete a third at random, with compaction steps and pops between */
+                for (i=0; i<1000 && n<cap; ++i, ++n) {
+                    char tmp[64];
+                    int len = snprintf(tmp, sizeof(tmp), "key_%d_%.*s", n, rand() % 40,
+                                       "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopq");
+                    addr[n] = zstrq_push_back(qs, tmp, len);
+                    zstrq_push_back(ref, tmp, len);
+                    ok &= addr[n] != 0;
+                }
+                n = zstrq_get_str_count(qs);
+                for (i=0; i<n/3; ++i) {
+                    k = rand() % n;
+                    if (zstrq_get_str_base(qs, k) && (k == n - 1 || rand() % 2)) {
+                        ok &= zstrq_del_str(qs, k) == 1 && zstrq_del_str(qs, k) == 0;
+                    }
+                    if (zstrq_compact_step(qs, 256, func, &rc) == 0 && (rand() % 8) == 0) {
+                        zstrq_pop_back(qs, 0);
+                    }
+                    n = zstrq_get_str_count(qs);
+                }
+                peak = MAX(peak, zstrq_get_total_size(qs));
+
+                /* the popped tail is pushed again next round */
+                while (zstrq_get_str_count(ref) > n) {
+                    zstrq_pop_back(ref, 0);
+                }
+                live = 0;
+                for (i=0; i<n; ++i) {
+                    zsq_char_t *str = zstrq_get_str_base(qs, i);
+                    if (str) {
+                        ok &= zstrq_get_str_size(qs, i) == zstrq_get_str_size(ref, i) &&
+                              strcmp(str, zstrq_get_str_base(ref, i)) == 0;
+                        ok &= !mode || str == addr[i];
+                        live += zstrq_get_str_size(qs, i) + 1;
+                    }
+                }
+                ok &= live == zstrq_get_live_bytes(qs) && !rc.b_bad;
+                if (round % 8 == 7) {
+                    zstrq_compact(qs, func, &rc);
+                    ok &= zstrq_get_total_used(qs) == live && !rc.b_bad;
+                }
+            }
+            xprint("<zstrq> %s churn: %d strings, %d dead, %llu live bytes, size %llu (peak %llu), %d moved\n",
+                mode ? "chunked" : "flat", n, zstrq_get_dead_count(qs), 
+                (unsigned long long)zstrq_get_live_bytes(qs),
+                (unsigned long long)zstrq_get_total_size(qs), (unsigned long long)peak, rc.moved);
+
+            /* interned ids of the deleted are gone, sort drops tombstones */
+            k = zstrq_intern(qs, "interned", 0);
+            zstrq_push_back(qs, "tail", 0);
+            ok &= zstrq_del_str(qs, k) == 1 && zstrq_intern_find(qs, "interned", 0) == ZSQ_NO_ID;
+            ok &= zstrq_intern(qs, "interned", 0) == (uint32_t)zstrq_get_str_count(qs) - 1;
+            n = zstrq_get_str_count(qs) - zstrq_get_dead_count(qs);
+            ok &= zstrq_sort(qs, 0) == n && zstrq_get_str_count(qs) == n && zstrq_get_dead_count(qs) == 0;
+            for (i=0; i<n; ++i) {
+                ok &= zstrq_get_str_base(qs, i) != 0;
+            }
+            if (mode) {
+                /* reordered chunks aren't compacted */
+                ok &= zstrq_del_str(qs, 0) == 1 && zstrq_compact(qs, func, &rc) == 0;
+            }
+            zstrq_free(qs);
+
+            /* sort drops a running pass, and the chars it reclaimed so far */
+            qs = mode ? zstrq_malloc_chunked(4096) : zstrq_malloc(0);
+            for (i=0; i<100; ++i) {
+                char tmp[32];
+                zstrq_push_back(qs, tmp, snprintf(tmp, sizeof(tmp), "gap_%d", i));
+            }
+            for (i=0; i<100; i+=4) {
+                zstrq_del_str(qs, i);
+            }
+            ok &= zstrq_compact_step(qs, 200, 0, 0) == 1;
+            ok &= zstrq_sort(qs, 0) == 75;
+            live = 0;
+            for (i=0; i<75; ++i) {
+                live += zstrq_get_str_size(qs, i) + 1;
+            }
+            ok &= zstrq_get_live_bytes(qs) == zstrq_get_total_used(qs);
+            ok &= mode || zstrq_get_live_bytes(qs) == live;
+            zstrq_free(qs);
+            zstrq_free(ref);
+            free(addr);
+        }
+        xprint("<zstrq> delete & compact test %s\n", ok ? "passed" : "FAILED");
+        if (!ok) {
+            return 1;
+        }
+    }
+
     return 0;
 }
 
@@ -337,6 +1316,1614 @@ int zhtree_test(int argc, char **argv)
 }
 
 
+typedef struct zh_bench_hash {
+    const char     *name;
+    zh_hash_func_t  func;
+    uint64_t        seed;
+}zh_bench_hash_t;
+
+/** bucket stats of @count keys "key_%08d" over 2^@log2 buckets, by the low bits */
+static
+void zhash_bench_dist(const zh_bench_hash_t *hf, int count, int log2)
+{
+    uint32_t nb = 1u << log2, i, max_chain = 0, empty = 0;
+    uint32_t *chain = calloc(nb, sizeof(uint32_t));
+    double lambda = (double)count / nb, chi2 = 0;
+    char key[32];
+    int  len;
+
+    for (i=0; i<(uint32_t)count; ++i) {
+        uint64_t h64;
+        len = snprintf(key, sizeof(key), "key_%08u", i);
+        h64 = hf->func(key, len, hf->seed);
+        chain[GETLSBS(ZH_HASH_FOLD(h64), log2)] += 1;
+    }
+    for (i=0; i<nb; ++i) {
+        max_chain = MAX(max_chain, chain[i]);
+        empty    += chain[i] == 0;
+        chi2     += (chain[i] - lambda) * (chain[i] - lambda) / lambda;
+    }
+
+    /* for a uniform hash, empty ~ e^-lambda and chi2/(nb-1) ~ 1 */
+    xprint("<hashbench> %-6s %d keys in 2^%d buckets: max chain %u, empty %.4f (e^-l %.4f), "
+        "chi2/df %.3f\n", hf->name, count, log2, max_chain, (double)empty / nb,
+        exp(-lambda), chi2 / (nb - 1));
+    free(chain);
+}
+
+int zhash_bench(int argc, char **argv)
+{
+    const zh_bench_hash_t hfs[] = {
+        {"time33", zh_hash_time33, 5381},
+        {"wy64",   zh_hash_wy64,   0},
+    };
+    const int lens[] = {4, 8, 16, 32, 64, 128, 256};
+    int nkey = 4096, ok = 1, i, j, k, r;
+    uint64_t bytes = argc > 1 ? strtoull(argv[1], 0, 0) : (256u << 20);
+    char *buf = malloc(nkey * 256);
+    char key[32];
+    double t0, t1;
+    static volatile uint64_t sink;
+
+    /* full table, every key of a collision chain has to stay reachable */
+    {
+        zhash_t *h = ZHASH_MALLOC(zh_test_node_t, 4);
+        zh_test_node_t *node;
+        ok &= zhash_set_hash_func(h, zh_hash_wy64, 1);
+        for (i=0; i<16; ++i) {
+            snprintf(key, sizeof(key), "key_%08d", i);
+            ok &= zhash_set_node(h, key, 0) != 0;
+        }
+        for (i=0; i<16; ++i) {
+            snprintf(key, sizeof(key), "key_%08d", i);
+            node = zhash_get_node(h, key, 0);
+            ok &= node && strcmp(node->key, key) == 0;
+        }
+        ok &= zhash_set_hash_func(h, zh_hash_time33, 1) == 0;   /* not empty */
+        zhash_free(h);
+
+        /* fixed seed gives the same hashes, another seed other ones */
+        ok &= zh_hash_wy64("abc", 3, 7) == zh_hash_wy64("abc", 3, 7);
+        ok &= zh_hash_wy64("abc", 3, 7) != zh_hash_wy64("abc", 3, 8);
+        ok &= zh_hash_wy64("abc", 3, 7) != zh_hash_wy64("abd", 3, 7);
+        ok &= zh_hash_seed() != zh_hash_seed();
+        xprint("<hashbench> check %s\n", ok ? "ok" : "FAILED");
+    }
+
+    for (i=0; i<nkey * 256; ++i) {
+        buf[i] = (char)(rand() >> 7);
+    }
+
+    for (j=0; j<ARRAY_SIZE(lens); ++j) {
+        int len = lens[j];
+        int rounds = (int)MAX(1, bytes / ((uint64_t)nkey * len));
+        for (k=0; k<ARRAY_SIZE(hfs); ++k) {
+            uint64_t acc = 0;
+            t0 = ztest_now_sec();
+            for (r=0; r<rounds; ++r) {
+                for (i=0; i<nkey; ++i) {
+                    acc ^= hfs[k].func(buf + i * len, len, hfs[k].seed);
+                }
+            }
+            t1 = ztest_now_sec() - t0;
+            sink ^= acc;
+            xprint("<hashbench> %-6s len %3d: %6.2f ns/key, %6.2f GB/s\n", hfs[k].name,
+                len, t1 * 1e9 / ((double)rounds * nkey), (double)rounds * nkey * len / t1 / 1e9);
+        }
+    }
+
+    for (k=0; k<ARRAY_SIZE(hfs); ++k) {
+        zhash_bench_dist(&hfs[k], 1 << 16, 16);
+        zhash_bench_dist(&hfs[k], 1 << 20, 12);
+    }
+
+    free(buf);
+    return !ok;
+}
+
+
+#define ZH_BENCH_KEY_LEN    (12)
+
+/** @count keys "<c>%011u" of ZH_BENCH_KEY_LEN chars, not null ended */
+static
+char *zhash_bench_keys(char c, uint32_t count)
+{
+    char *keys = malloc((size_t)count * ZH_BENCH_KEY_LEN + 1);
+    uint32_t i;
+    for (i=0; keys && i<count; ++i) {
+        sprintf(keys + (size_t)i * ZH_BENCH_KEY_LEN, "%c%011u", c, i);
+    }
+    return keys;
+}
+
+/** insert all, then hit all and miss as many in shuffled order, @return 1 if all right */
+static
+int zhash_bench_engine(int b_open, uint32_t count, const char *keys, const char *miss,
+                    const uint32_t *order)
+{
+    uint32_t log2 = 4, i, found = 0, n;
+    zhash_t *h;
+    double t0, t1, t2, t3;
+
+    /* the same node room for both: 2^log2 (chained), 7/8 of it (open) */
+    while (((1ull << log2) - (b_open ? (1ull << log2) / 8 : 0)) < count) {
+        log2 += 1;
+    }
+    h = b_open ? ZHASH_MALLOC_OPEN(zh_test_node_t, log2) : ZHASH_MALLOC(zh_test_node_t, log2);
+    if (!h) {
+        return 0;
+    }
+
+    t0 = ztest_now_sec();
+    for (i=0; i<count; ++i) {
+        found += zhash_set_node(h, keys + (size_t)i * ZH_BENCH_KEY_LEN, ZH_BENCH_KEY_LEN) != 0;
+    }
+    t1 = ztest_now_sec();
+    for (i=0; i<count; ++i) {
+        zh_test_node_t *node = zhash_get_node(h, keys + (size_t)order[i] * ZH_BENCH_KEY_LEN,
+                                    ZH_BENCH_KEY_LEN);
+        found += node && node->key[1] == keys[(size_t)order[i] * ZH_BENCH_KEY_LEN + 1];
+    }
+    t2 = ztest_now_sec();
+    for (i=0; i<count; ++i) {
+        found += zhash_get_node(h, miss + (size_t)order[i] * ZH_BENCH_KEY_LEN,
+                                    ZH_BENCH_KEY_LEN) != 0;
+    }
+    t3 = ztest_now_sec();
+
+    {
+        zh_iter_t iter = zhash_iter(h);
+        zh_test_node_t *node;
+        n = 0;
+        for (node = zhash_iter_front(&iter); node; node = zhash_iter_next(&iter)) {
+            n += 1;
+        }
+    }
+
+    xprint("<htbench> %-7s %9u keys, 2^%u buckets, load %.3f: insert %6.1f ns, hit %6.1f ns, "
+        "miss %6.1f ns\n", b_open ? "open" : "chained", count, log2,
+        (double)count / (1u << log2), (t1 - t0) * 1e9 / count, (t2 - t1) * 1e9 / count,
+        (t3 - t2) * 1e9 / count);
+
+    zhash_free(h);
+    return found == 2 * count && n == count;
+}
+
+/** grow a 2^2 table to @count keys, all of them stay reachable while it rehashes */
+static
+int zhash_grow_check(int b_open, uint32_t count)
+{
+    zhash_t *h = b_open ? ZHASH_MALLOC_OPEN(zh_test_node_t, 2) : ZHASH_MALLOC(zh_test_node_t, 2);
+    zh_iter_t iter = zhash_iter(h);
+    zh_test_node_t *node;
+    uint32_t i, n = 0, rehashing = 0;
+    int ok = 1;
+    char key[32];
+
+    for (i=0; i<count; ++i) {
+        snprintf(key, sizeof(key), "key_%u", i);
+        node = zhash_set_node(h, key, 0);
+        ok &= node && strcmp(node->key, key) == 0;
+        rehashing += zhash_is_rehashing(h);
+        snprintf(key, sizeof(key), "key_%u", i / 2);
+        node = zhash_get_node(h, key, 0);
+        ok &= node && strcmp(node->key, key) == 0;
+    }
+    for (i=0; i<count; ++i) {
+        snprintf(key, sizeof(key), "key_%u", i);
+        node = zhash_get_node(h, key, 0);
+        ok &= node && strcmp(node->key, key) == 0;
+    }
+    ok &= zhash_get_node(h, "key_x", 0) == 0;
+    ok &= zhash_get_count(h) == (zcount_t)count && rehashing > 0;
+
+    WHILE_ZHASH_ITER_PREORDER(iter, node) {
+        n += 1;
+    }
+    WHILE_ZHASH_ITER_POSTORDER(iter, node) {
+        n += 1;
+    }
+    ok &= n == 2 * count;
+
+    zhash_free(h);
+    return ok;
+}
+
+int zhash_engine_bench(int argc, char **argv)
+{
+    uint32_t counts[8] = {1000000, 10000000}, i, j, k;
+    int ncount = 2, ok = 1;
+
+    /* from the smallest table, through many rehashes */
+    ok &= zhash_grow_check(0, 5000);
+    ok &= zhash_grow_check(1, 5000);
+
+    if (argc > 1) {
+        for (ncount=0; ncount+1<argc && ncount<ARRAY_SIZE(counts); ++ncount) {
+            counts[ncount] = (uint32_t)strtoul(argv[ncount+1], 0, 0);
+        }
+    }
+
+    for (k=0; k<(uint32_t)ncount; ++k) {
+        uint32_t count = counts[k];
+        char     *keys  = zhash_bench_keys('k', count);
+        char     *miss  = zhash_bench_keys('m', count);
+        uint32_t *order = malloc((size_t)count * sizeof(uint32_t));
+
+        if (!keys || !miss || !order) {
+            xerr("<htbench> no memory for %u keys\n", count);
+            ok = 0;
+        } else {
+            for (i=0; i<count; ++i) {
+                order[i] = i;
+            }
+            for (i=count-1; i>0; --i) {
+                j = (uint32_t)(((uint64_t)rand() * RAND_MAX + rand()) % (i + 1));
+                uint32_t t = order[i];
+                order[i] = order[j];
+                order[j] = t;
+            }
+            ok &= zhash_bench_engine(0, count, keys, miss, order);
+            ok &= zhash_bench_engine(1, count, keys, miss, order);
+        }
+        free(keys);
+        free(miss);
+        free(order);
+    }
+
+    xprint("<htbench> check %s\n", ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+
+/** per-op latency, log2 ns histogram */
+typedef struct zh_lat_hist {
+    uint64_t    n[32];
+    double      max;
+}zh_lat_hist_t;
+
+static
+void zh_lat_add(zh_lat_hist_t *lh, double sec)
+{
+    uint64_t ns = (uint64_t)(sec * 1e9);
+    lh->n[MIN(63 - __builtin_clzll(ns | 1), 31)] += 1;
+    lh->max = MAX(lh->max, sec);
+}
+
+/** upper bound of the histogram bin holding quantile @q */
+static
+double zh_lat_quantile(const zh_lat_hist_t *lh, uint64_t total, double q)
+{
+    uint64_t acc = 0;
+    int i;
+    for (i=0; i<32; ++i) {
+        acc += lh->n[i];
+        if (acc >= q * total) {
+            break;
+        }
+    }
+    return (double)(2ull << i);
+}
+
+static
+void zh_lat_print(const char *name, const zh_lat_hist_t *lh, uint64_t total)
+{
+    xprint("<rehash> %-8s %llu ops: p50 < %.0f ns, p99.9 < %.0f ns, p99.999 < %.0f ns, "
+        "max %.1f us\n", name, (unsigned long long)total, zh_lat_quantile(lh, total, 0.5),
+        zh_lat_quantile(lh, total, 0.999), zh_lat_quantile(lh, total, 0.99999), lh->max * 1e6);
+}
+
+/**
+ * Grow from 2^4 buckets to @count keys and time each insert, the tail is
+ * a few buckets of moves, not a pass over the table. zhtree keys go under
+ * 64 parents. All keys are looked up after. The "clock" line times an
+ * empty body: its max is the floor from the clock and the scheduler.
+ */
+int zhash_rehash_test(int argc, char **argv)
+{
+    uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], 0, 0) : 4000000;
+    uint32_t i;
+    int ok = 1, b_open;
+    char key[32];
+    double t0;
+
+    {
+        zh_lat_hist_t lh = {{0}, 0};
+        for (i=0; i<count; ++i) {
+            t0 = ztest_now_sec();
+            zh_lat_add(&lh, ztest_now_sec() - t0);
+        }
+        zh_lat_print("clock", &lh, count);
+    }
+
+    for (b_open=0; b_open<2; ++b_open) {
+        zhash_t *h = b_open ? ZHASH_MALLOC_OPEN(zh_test_node_t, 4) : ZHASH_MALLOC(zh_test_node_t, 4);
+        zh_lat_hist_t lh = {{0}, 0};
+        zh_test_node_t *node;
+
+        for (i=0; i<count; ++i) {
+            int len = snprintf(key, sizeof(key), "key_%u", i);
+            t0 = ztest_now_sec();
+            node = zhash_set_node(h, key, len);
+            zh_lat_add(&lh, ztest_now_sec() - t0);
+            ok &= node != 0;
+        }
+        for (i=0; i<count; ++i) {
+            int len = snprintf(key, sizeof(key), "key_%u", i);
+            node = zhash_get_node(h, key, len);
+            ok &= node && node->key_len == (uint32_t)len;
+        }
+        ok &= zhash_get_count(h) == (zcount_t)count;
+        zh_lat_print(b_open ? "open" : "chained", &lh, count);
+        zhash_free(h);
+    }
+
+    {
+        zhtree_t *h = zhtree_malloc(sizeof(zht_node_t), 4);
+        zht_node_t *dirs[64], *node;
+        zh_lat_hist_t lh = {{0}, 0};
+
+        for (i=0; i<64; ++i) {
+            snprintf(key, sizeof(key), "dir%u", i);
+            dirs[i] = zhtree_touch_child(h, zhtree_get_root(h), key, 0);
+            ok &= dirs[i] != 0;
+        }
+        for (i=0; i<count; ++i) {
+            int len = snprintf(key, sizeof(key), "%u", i / 64);
+            t0 = ztest_now_sec();
+            node = zhtree_touch_child(h, dirs[i % 64], key, len);
+            zh_lat_add(&lh, ztest_now_sec() - t0);
+            ok &= node && node->parent == dirs[i % 64];
+        }
+        for (i=0; i<count; ++i) {
+            int len = snprintf(key, sizeof(key), "%u", i / 64);
+            node = zhtree_get_child(h, dirs[i % 64], key, len);
+            ok &= node && node->parent == dirs[i % 64] && node->key_len == (uint32_t)len;
+        }
+        ok &= zhtree_get_count(h) == (zcount_t)count + 65;
+        zh_lat_print("zhtree", &lh, count);
+        zhtree_free(h);
+    }
+
+    xprint("<rehash> check %s\n", ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+
+/** delete half, delete while iterating, and churn with a fixed live set */
+static
+int zhash_del_check(int b_open, uint32_t count, uint32_t churn)
+{
+    zhash_t *h = b_open ? ZHASH_MALLOC_OPEN(zh_test_node_t, 2) : ZHASH_MALLOC(zh_test_node_t, 2);
+    zh_iter_t iter = zhash_iter(h);
+    zh_test_node_t *node, other;
+    uint32_t i, n = 0, live = 1000, depth0;
+    uint64_t peak_used = 0, used;
+    zcount_t peak_dead = 0;
+    int ok = 1;
+    char key[32];
+
+    for (i=0; i<count; ++i) {
+        snprintf(key, sizeof(key), "key_%u", i);
+        ok &= zhash_set_node(h, key, 0) != 0;
+    }
+    for (i=0; i<count; i+=2) {
+        snprintf(key, sizeof(key), "key_%u", i);
+        ok &= zhash_del_key(h, key, 0) == 1;
+        ok &= zhash_del_key(h, key, 0) == 0;
+    }
+    for (i=0; i<count; ++i) {
+        snprintf(key, sizeof(key), "key_%u", i);
+        node = zhash_get_node(h, key, 0);
+        ok &= (i & 1) ? node && strcmp(node->key, key) == 0 : node == 0;
+    }
+    ok &= zhash_get_count(h) == (zcount_t)(count / 2);
+    WHILE_ZHASH_ITER_PREORDER(iter, node) {
+        n += 1;
+    }
+    WHILE_ZHASH_ITER_POSTORDER(iter, node) {
+        n += 1;
+    }
+    ok &= n == count / 2 * 2;
+
+    memset(&other, 0, sizeof(other));
+    other.key = "key_1";
+    ok &= zhash_del_node(h, &other) == 0;
+
+    /* the iterators skip the deleted node */
+    n = 0;
+    WHILE_ZHASH_ITER_PREORDER(iter, node) {
+        ok &= zhash_del_node(h, node) == 1;
+        n += 1;
+    }
+    ok &= n == count / 2 && zhash_get_count(h) == 0 && zhash_iter_front(&iter) == 0;
+
+    /* churn: node room doesn't grow, keys stay bounded by the live set */
+    depth0 = b_open ? h->depth : (uint32_t)zh_nodeq_depth(h->nodeq, h->nodeq_ext);
+    for (i=0; i<churn; ++i) {
+        snprintf(key, sizeof(key), "churn_%u", i);
+        ok &= zhash_set_node(h, key, 0) != 0;
+        if (i >= live) {
+            snprintf(key, sizeof(key), "churn_%u", i - live);
+            ok &= zhash_del_key(h, key, 0) == 1;
+        }
+        if (i > churn / 2) {
+            used = zstrq_get_total_used(h->strq);
+            used += h->old_strq ? zstrq_get_total_used(h->old_strq) : 0;
+            peak_used = MAX(peak_used, used);
+            peak_dead = MAX(peak_dead, zstrq_get_dead_count(h->strq));
+        }
+    }
+    for (i=churn-live; i<churn; ++i) {
+        snprintf(key, sizeof(key), "churn_%u", i);
+        node = zhash_get_node(h, key, 0);
+        ok &= node && strcmp(node->key, key) == 0;
+    }
+    ok &= zhash_get_count(h) == (zcount_t)live;
+    ok &= peak_used < live * 16 * 4 && peak_dead <= (zcount_t)live * 2;
+    ok &= depth0 == (b_open ? h->depth : (uint32_t)zh_nodeq_depth(h->nodeq, h->nodeq_ext));
+
+    xprint("<hashdel> %-7s count %u, churn %u: depth %u, key bytes peak %llu, dead keys peak %d for %u live\n",
+        b_open ? "open" : "chained", count, churn, h->depth, (unsigned long long)peak_used,
+        peak_dead, live);
+    zhash_free(h);
+    return ok;
+}
+
+int zhash_del_test(int argc, char **argv)
+{
+    uint32_t churn = argc > 1 ? (uint32_t)strtoul(argv[1], 0, 0) : 1000000;
+    int ok = 1;
+
+    ok &= zhash_del_check(0, 20000, churn);
+    ok &= zhash_del_check(1, 20000, churn);
+    xprint("<hashdel> check %s\n", ok ? "ok" : "FAILED");
+    return !ok;
+}
+
+
+typedef struct spscq_test_ctx {
+    zspscq_t   *sq;
+    uint64_t    total;
+    int         batch;
+    uint64_t    errors;
+    atomic_int  b_done;                 //<! set by the consumer at the end
+}spscq_test_ctx_t;
+
+static
+void *spscq_producer(void *arg)
+{
+    spscq_test_ctx_t *ctx = arg;
+    uint64_t buf[256];
+    uint64_t next = 0;
+    int i, n;
+
+    while (next < ctx->total) {
+        if (ctx->batch <= 1) {
+            n = zspscq_push(ctx->sq, &next);
+        } else {
+            n = (int)MIN((uint64_t)ctx->batch, ctx->total - next);
+            for (i=0; i<n; ++i) {
+                buf[i] = next + i;
+            }
+            n = zspscq_push_multi(ctx->sq, buf, n);
+        }
+        next += n;
+        if (!n) {
+            sched_yield();      /* full */
+        }
+    }
+    return 0;
+}
+
+static
+void *spscq_consumer(void *arg)
+{
+    spscq_test_ctx_t *ctx = arg;
+    uint64_t buf[256];
+    uint64_t expect = 0;
+    int i, n;
+
+    while (expect < ctx->total) {
+        if (ctx->batch <= 1) {
+            n = zspscq_pop(ctx->sq, buf);
+        } else {
+            n = zspscq_pop_multi(ctx->sq, buf, ctx->batch);
+        }
+        for (i=0; i<n; ++i) {
+            ctx->errors += (buf[i] != expect + i);
+        }
+        expect += n;
+        if (!n) {
+            sched_yield();      /* empty */
+        }
+    }
+    atomic_store(&ctx->b_done, 1);
+    return 0;
+}
+
+int zspscq_test(int argc, char **argv)
+{
+    static const int batches[] = {1, 16, 256};
+    uint64_t total = argc > 1 ? strtoull(argv[1], 0, 0) : (1<<24);
+    uint64_t buf[8] = {0};
+    int i, errors = 0;
+
+    /* single thread sanity: wrap around and full/empty */
+    zspscq_t *sq = ZSPSCQ_MALLOC(uint64_t, 5);
+    assert(sq && zspscq_get_depth(sq) == 8);
+    for (i=0; i<20; ++i) {
+        uint64_t v = i;
+        assert(zspscq_push(sq, &v) == 1);
+        assert(zspscq_pop(sq, buf) == 1 && buf[0] == v);
+    }
+    for (i=0; i<8; ++i) {
+        buf[i] = 100 + i;
+    }
+    assert(zspscq_push_multi(sq, buf, 8) == 8);
+    assert(zspscq_push(sq, buf) == 0);
+    assert(zspscq_pop_multi(sq, buf, 8) == 8 && buf[7] == 107);
+    assert(zspscq_pop(sq, buf) == 0);
+    zspscq_free(sq);
+
+    for (i=0; i<ARRAY_SIZE(batches); ++i) {
+        pthread_t prod, cons;
+        spscq_test_ctx_t ctx = {0};
+        double t0, t1;
+
+        ctx.sq = ZSPSCQ_MALLOC(uint64_t, 4096);
+        ctx.total = total;
+        ctx.batch = batches[i];
+
+        t0 = ztest_now_sec();
+        pthread_create(&cons, 0, spscq_consumer, &ctx);
+        pthread_create(&prod, 0, spscq_producer, &ctx);
+        pthread_join(prod, 0);
+        pthread_join(cons, 0);
+        t1 = ztest_now_sec();
+
+        xprint("<zspscq> batch=%-3d %llu elems, %.1f M/s, errors=%llu\n", 
+            ctx.batch, (unsigned long long)total, 
+            total / (t1 - t0) / 1e6, (unsigned long long)ctx.errors);
+        errors += (ctx.errors != 0);
+        zspscq_free(ctx.sq);
+    }
+
+    /* a third thread reading the count races both ends */
+    {
+        pthread_t prod, cons;
+        spscq_test_ctx_t ctx = {0};
+        uint64_t bad = 0;
+        zcount_t c;
+
+        ctx.sq = ZSPSCQ_MALLOC(uint64_t, 64);
+        ctx.total = 1<<20;
+        ctx.batch = 16;
+        pthread_create(&cons, 0, spscq_consumer, &ctx);
+        pthread_create(&prod, 0, spscq_producer, &ctx);
+        while (!atomic_load(&ctx.b_done)) {
+            c = zspscq_get_count(ctx.sq);
+            bad += (c < 0 || c > zspscq_get_depth(ctx.sq));
+        }
+        pthread_join(prod, 0);
+        pthread_join(cons, 0);
+        xprint("<zspscq> count read while pushing & popping, out of range %llu\n",
+            (unsigned long long)bad);
+        errors += (ctx.errors != 0 || bad != 0);
+        zspscq_free(ctx.sq);
+    }
+
+    return errors;
+}
+
+typedef struct mpmcq_test_ctx {
+    zmpmcq_t       *mq;
+    zqueue_t       *q;              //<! mutex + zqueue baseline if not 0
+    pthread_mutex_t lock;
+    uint64_t        per_thread;
+    atomic_uint_fast64_t next_id;
+    atomic_uint_fast64_t sum;
+}mpmcq_test_ctx_t;
+
+static
+zcount_t mpmcq_locked_try(mpmcq_test_ctx_t *ctx, uint64_t *v, int b_push)
+{
+    zcount_t ret;
+    pthread_mutex_lock(&ctx->lock);
+    ret = b_push ? (zqueue_push_back(ctx->q, v) != 0) : zqueue_pop_front(ctx->q, v);
+    pthread_mutex_unlock(&ctx->lock);
+    return ret;
+}
+
+static
+void *mpmcq_producer(void *arg)
+{
+    mpmcq_test_ctx_t *ctx = arg;
+    uint64_t id = atomic_fetch_add(&ctx->next_id, 1);
+    uint64_t i, v;
+
+    for (i=0; i<ctx->per_thread; ++i) {
+        v = id * ctx->per_thread + i;
+        if (ctx->q) {
+            while (!mpmcq_locked_try(ctx, &v, 1)) {
+                sched_yield();
+            }
+        } else {
+            zmpmcq_push(ctx->mq, &v);
+        }
+    }
+    return 0;
+}
+
+static
+void *mpmcq_consumer(void *arg)
+{
+    mpmcq_test_ctx_t *ctx = arg;
+    uint64_t i, v, sum = 0;
+
+    for (i=0; i<ctx->per_thread; ++i) {
+        if (ctx->q) {
+            while (!mpmcq_locked_try(ctx, &v, 0)) {
+                sched_yield();
+            }
+        } else {
+            zmpmcq_pop(ctx->mq, &v);
+        }
+        sum += v;
+    }
+    atomic_fetch_add(&ctx->sum, sum);
+    return 0;
+}
+
+int zmpmcq_test(int argc, char **argv)
+{
+    static const int nthreads[] = {1, 2, 4, 8, 16, 32};
+    uint64_t total = argc > 1 ? strtoull(argv[1], 0, 0) : (1<<20);
+    uint64_t v = 0;
+    int i, k, b_locked, errors = 0;
+
+    zmpmcq_t *mq = ZMPMCQ_MALLOC(uint64_t, 3);
+    assert(mq && zmpmcq_get_depth(mq) == 4);
+    for (i=0; i<4; ++i) {
+        v = i;
+        assert(zmpmcq_try_push(mq, &v) == 1);
+    }
+    assert(zmpmcq_try_push(mq, &v) == 0 && zmpmcq_get_count(mq) == 4);
+    for (i=0; i<4; ++i) {
+        assert(zmpmcq_try_pop(mq, &v) == 1 && v == i);
+    }
+    assert(zmpmcq_try_pop(mq, &v) == 0);
+    zmpmcq_free(mq);
+
+    xprint("<zmpmcq> %llu elems, P producers + P consumers, depth 1024\n", 
+        (unsigned long long)total);
+    for (b_locked=0; b_locked<2; ++b_locked) {
+        for (i=0; i<ARRAY_SIZE(nthreads); ++i) {
+            pthread_t th[2*32];
+            mpmcq_test_ctx_t ctx;
+            int n = nthreads[i];
+            uint64_t all, expect;
+            double t0, t1;
+
+            memset(&ctx, 0, sizeof(ctx));
+            ctx.per_thread = total / n;
+            all = ctx.per_thread * n;
+            expect = all * (all - 1) / 2;
+            if (b_locked) {
+                ctx.q = ZQUEUE_MALLOC_S(uint64_t, 1024);
+                pthread_mutex_init(&ctx.lock, 0);
+            } else {
+                ctx.mq = ZMPMCQ_MALLOC(uint64_t, 1024);
+            }
+
+            t0 = ztest_now_sec();
+            for (k=0; k<n; ++k) {
+                pthread_create(&th[k], 0, mpmcq_consumer, &ctx);
+                pthread_create(&th[n+k], 0, mpmcq_producer, &ctx);
+            }
+            for (k=0; k<2*n; ++k) {
+                pthread_join(th[k], 0);
+            }
+            t1 = ztest_now_sec();
+
+            xprint("<zmpmcq> %-12s P=%-2d %.2f M/s %s\n", 
+                b_locked ? "mutex+zqueue" : "lock-free", n, all / (t1 - t0) / 1e6,
+                atomic_load(&ctx.sum) == expect ? "ok" : "CHECKSUM MISMATCH");
+            errors += (atomic_load(&ctx.sum) != expect);
+
+            if (b_locked) {
+                pthread_mutex_destroy(&ctx.lock);
+                zqueue_free(ctx.q);
+            } else {
+                zmpmcq_free(ctx.mq);
+            }
+        }
+    }
+
+    return errors;
+}
+
+typedef struct bqueue_test_ctx {
+    zbqueue_t      *bq;
+    uint64_t        per_thread;
+    atomic_uint_fast64_t next_id;
+    atomic_uint_fast64_t popped;
+    atomic_uint_fast64_t sum;
+}bqueue_test_ctx_t;
+
+static
+void *bqueue_producer(void *arg)
+{
+    bqueue_test_ctx_t *ctx = arg;
+    uint64_t id = atomic_fetch_add(&ctx->next_id, 1);
+    uint64_t buf[32];
+    uint64_t i = 0;
+    int k, n;
+
+    while (i < ctx->per_thread) {
+        n = (int)MIN(ARRAY_SIZE(buf), ctx->per_thread - i);
+        for (k=0; k<n; ++k) {
+            buf[k] = id * ctx->per_thread + i + k;
+        }
+        i += zbqueue_push_multi(ctx->bq, buf, n, -1);
+    }
+    return 0;
+}
+
+static
+void *bqueue_consumer(void *arg)
+{
+    bqueue_test_ctx_t *ctx = arg;
+    uint64_t buf[16];
+    uint64_t sum = 0, cnt = 0;
+    int k, n;
+
+    while ((n = zbqueue_pop_multi(ctx->bq, buf, ARRAY_SIZE(buf), -1)) > 0) {
+        for (k=0; k<n; ++k) {
+            sum += buf[k];
+        }
+        cnt += n;
+    }
+    atomic_fetch_add(&ctx->sum, sum);
+    atomic_fetch_add(&ctx->popped, cnt);
+    return 0;
+}
+
+int zbqueue_test(int argc, char **argv)
+{
+    uint64_t total = argc > 1 ? strtoull(argv[1], 0, 0) : (1<<20);
+    const int n = 4;
+    pthread_t th[2*4];
+    bqueue_test_ctx_t ctx;
+    uint64_t v = 7, all, expect;
+    double t0, t1;
+    int k;
+
+    zbqueue_t *bq = ZBQUEUE_MALLOC(uint64_t, 2);
+    t0 = ztest_now_sec();
+    assert(zbqueue_pop_timed(bq, &v, 20) == 0);
+    t1 = ztest_now_sec();
+    assert(t1 - t0 >= 0.015);
+    assert(zbqueue_push_timed(bq, &v, 0) == 1);
+    assert(zbqueue_push_timed(bq, &v, 0) == 1);
+    assert(zbqueue_push_timed(bq, &v, 10) == 0);
+    zbqueue_close(bq);
+    assert(zbqueue_push(bq, &v) == 0 && !zbqueue_is_drained(bq));
+    assert(zbqueue_pop(bq, &v) == 1 && zbqueue_pop(bq, &v) == 1);
+    assert(zbqueue_pop(bq, &v) == 0 && zbqueue_is_drained(bq));
+    zbqueue_free(bq);
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.bq = ZBQUEUE_MALLOC(uint64_t, 256);
+    ctx.per_thread = total / n;
+    all = ctx.per_thread * n;
+    expect = all * (all - 1) / 2;
+
+    t0 = ztest_now_sec();
+    for (k=0; k<n; ++k) {
+        pthread_create(&th[k], 0, bqueue_consumer, &ctx);
+        pthread_create(&th[n+k], 0, bqueue_producer, &ctx);
+    }
+    for (k=0; k<n; ++k) {
+        pthread_join(th[n+k], 0);
+    }
+    zbqueue_close(ctx.bq);
+    for (k=0; k<n; ++k) {
+        pthread_join(th[k], 0);
+    }
+    t1 = ztest_now_sec();
+
+    xprint("<zbqueue> %d producers + %d consumers, %llu elems, %.2f M/s %s\n", 
+        n, n, (unsigned long long)all, all / (t1 - t0) / 1e6,
+        (atomic_load(&ctx.sum) == expect && atomic_load(&ctx.popped) == all) 
+            ? "ok" : "CHECKSUM MISMATCH");
+    zbqueue_free(ctx.bq);
+
+    return atomic_load(&ctx.sum) != expect;
+}
+
+typedef struct wsdeque_test_ctx {
+    zwsdeque_t     *wd;
+    uint64_t        total;
+    atomic_uchar   *seen;           //<! seen[id] times taken
+    atomic_int      b_done;         //<! owner finished pushing & popping
+    atomic_uint_fast64_t taken;
+    atomic_uint_fast64_t stolen;
+    atomic_uint_fast64_t aborts;
+}wsdeque_test_ctx_t;
+
+static
+void *wsdeque_thief(void *arg)
+{
+    wsdeque_test_ctx_t *ctx = arg;
+    uint64_t v, stolen = 0, aborts = 0;
+    zcount_t ret;
+
+    for (;;) {
+        ret = zwsdeque_steal(ctx->wd, &v);
+        if (ret == 1) {
+            atomic_fetch_add(&ctx->seen[v], 1);
+            ++ stolen;
+        } else if (ret == ZWSDEQUE_ABORT) {
+            ++ aborts;
+        } else if (atomic_load(&ctx->b_done)) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&ctx->stolen, stolen);
+    atomic_fetch_add(&ctx->taken, stolen);
+    atomic_fetch_add(&ctx->aborts, aborts);
+    return 0;
+}
+
+int zwsdeque_test(int argc, char **argv)
+{
+    typedef struct { int32_t a, b, c; } elem12_t;
+    uint64_t total = argc > 1 ? strtoull(argv[1], 0, 0) : (1<<20);
+    const int n = 3;
+    pthread_t th[3];
+    wsdeque_test_ctx_t ctx;
+    uint64_t i, v, popped = 0, dups = 0;
+    elem12_t e;
+    double t0, t1;
+    int k;
+
+    /* non word sized elems, growth from depth 2 */
+    zwsdeque_t *wd = ZWSDEQUE_MALLOC(elem12_t, 1);
+    assert(wd && zwsdeque_get_depth(wd) == 2);
+    for (k=0; k<100; ++k) {
+        e.a = k; e.b = -k; e.c = k * 3;
+        assert(zwsdeque_push(wd, &e) == 1);
+    }
+    assert(zwsdeque_get_count(wd) == 100 && zwsdeque_get_depth(wd) == 128);
+    assert(zwsdeque_pop(wd, &e) == 1 && e.a == 99 && e.b == -99 && e.c == 297);
+    assert(zwsdeque_steal(wd, &e) == 1 && e.a == 0 && e.b == 0);
+    assert(zwsdeque_steal(wd, &e) == 1 && e.a == 1 && e.c == 3);
+    for (k=98; k>=2; --k) {
+        assert(zwsdeque_pop(wd, &e) == 1 && e.a == k);
+    }
+    assert(zwsdeque_pop(wd, &e) == 0 && zwsdeque_steal(wd, &e) == 0);
+    assert(wd->retired == 0);
+    zwsdeque_free(wd);
+
+    /* owner pushes & pops, thieves steal, each id must be taken once */
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.wd = ZWSDEQUE_MALLOC(uint64_t, 16);
+    ctx.total = total;
+    ctx.seen = calloc(total, sizeof(atomic_uchar));
+
+    t0 = ztest_now_sec();
+    for (k=0; k<n; ++k) {
+        pthread_create(&th[k], 0, wsdeque_thief, &ctx);
+    }
+    for (i=0; i<total; ++i) {
+        zwsdeque_push(ctx.wd, &i);
+        if ((i % 3) == 2 && zwsdeque_pop(ctx.wd, &v)) {
+            atomic_fetch_add(&ctx.seen[v], 1);
+            ++ popped;
+        }
+    }
+    while (zwsdeque_pop(ctx.wd, &v)) {
+        atomic_fetch_add(&ctx.seen[v], 1);
+        ++ popped;
+    }
+    atomic_store(&ctx.b_done, 1);
+    for (k=0; k<n; ++k) {
+        pthread_join(th[k], 0);
+    }
+    t1 = ztest_now_sec();
+    atomic_fetch_add(&ctx.taken, popped);
+
+    for (i=0; i<total; ++i) {
+        dups += (atomic_load(&ctx.seen[i]) != 1);
+    }
+    xprint("<zwsdeque> 1 owner + %d thieves, %llu elems, %.2f M/s, popped %llu, stolen %llu, "
+        "aborts %llu, depth %d %s\n", 
+        n, (unsigned long long)total, total / (t1 - t0) / 1e6, 
+        (unsigned long long)popped, (unsigned long long)atomic_load(&ctx.stolen), 
+        (unsigned long long)atomic_load(&ctx.aborts), zwsdeque_get_depth(ctx.wd),
+        (dups == 0 && atomic_load(&ctx.taken) == total) ? "ok" : "LOST/DUPLICATED ELEMS");
+
+    zwsdeque_reclaim(ctx.wd);
+    free(ctx.seen);
+    zwsdeque_free(ctx.wd);
+
+    return dups != 0;
+}
+
+
+static
+uint64_t ztest_rand64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+typedef struct timerwheel_test_ctx {
+    ztimerwheel_t  *tw;
+    uint64_t       *due;            //<! MAX(expire, tick at schedule)
+    uint8_t        *state;          //<! 0 pending, 1 fired, 2 cancelled
+    uint32_t        next;           //<! next free user id for re-arm
+    uint32_t        depth;
+    uint64_t        fired;
+    uint64_t        errors;
+}timerwheel_test_ctx_t;
+
+static
+void timerwheel_test_expire(void *arg, void **users, zcount_t count)
+{
+    timerwheel_test_ctx_t *ctx = arg;
+    uint64_t tick = ctx->tw->tick - 1;
+    zcount_t k;
+
+    for (k=0; k<count; ++k) {
+        uint32_t u = (uint32_t)(uintptr_t)users[k];
+        if (ctx->state[u] != 0 || ctx->due[u] != tick) {
+            ++ ctx->errors;
+        }
+        ctx->state[u] = 1;
+        ++ ctx->fired;
+
+        /* re-arm from the callback, some already due */
+        if ((u % 5) == 0 && ctx->next < ctx->depth) {
+            uint32_t r = ctx->next ++;
+            uint64_t expire = tick + (u % 3000) - 1;
+            ctx->due[r] = MAX(expire, ctx->tw->tick);
+            ztimerwheel_schedule(ctx->tw, expire, (void *)(uintptr_t)r);
+        }
+    }
+}
+
+typedef struct timerwheel_cancel_ctx {
+    ztimerwheel_t  *tw;
+    ztimer_id_t     ids[ZTW_BATCH * 2 + 89];
+    uint8_t         fired[ZTW_BATCH * 2 + 89];
+    ztimer_id_t     later;              //<! due on the next tick
+    uint64_t        errors;
+}timerwheel_cancel_ctx_t;
+
+/** cancel timers of the same tick not fired yet, and one of the next tick */
+static
+void timerwheel_cancel_expire(void *arg, void **users, zcount_t count)
+{
+    timerwheel_cancel_ctx_t *ctx = arg;
+    zcount_t k;
+
+    for (k=0; k<count; ++k) {
+        uint32_t u = (uint32_t)(uintptr_t)users[k];
+        ctx->errors += (ctx->fired[u] != 0);
+        ctx->fired[u] = 1;
+    }
+    if (ctx->later) {
+        ctx->errors += ztimerwheel_cancel(ctx->tw, ctx->ids[343]) != 0;
+        ctx->errors += ztimerwheel_cancel(ctx->tw, ctx->ids[ARRAY_SIZE(ctx->ids) - 1]) != 0;
+        ctx->errors += ztimerwheel_cancel(ctx->tw, ctx->later) != 1;
+        ctx->later = 0;
+    }
+}
+
+int ztimerwheel_test(int argc, char **argv)
+{
+    const uint32_t n = 200000;
+    timerwheel_test_ctx_t ctx;
+    ztimer_id_t *ids, far_id;
+    uint64_t seed = 88172645463325252ull, now = 1000, end = now + (1<<23);
+    uint64_t cancelled = 0, pending = 0;
+    uint32_t i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.depth = 2 * n;
+    ctx.tw    = ztimerwheel_malloc(now, 16);
+    ctx.due   = calloc(ctx.depth, sizeof(uint64_t));
+    ctx.state = calloc(ctx.depth, sizeof(uint8_t));
+    ids       = calloc(n, sizeof(ztimer_id_t));
+    ctx.next  = n;
+
+    for (i=0; i<n; ++i) {
+        uint64_t r = ztest_rand64(&seed);
+        uint64_t expire = (i % 10 == 0) ? now - r % 100 : now + r % (1 << (4 + i % 19));
+        ctx.due[i] = MAX(expire, now);
+        ids[i] = ztimerwheel_schedule(ctx.tw, expire, (void *)(uintptr_t)i);
+        assert(ids[i] != 0);
+    }
+    far_id = ztimerwheel_schedule(ctx.tw, now + (1ull << 40), 0);
+    assert(ztimerwheel_get_count(ctx.tw) == n + 1);
+
+    /* cancel 1/3, in random steps of advance */
+    while (now < end) {
+        now += ztest_rand64(&seed) % 4000;
+        ztimerwheel_advance(ctx.tw, now, timerwheel_test_expire, &ctx);
+        for (i=0; i<64; ++i) {
+            uint32_t k = (uint32_t)(ztest_rand64(&seed) % n);
+            if (k % 3 == 0) {
+                zcount_t ret = ztimerwheel_cancel(ctx.tw, ids[k]);
+                ctx.errors += (ret != (ctx.state[k] == 0));
+                if (ret) {
+                    ctx.state[k] = 2;
+                    ++ cancelled;
+                }
+            }
+        }
+    }
+    for (i=0; i<ctx.next; ++i) {
+        pending += (ctx.state[i] == 0);
+        ctx.errors += (ctx.state[i] == 0 && ctx.due[i] <= now);
+    }
+    ctx.errors += (ztimerwheel_get_count(ctx.tw) != pending + 1);
+    ctx.errors += (ztimerwheel_cancel(ctx.tw, far_id) != 1 || ztimerwheel_cancel(ctx.tw, far_id) != 0);
+
+    xprint("<ztimerwheel> %u timers + %u re-armed: fired %llu, cancelled %llu, pending %llu, errors=%llu\n",
+        n, ctx.next - n, (unsigned long long)ctx.fired, (unsigned long long)cancelled,
+        (unsigned long long)pending, (unsigned long long)ctx.errors);
+
+    free(ids);
+    free(ctx.due);
+    free(ctx.state);
+    ztimerwheel_free(ctx.tw);
+
+    /* cancel from the callback, the tick has more than ZTW_BATCH timers */
+    {
+        timerwheel_cancel_ctx_t cc;
+        uint32_t k;
+
+        memset(&cc, 0, sizeof(cc));
+        cc.tw = ztimerwheel_malloc(0, 16);
+        for (k=0; k<ARRAY_SIZE(cc.ids); ++k) {
+            cc.ids[k] = ztimerwheel_schedule(cc.tw, 5, (void *)(uintptr_t)k);
+        }
+        cc.later = ztimerwheel_schedule(cc.tw, 6, (void *)(uintptr_t)0);
+        cc.errors += ztimerwheel_advance(cc.tw, 10, timerwheel_cancel_expire, &cc) != ARRAY_SIZE(cc.ids);
+        for (k=0; k<ARRAY_SIZE(cc.ids); ++k) {
+            cc.errors += cc.fired[k] != 1;
+        }
+        cc.errors += ztimerwheel_get_count(cc.tw) != 0;
+
+        /* the free list is sound: another round fires them all once */
+        memset(cc.fired, 0, sizeof(cc.fired));
+        for (k=0; k<ARRAY_SIZE(cc.ids); ++k) {
+            cc.ids[k] = ztimerwheel_schedule(cc.tw, 20, (void *)(uintptr_t)k);
+        }
+        cc.errors += ztimerwheel_get_count(cc.tw) != ARRAY_SIZE(cc.ids);
+        cc.errors += ztimerwheel_advance(cc.tw, 20, timerwheel_cancel_expire, &cc) != ARRAY_SIZE(cc.ids);
+        for (k=0; k<ARRAY_SIZE(cc.ids); ++k) {
+            cc.errors += cc.fired[k] != 1;
+        }
+        cc.errors += ztimerwheel_get_count(cc.tw) != 0;
+
+        xprint("<ztimerwheel> cancel from the callback on a tick of %u timers, errors=%llu\n",
+            (uint32_t)ARRAY_SIZE(cc.ids), (unsigned long long)cc.errors);
+        ctx.errors += cc.errors;
+        ztimerwheel_free(cc.tw);
+    }
+
+    return ctx.errors != 0;
+}
+
+static
+void timerwheel_bench_expire(void *arg, void **users, zcount_t count)
+{
+    *(uint64_t *)arg += count;
+}
+
+int ztimerwheel_bench(int argc, char **argv)
+{
+    uint64_t total = argc > 1 ? strtoull(argv[1], 0, 0) : 10000000;
+    uint64_t seed = 88172645463325252ull, now = 0, fired = 0, i;
+    ztimer_id_t *ids = malloc(total * sizeof(ztimer_id_t));
+    ztimerwheel_t *tw = ztimerwheel_malloc(now, 1024);
+    double t0, t1, t2, t3;
+
+    t0 = ztest_now_sec();
+    for (i=0; i<total; ++i) {
+        ids[i] = ztimerwheel_schedule(tw, now + 1 + ztest_rand64(&seed) % (1<<20), 0);
+    }
+    t1 = ztest_now_sec();
+    for (i=0; i<total; i+=2) {
+        ztimerwheel_cancel(tw, ids[i]);
+    }
+    t2 = ztest_now_sec();
+    while (ztimerwheel_get_count(tw)) {
+        now += 1000;
+        ztimerwheel_advance(tw, now, timerwheel_bench_expire, &fired);
+    }
+    t3 = ztest_now_sec();
+
+    xprint("<ztimerwheel> %llu timers over 2^20 ticks: schedule %.1f ns, cancel %.1f ns, "
+        "expire %.1f ns per timer (%llu fired)\n", (unsigned long long)total,
+        (t1 - t0) * 1e9 / total, (t2 - t1) * 1e9 / ((total + 1) / 2),
+        (t3 - t2) * 1e9 / MAX(fired, 1), (unsigned long long)fired);
+
+    free(ids);
+    ztimerwheel_free(tw);
+    return fired != total / 2;
+}
+
+
+/** brute force aggregates of the last @n of @v[0 ... end-1] */
+static
+int zwindow_check(zwindow_t *zw, const double *v, int end, int n)
+{
+    double mn = v[end-1], mx = v[end-1], sum = 0, mean, var = 0;
+    int i;
+    for (i=end-n; i<end; ++i) {
+        mn = MIN(mn, v[i]);
+        mx = MAX(mx, v[i]);
+        sum += v[i];
+    }
+    mean = sum / n;
+    for (i=end-n; i<end; ++i) {
+        var += (v[i] - mean) * (v[i] - mean);
+    }
+    var /= n;
+    return zwindow_get_count(zw) == n && zwindow_get_min(zw) == mn && zwindow_get_max(zw) == mx
+        && fabs(zwindow_get_mean(zw) - mean) <= 1e-9 * fabs(mean) + 1e-9
+        && fabs(zwindow_get_var(zw) - var) <= 1e-6 * var + 1e-6;
+}
+
+int zwindow_test(int argc, char **argv)
+{
+    const int n = 200000, win = 100;
+    uint64_t seed = 88172645463325252ull;
+    double *v = malloc(n * sizeof(double));
+    int i, k, errors = 0;
+    zwindow_t *zw;
+
+    /* large offset & small noise: sums would drift without re-anchoring */
+    for (i=0; i<n; ++i) {
+        v[i] = 1e9 + (double)(ztest_rand64(&seed) % 100000) / 1000.0;
+    }
+
+    /* count window, single & batch push */
+    zw = zwindow_malloc(win, 0);
+    assert(zwindow_get_count(zw) == 0 && zwindow_get_max(zw) == 0);
+    for (i=0; i<n/2; ++i) {
+        zwindow_push(zw, v[i], i);
+        errors += !zwindow_check(zw, v, i + 1, MIN(i + 1, win));
+    }
+    for (; i<n; i+=k) {
+        k = (int)MIN(ztest_rand64(&seed) % 150, n - i);
+        zwindow_push_multi(zw, v + i, k, i);
+        if (i + k > 0) {
+            errors += !zwindow_check(zw, v, i + k, MIN(i + k, win));
+        }
+    }
+    zwindow_free(zw);
+
+    /* time window: sample i at t = i / 3, keeps t > now - 10 */
+    zw = zwindow_malloc(0, 10);
+    for (i=0; i<n; ++i) {
+        int first = 0;
+        zwindow_push(zw, v[i], i / 3);
+        while (first / 3 <= i / 3 - 10) {
+            ++ first;
+        }
+        errors += !zwindow_check(zw, v, i + 1, i + 1 - first);
+    }
+    zwindow_evict(zw, n / 3 + 100);
+    errors += (zwindow_get_count(zw) != 0 || zwindow_get_sum(zw) != 0);
+    zwindow_free(zw);
+
+    xprint("<zwindow> %d samples vs brute force, errors=%d\n", n, errors);
+
+    /* window 4096: aggregates per push vs iterating the whole window */
+    {
+        const int w = 4096, m = 4 * 1000 * 1000;
+        double t0, t1, t2, acc = 0;
+        zqueue_t *q = ZQUEUE_MALLOC_S(double, w);
+        zq_iter_t it;
+        double *p;
+
+        zw = zwindow_malloc(w, 0);
+        t0 = ztest_now_sec();
+        for (i=0; i<m; ++i) {
+            zwindow_push(zw, v[i % n], i);
+            acc += zwindow_get_min(zw) + zwindow_get_max(zw) + zwindow_get_mean(zw);
+        }
+        t1 = ztest_now_sec();
+        for (i=0; i<m/64; ++i) {
+            double mn = 1e300, mx = -1e300, sum = 0;
+            if (zqueue_get_count(q) == w) {
+                zqueue_pop_front(q, 0);
+            }
+            zqueue_push_back(q, &v[i % n]);
+            it = zqueue_iter(q);
+            for (p = zqueue_front(&it); p; p = zqueue_next(&it)) {
+                mn = MIN(mn, *p);
+                mx = MAX(mx, *p);
+                sum += *p;
+            }
+            acc += mn + mx + sum / zqueue_get_count(q);
+        }
+        t2 = ztest_now_sec();
+        xprint("<zwindow> window %d: %.1f ns/push+query, whole-queue iteration %.1f ns%s\n",
+            w, (t1 - t0) * 1e9 / m, (t2 - t1) * 1e9 / (m / 64), acc > 0 ? "" : " ?");
+        zqueue_free(q);
+        zwindow_free(zw);
+    }
+
+    free(v);
+    return errors;
+}
+
+
+int zfcstrq_test(int argc, char **argv)
+{
+    static const char *dir[] = {"usr", "usr/lib", "usr/share/doc", "var/log", "home/jeff/src"};
+    zcount_t total = argc > 1 ? (zcount_t)strtol(argv[1], 0, 0) : 200000;
+    uint64_t seed = 88172645463325252ull;
+    zstrq_t *sq = zstrq_malloc_chunked(1 << 20);
+    uint32_t bs, len;
+    zqidx_t i, j;
+    char buf[256];
+    int ok = 1;
+
+    for (i=0; i<total; ++i) {
+        uint64_t r = ztest_rand64(&seed);
+        int n = snprintf(buf, sizeof(buf), "/%s/pkg%u/file_%u.%s", dir[r % 5],
+            (unsigned)(r >> 8) % 300, (unsigned)(r >> 20) % 5000, (r >> 40) & 1 ? "c" : "h");
+        zstrq_push_back(sq, buf, n);
+    }
+    zstrq_push_back(sq, "", 0);
+    zstrq_push_back(sq, "/usr", 0);
+    zstrq_push_back(sq, "/usr", 0);
+    zstrq_sort(sq, 0);
+    total = zstrq_get_str_count(sq);
+
+    ok &= zfcstrq_build(sq, 8) == 0;
+    for (bs=ZFCSQ_BLOCK_MIN; bs<=ZFCSQ_BLOCK_MAX; bs*=2) {
+        zfcstrq_t *fc = zfcstrq_build(sq, bs);
+        zfcsq_iter_t iter;
+        double t0, t1;
+        zsq_char_t *str;
+
+        ok &= fc && zfcstrq_get_count(fc) == total;
+        if (!fc) {
+            break;
+        }
+
+        /* random access, and a truncated one */
+        for (i=0; i<total; i+=7) {
+            len = zfcstrq_get(fc, i, buf, sizeof(buf));
+            ok &= len == zstrq_get_str_size(sq, i) && memcmp(buf, zstrq_get_str_base(sq, i), len) == 0;
+        }
+        len = zfcstrq_get(fc, total - 1, buf, 5);
+        ok &= len == zstrq_get_str_size(sq, total - 1) && strlen(buf) == 4 &&
+              memcmp(buf, zstrq_get_str_base(sq, total - 1), 4) == 0;
+
+        /* sequential, from the start and from the middle of a block */
+        iter = zfcstrq_iter_open(fc, 0);
+        for (i=0; (str = zfcstrq_iter_next(&iter, &len)); ++i) {
+            ok &= len == zstrq_get_str_size(sq, i) && memcmp(str, zstrq_get_str_base(sq, i), len + 1) == 0;
+        }
+        ok &= i == total;
+        zfcstrq_iter_close(&iter);
+        iter = zfcstrq_iter_open(fc, bs + 3);
+        str = zfcstrq_iter_next(&iter, &len);
+        ok &= str && strcmp(str, zstrq_get_str_base(sq, bs + 3)) == 0;
+        zfcstrq_iter_close(&iter);
+
+        /* lookups of present keys, and of keys around them */
+        t0 = ztest_now_sec();
+        for (i=0; i<total; ++i) {
+            j = zfcstrq_find(fc, zstrq_get_str_base(sq, i), zstrq_get_str_size(sq, i));
+            ok &= j >= 0 && j <= i && zstrq_get_str_size(sq, j) == zstrq_get_str_size(sq, i) &&
+                  strcmp(zstrq_get_str_base(sq, j), zstrq_get_str_base(sq, i)) == 0;
+        }
+        t1 = ztest_now_sec();
+        for (i=0; i<total; i+=13) {
+            len = zstrq_get_str_size(sq, i);
+            memcpy(buf, zstrq_get_str_base(sq, i), len);
+            buf[len] = "0z~"[i % 3];
+            len = (i & 1) ? len + 1 : len / 2;
+            ok &= zfcstrq_find(fc, buf, len) < 0 || (i & 1) == 0;
+            /* lower bound: [j-1] < key <= [j] */
+            j = zfcstrq_lower_bound(fc, buf, len);
+            ok &= j >= 0 && j <= total;
+            if (j > 0) {
+                const zsq_char_t *s2 = zstrq_get_str_base(sq, j - 1);
+                uint32_t l2 = zstrq_get_str_size(sq, j - 1);
+                int r = memcmp(s2, buf, MIN(l2, len));
+                ok &= r < 0 || (r == 0 && l2 < len);
+            }
+            if (j < total) {
+                const zsq_char_t *s2 = zstrq_get_str_base(sq, j);
+                uint32_t l2 = zstrq_get_str_size(sq, j);
+                int r = memcmp(s2, buf, MIN(l2, len));
+                ok &= r > 0 || (r == 0 && l2 >= len);
+            }
+        }
+        ok &= zfcstrq_lower_bound(fc, "", 0) == 0 && zfcstrq_find(fc, "", 0) == 0;
+        ok &= zfcstrq_lower_bound(fc, "\xff", 1) == total;
+
+        zfcstrq_print_stats(fc, bs == 16 ? "block 16" : bs == 32 ? "block 32" : "block 64");
+        xprint("<zfcstrq> find: %.1f ns/key\n", (t1 - t0) * 1e9 / total);
+        zfcstrq_free(fc);
+    }
+
+    zstrq_free(sq);
+    xprint("<zfcstrq> test %s\n", ok ? "passed" : "FAILED");
+    return !ok;
+}
+
+typedef struct zacm_test_sig {
+    zcount_t    count;
+    uint64_t    sig;
+    uint64_t    first_end;
+    int         b_stop;
+}zacm_test_sig_t;
+
+static
+int zacm_test_on_match(void *ctx, zqidx_t pat, uint64_t end)
+{
+    zacm_test_sig_t *ts = ctx;
+    if (ts->count++ == 0) {
+        ts->first_end = end;
+    }
+    ts->sig += ((uint64_t)pat * 0x9e3779b97f4a7c15ull) ^ (end * 0xff51afd7ed558ccdull);
+    return ts->b_stop;
+}
+
+/** check one pattern set against a naive scan, whole and streamed */
+static
+int zacm_test_one(zstrq_t *pats, const char *text, size_t size, uint64_t *seed, const char *name)
+{
+    zacmatch_t *acm = zacmatch_build(pats);
+    zacm_test_sig_t ref = {0}, ts = {0};
+    zacm_stream_t st;
+    zcount_t npat = zstrq_get_str_count(pats), n;
+    size_t pos, chunk;
+    zqidx_t p;
+    int ok = acm != 0;
+
+    if (!acm) {
+        return 0;
+    }
+    ref.first_end = UINT64_MAX;
+    for (p=0; p<npat; ++p) {
+        const char *str = zstrq_get_str_base(pats, p);
+        uint32_t len = zstrq_get_str_size(pats, p);
+        for (pos=0; len && pos+len<=size; ++pos) {
+            if (memcmp(text + pos, str, len) == 0) {
+                ref.count += 1;
+                ref.sig += ((uint64_t)p * 0x9e3779b97f4a7c15ull) ^ ((pos + len) * 0xff51afd7ed558ccdull);
+                ref.first_end = MIN(ref.first_end, pos + len);
+            }
+        }
+    }
+
+    n = zacmatch_scan(acm, text, size, zacm_test_on_match, &ts);
+    ok &= n == ref.count && ts.count == ref.count && ts.sig == ref.sig;
+
+    /* streamed in random pieces */
+    memset(&ts, 0, sizeof(ts));
+    zacmatch_stream_init(&st);
+    for (pos=0, n=0; pos<size; pos+=chunk) {
+        chunk = MIN(size - pos, 1 + ztest_rand64(seed) % 40);
+        n += zacmatch_stream_feed(acm, &st, text + pos, chunk, zacm_test_on_match, &ts);
+    }
+    ok &= n == ref.count && ts.sig == ref.sig && st.off == size;
+
+    /* stop at the first match */
+    memset(&ts, 0, sizeof(ts));
+    ts.b_stop = 1;
+    zacmatch_stream_init(&st);
+    n = zacmatch_stream_feed(acm, &st, text, size, zacm_test_on_match, &ts);
+    ok &= ref.count ? (n == 1 && st.off == ref.first_end) : (n == 0 && st.off == size);
+
+    xprint("<zacmatch> %s: %d patterns, %u states x %u classes, prefilter %u/%u, %d matches\n",
+        name, npat, acm->nstate, acm->nclass, acm->pf_n[0], acm->pf_n[1], ref.count);
+    zacmatch_free(acm);
+    return ok;
+}
+
+int zacmatch_test(int argc, char **argv)
+{
+    static const char *lower = "abcdefghijklmnopqrstuvwxyz";
+    zcount_t total = argc > 1 ? (zcount_t)strtol(argv[1], 0, 0) : 2000;
+    uint64_t seed = 88172645463325252ull;
+    size_t size = 1 << 16, i, rec;
+    char *text = malloc(size + 1), buf[16];
+    zstrq_t *pats;
+    zacmatch_t *acm;
+    zacm_test_sig_t ts = {0};
+    double t0, t1, t2;
+    zcount_t n = 0, m = 0;
+    int ok = 1, k, len;
+
+    /* short patterns over a tiny alphabet: dense overlaps, 1-char ones, dups */
+    pats = zstrq_malloc_chunked(0);
+    for (k=0; k<50; ++k) {
+        len = 1 + ztest_rand64(&seed) % 5;
+        for (i=0; i<(size_t)len; ++i) {
+            buf[i] = "abcd"[ztest_rand64(&seed) % 4];
+        }
+        zstrq_push_back(pats, buf, len);
+    }
+    zstrq_push_back(pats, "abca", 4);
+    zstrq_push_back(pats, "abca", 4);
+    zstrq_push_back(pats, "", 0);
+    for (i=0; i<size; ++i) {
+        text[i] = "abcde"[ztest_rand64(&seed) % 5];
+    }
+    ok &= zacm_test_one(pats, text, size, &seed, "abcd");
+    zstrq_free(pats);
+
+    /* q[ux]... in words: pair prefilter */
+    pats = zstrq_malloc_chunked(0);
+    for (k=0; k<200; ++k) {
+        len = 2 + ztest_rand64(&seed) % 4;
+        buf[0] = 'q';
+        buf[1] = "ux"[k & 1];
+        for (i=2; i<(size_t)len; ++i) {
+            buf[i] = "aeiou"[ztest_rand64(&seed) % 5];
+        }
+        zstrq_push_back(pats, buf, len);
+    }
+    for (i=0; i<size; ++i) {
+        uint64_t r = ztest_rand64(&seed);
+        text[i] = (r & 7) == 0 ? ' ' : (r & 0x38) == 0 ? 'q' : (r & 0x1c0) == 0 ? 'u' :
+                  (r & 0x600) == 0 ? "aeiou"[(r >> 11) % 5] : lower[(r >> 16) % 26];
+    }
+    ok &= zacm_test_one(pats, text, size, &seed, "qu");
+    zstrq_free(pats);
+
+    /* many patterns, all bytes: table prefilter, 256 classes */
+    pats = zstrq_malloc_chunked(0);
+    for (k=0; k<256; ++k) {
+        buf[0] = (char)k;
+        buf[1] = (char)(255 - k);
+        zstrq_push_back(pats, buf, 1 + (k & 1));
+    }
+    for (i=0; i<size; ++i) {
+        text[i] = (char)ztest_rand64(&seed);
+    }
+    ok &= zacm_test_one(pats, text, size, &seed, "binary");
+    zstrq_free(pats);
+
+    /* bench: @total words against records of 256 chars, vs strstr */
+    pats = zstrq_malloc_chunked(0);
+    for (k=0; k<total; ++k) {
+        len = 4 + ztest_rand64(&seed) % 8;
+        for (i=0; i<(size_t)len; ++i) {
+            buf[i] = lower[ztest_rand64(&seed) % 26];
+        }
+        zstrq_push_back(pats, buf, len);
+    }
+    acm = zacmatch_build(pats);
+    ok &= acm != 0;
+    for (i=0; i<size; ++i) {
+        uint64_t r = ztest_rand64(&seed);
+        text[i] = (r & 7) == 0 ? ' ' : lower[(r >> 8) % 26];
+    }
+    for (rec=0; rec<size; rec+=256) {
+        text[rec + 255] = 0;
+    }
+    text[size] = 0;
+
+    t0 = ztest_now_sec();
+    for (k=0; acm && k<64; ++k) {
+        for (rec=0; rec<size; rec+=256) {
+            n += zacmatch_scan(acm, text + rec, 255, zacm_test_on_match, &ts);
+        }
+    }
+    t1 = ztest_now_sec();
+    for (rec=0; rec<size; rec+=256) {
+        for (k=0; k<total; ++k) {
+            const char *hit = text + rec, *str = zstrq_get_str_base(pats, k);
+            while ((hit = strstr(hit, str))) {
+                m += 1;
+                hit += 1;
+            }
+        }
+    }
+    t2 = ztest_now_sec();
+    ok &= n == 64 * m;
+    if (acm) {
+        xprint("<zacmatch> %d patterns, %u states x %u classes, %.1f KB\n", total,
+            acm->nstate, acm->nclass, zacmatch_get_mem_size(acm) / 1024.0);
+    }
+    xprint("<zacmatch> scan %.1f MB/s, strstr loop %.2f MB/s, %d matches\n",
+        64.0 * size / (t1 - t0) / 1e6, size / (t2 - t1) / 1e6, m);
+    zacmatch_free(acm);
+    zstrq_free(pats);
+
+    free(text);
+    xprint("<zacmatch> test %s\n", ok ? "passed" : "FAILED");
+    return !ok;
+}
+
+typedef struct zstrq_bench_ref {
+    const zsq_char_t   *str;
+    uint32_t            len;
+}zstrq_bench_ref_t;
+
+static
+int zstrq_bench_cmpf(const void *a, const void *b)
+{
+    const zstrq_bench_ref_t *x = a, *y = b;
+    int r = memcmp(x->str, y->str, MIN(x->len, y->len));
+    return r ? r : (x->len > y->len) - (x->len < y->len);
+}
+
+int zstrq_sort_bench(int argc, char **argv)
+{
+    static const char *scheme[] = {"http://", "https://"};
+    static const char *tld[] = {"com", "org", "net", "io", "cn"};
+    static const char *dir[] = {"news", "item", "user", "static/img", "api/v2", "search"};
+    zcount_t total = argc > 1 ? (zcount_t)strtol(argv[1], 0, 0) : 10000000;
+    uint64_t seed = 88172645463325252ull, bytes = 0;
+    zstrq_t *sq = zstrq_malloc_chunked(1 << 20);
+    uint32_t *perm = malloc(sizeof(uint32_t) * total);
+    uint32_t *lcp = malloc(sizeof(uint32_t) * total);
+    zstrq_bench_ref_t *ref = malloc(sizeof(zstrq_bench_ref_t) * total);
+    double t0, t1, t2, t3;
+    zcount_t i;
+    int ok = 1;
+
+    for (i=0; i<total; ++i) {
+        char url[128];
+        uint64_t r = ztest_rand64(&seed);
+        int len = snprintf(url, sizeof(url), "%swww.site%u.%s/%s/%u?id=%u",
+            scheme[r & 1], (unsigned)(r >> 8) % 2000, tld[(r >> 4) % 5], 
+            dir[(r >> 24) % 6], (unsigned)(r >> 32) % 100000, (unsigned)(r >> 40) % 1000);
+        zstrq_push_back(sq, url, len);
+        bytes += len;
+    }
+    for (i=0; i<total; ++i) {
+        ref[i].str = zstrq_get_str_base(sq, i);
+        ref[i].len = zstrq_get_str_size(sq, i);
+    }
+
+    t0 = ztest_now_sec();
+    zstrq_sort_perm(sq, perm, 0);
+    t1 = ztest_now_sec();
+    zstrq_sort_perm(sq, perm, lcp);
+    t2 = ztest_now_sec();
+    qsort(ref, total, sizeof(zstrq_bench_ref_t), zstrq_bench_cmpf);
+    t3 = ztest_now_sec();
+
+    for (i=0; i<total; ++i) {
+        ok &= ref[i].str == zstrq_get_str_base(sq, perm[i]) ||
+              zstrq_bench_cmpf(&ref[i], &(zstrq_bench_ref_t){zstrq_get_str_base(sq, perm[i]), 
+                                          zstrq_get_str_size(sq, perm[i])}) == 0;
+    }
+
+    xprint("<zstrq> sort %d URL-like strings (%.1f bytes avg): "
+        "multikey qsort %.2f s, +lcp %.2f s, qsort(memcmp) %.2f s, %s\n",
+        total, (double)bytes / MAX(total, 1), t1 - t0, t2 - t1, t3 - t2, ok ? "same order" : "MISMATCH");
+
+    free(ref);
+    free(lcp);
+    free(perm);
+    zstrq_free(sq);
+    return !ok;
+}
+
 int main(int argc, char **argv)
 {
     int i=0, j = 0;
@@ -351,9 +2938,26 @@ int main(int argc, char **argv)
     const static yuv_module_t sub_main[] = {
         {"list",    zlist_test,     ""},
         {"array",   zarray_test,    ""},
+        {"queue",   zqueue_test,    ""},
+        {"qbench",  zqueue_bench,   "[count] zqueue access & sort bench"},
+        {"qstats",  zqueue_stats_test, "zqueue telemetry, needs make ZQUEUE_TELEMETRY=1"},
         {"strq",    zstrq_test,     ""},
+        {"fcstrq",  zfcstrq_test,   "[count] front-coded zstrq test"},
+        {"acmatch", zacmatch_test,  "[count] multi-pattern matcher test & bench, 2000 patterns by default"},
+        {"sqsort",  zstrq_sort_bench, "[count] zstrq sort bench, 10M URL-like strings by default"},
         {"hash",    zhash_test,     ""},
         {"zhtree",  zhtree_test,    ""},
+        {"hashbench", zhash_bench,  "[bytes] zhash hash functions throughput & bucket distribution"},
+        {"hashdel", zhash_del_test, "[churn] zhash deletion test"},
+        {"rehash",  zhash_rehash_test, "[count] zhash & zhtree growth, per-insert latency, 4M keys by default"},
+        {"htbench", zhash_engine_bench, "[count ...] chained vs open-addressing zhash, 1M & 10M keys by default"},
+        {"spscq",   zspscq_test,    "[count] spsc ring test & bench"},
+        {"mpmcq",   zmpmcq_test,    "[count] mpmc queue test & contention bench"},
+        {"bqueue",  zbqueue_test,   "[count] blocking queue test"},
+        {"wsdeque", zwsdeque_test,  "[count] work-stealing deque test"},
+        {"timerwheel", ztimerwheel_test, ""},
+        {"twbench", ztimerwheel_bench, "[count] timer wheel bench, 10M timers by default"},
+        {"window",  zwindow_test,   "sliding-window aggregates test & bench"},
     };
 
     xlog_init(SLOG_DEFAULT);